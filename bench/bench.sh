@@ -0,0 +1,159 @@
+#!/bin/bash
+# Runs the benchmark workloads made by gen.sh, and measures each phase
+#
+# Usage: bench.sh [-b binary] [-s scale] [-r runs] [workload ...]
+#   -b : the LexicalAnalyzer to measure (bin/LexicalAnalyzer)
+#   -s : multiplies the size of every workload (1)
+#   -r : how many times each is run; the fastest run counts (3)
+#   The workloads are loop, stmts, deep, concat and list (all of them).
+#
+# Writes one line of JSON per workload to stdout, with the keys always in
+# the same order, so two runs can be compared with compare.sh:
+#   {"workload":"loop","scale":1000000,"bytes":210,"tokens":60,"ast_nodes":35,
+#    "lex_ms":0.05,"lex_mb_s":4.2,"parse_ms":0.04,"parse_nodes_s":875000,
+#    "type_check_ms":0.01,"interpret_ms":310.2,"ops":9000007,"interpret_ops_s":29013000,
+#    "elf32_ms":2.1,"elf64_ms":1.9}
+# A table of the same numbers is written to stderr.
+# The times come from the -stats option, except for the compiled
+# executables, which are timed from outside.
+
+dir=$(cd "$(dirname "$0")" && pwd)
+binary=$dir/../bin/LexicalAnalyzer
+scale=1
+runs=3
+
+while getopts "b:s:r:" opt
+do
+  case $opt in
+  b) binary=$OPTARG ;;
+  s) scale=$OPTARG ;;
+  r) runs=$OPTARG ;;
+  *) sed -n '3,9s/^# \{0,1\}//p' "$0" >&2; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+workloads=("$@")
+[ ${#workloads[@]} -eq 0 ] && workloads=(loop stmts deep concat list)
+
+if [ ! -x "$binary" ]
+then
+  echo "No LexicalAnalyzer at '$binary'. Run make first." >&2
+  exit 1
+fi
+
+# The size of each workload at scale 1
+size()
+{
+  case $1 in
+  loop)   echo 1000000 ;;
+  stmts)  echo 20000 ;;
+  deep)   echo 20000 ;;
+  concat) echo 100000 ;;
+  list)   echo 20000 ;;
+  esac
+}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Gets a number from a line of -stats output
+field()
+{
+  sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p" <<< "$2"
+}
+
+# Gets the wall time of a phase from a line of -stats output
+phase()
+{
+  sed -n "s/.*\"phase\":\"$1\",\"wall_ms\":\([0-9.]*\).*/\1/p" <<< "$2"
+}
+
+# The smaller of two times, where an empty one has not been measured yet
+least()
+{
+  awk -v a="$1" -v b="$2" 'BEGIN { print ((a == "" || b + 0 < a + 0) ? b : a) }'
+}
+
+# Milliseconds one run of a command takes
+run_time()
+{
+  local start end
+  start=$(date +%s%N)
+  "$@" < /dev/null > /dev/null 2>&1
+  end=$(date +%s%N)
+  awk -v t=$((end - start)) 'BEGIN { printf "%.3f\n", t / 1000000 }'
+}
+
+# a / b, or 0 if b is 0
+ratio()
+{
+  awk -v a="$1" -v b="$2" -v m="${3:-1}" 'BEGIN { printf "%.0f\n", (b > 0 ? a * m / b : 0) }'
+}
+
+printf "%-8s %9s %10s %10s %14s %10s %13s %16s %10s %10s\n" \
+  workload scale lex_mb_s parse_ms parse_nodes_s check_ms interpret_ms interpret_ops_s elf32_ms elf64_ms >&2
+
+for workload in "${workloads[@]}"
+do
+  n=$(size "$workload")
+  if [ -z "$n" ]
+  then
+    echo "Unknown workload '$workload'" >&2
+    exit 1
+  fi
+  n=$(awk -v n="$n" -v s="$scale" 'BEGIN { printf "%d\n", (n * s >= 1 ? n * s : 1) }')
+
+  program=$work/$workload.txt
+  "$dir/gen.sh" "$workload" "$n" > "$program" || exit 1
+  bytes=$(wc -c < "$program")
+
+  # The phases of the interpreter, fastest of the runs
+  lex= parse= check= interpret= stats=
+  for ((i = 0; i < runs; i++))
+  do
+    stats=$("$binary" -no-print -stats "$program" < /dev/null 2>&1 > /dev/null | grep '^{"file"')
+    if ! grep -q '"ok":true' <<< "$stats"
+    then
+      echo "$workload did not run:" >&2
+      "$binary" -no-print "$program" < /dev/null > /dev/null
+      exit 1
+    fi
+    lex=$(least "$lex" "$(phase lex "$stats")")
+    parse=$(least "$parse" "$(phase parse "$stats")")
+    check=$(least "$check" "$(phase type-check "$stats")")
+    interpret=$(least "$interpret" "$(phase interpret "$stats")")
+  done
+  tokens=$(field tokens "$stats")
+  nodes=$(field ast_nodes "$stats")
+
+  # How many nodes the interpreter executed, from the total -op-stats prints
+  ops=$("$binary" -no-print -op-stats "$program" < /dev/null 2>&1 > /dev/null |
+        sed -n 's/^Executed nodes: \([0-9]*\)$/\1/p')
+
+  # The executables, for both machines
+  elf32= elf64=
+  "$binary" -a -elf -o "$work/elf32" "$program" &&
+  "$binary" -a -m64 -elf -o "$work/elf64" "$program" || exit 1
+  for ((i = 0; i < runs; i++))
+  do
+    elf32=$(least "$elf32" "$(run_time "$work/elf32")")
+    elf64=$(least "$elf64" "$(run_time "$work/elf64")")
+  done
+
+  lex_mb_s=$(awk -v b="$bytes" -v t="$lex" 'BEGIN { printf "%.2f\n", (t > 0 ? b / t / 1000 : 0) }')
+  parse_nodes_s=$(ratio "$nodes" "$parse" 1000)
+  interpret_ops_s=$(ratio "$ops" "$interpret" 1000)
+
+  printf '{"workload":"%s","scale":%d,"bytes":%d,"tokens":%d,"ast_nodes":%d,' \
+    "$workload" "$n" "$bytes" "$tokens" "$nodes"
+  printf '"lex_ms":%s,"lex_mb_s":%s,"parse_ms":%s,"parse_nodes_s":%s,' \
+    "$lex" "$lex_mb_s" "$parse" "$parse_nodes_s"
+  printf '"type_check_ms":%s,"interpret_ms":%s,"ops":%d,"interpret_ops_s":%s,' \
+    "$check" "$interpret" "$ops" "$interpret_ops_s"
+  printf '"elf32_ms":%s,"elf64_ms":%s}\n' "$elf32" "$elf64"
+
+  printf "%-8s %9d %10s %10s %14s %10s %13s %16s %10s %10s\n" \
+    "$workload" "$n" "$lex_mb_s" "$parse" "$parse_nodes_s" "$check" \
+    "$interpret" "$interpret_ops_s" "$elf32" "$elf64" >&2
+done
@@ -0,0 +1,58 @@
+#!/bin/bash
+# Compares two result files written by bench.sh
+#
+# Usage: compare.sh old.jsonl new.jsonl
+#
+# For every workload in both, prints each time and rate with its speedup:
+# how many times faster the new run is, so above 1 is better for both.
+
+if [ $# -ne 2 ]
+then
+  echo "USAGE: $0 old.jsonl new.jsonl" >&2
+  exit 1
+fi
+
+awk '
+# Splits a line of bench.sh output into key value pairs
+function parse(line, values,    pairs, n, i, kv)
+{
+  gsub(/[{}"]/, "", line)
+  n = split(line, pairs, ",")
+  for (i = 1; i <= n; i++)
+  {
+    split(pairs[i], kv, ":")
+    values[kv[1]] = kv[2]
+    if (FNR == 1 && NR == FNR)
+      order[++keys] = kv[1]
+  }
+}
+
+NR == FNR {
+  parse($0, row)
+  for (k in row)
+    old[row["workload"], k] = row[k]
+  delete row
+  next
+}
+
+{
+  parse($0, row)
+  w = row["workload"]
+  if (!((w, "workload") in old))
+    next
+  printf "%s\n", w
+  for (i = 1; i <= keys; i++)
+  {
+    k = order[i]
+    if (k !~ /(_ms|_s)$/)
+      continue
+    a = old[w, k]
+    b = row[k]
+    if (k ~ /_ms$/)
+      speedup = b > 0 ? a / b : 0
+    else
+      speedup = a > 0 ? b / a : 0
+    printf "  %-16s %14s %14s %8.2fx\n", k, a, b, speedup
+  }
+  delete row
+}' "$1" "$2"
@@ -0,0 +1,115 @@
+#!/bin/bash
+# Writes a benchmark program to stdout
+#
+# Usage: gen.sh workload scale
+#   loop   : a while loop of arithmetic and a condition, run scale times
+#   stmts  : scale straight line statements
+#   deep   : scale terms, in expressions 500 terms deep
+#   concat : a string grown by scale appends
+#   list   : a list literal of scale ints, then summed
+#
+# The programs read no input, and print a few lines at the end,
+# so they run the same in the interpreter and compiled.
+
+workload=$1
+scale=$2
+
+if [ -z "$workload" ] || ! [ "$scale" -gt 0 ] 2>/dev/null
+then
+  echo "USAGE: $0 loop|stmts|deep|concat|list scale" >&2
+  exit 1
+fi
+
+case $workload in
+loop)
+  cat <<END
+# A loop of arithmetic and a condition
+var i = 0;
+var s = 0;
+var t = 0;
+while i < $scale do
+  s = s + i * 3;
+  if s > 1000000 then
+    s = s - 1000000;
+    t = t + 1;
+  end
+  i = i + 1;
+end
+println(s);
+println(t);
+END
+  ;;
+stmts)
+  # Assignments, conditions and declarations, over and over
+  awk -v n="$scale" 'BEGIN {
+    print "# Straight line statements"
+    print "var a = 1;"
+    print "var b = 2;"
+    print "var c = 0;"
+    for (i = 0; i < n; i++)
+    {
+      k = i % 4
+      if (k == 0) printf "a = a + %d;\n", i % 97
+      else if (k == 1) printf "b = a - b / %d;\n", i % 13 + 2
+      else if (k == 2) printf "if a > b then c = c + 1; else c = c - 1; end\n"
+      else printf "int v%d = b + a / %d;\n", i, i % 7 + 1
+    }
+    print "println(a);"
+    print "println(b);"
+    print "println(c);"
+  }'
+  ;;
+deep)
+  # Expressions are right associative, so a chain of terms is as deep as it is long
+  awk -v n="$scale" 'BEGIN {
+    print "# Deep expressions"
+    print "var x = 3;"
+    print "var y = 0;"
+    depth = 500
+    for (done = 0; done < n; done += depth)
+    {
+      terms = n - done < depth ? n - done : depth
+      printf "y = y"
+      for (i = 0; i < terms; i++)
+        printf " %s %s", (i % 3 == 0 ? "-" : "+"), (i % 2 ? "x" : i % 10 + 1)
+      print ";"
+      print "x = x + 1;"
+    }
+    print "println(x);"
+    print "println(y);"
+  }'
+  ;;
+concat)
+  cat <<END
+# A string grown one piece at a time
+string s = "";
+var i = 0;
+while i < $scale do
+  s = s + "ab" + i;
+  i = i + 1;
+end
+println(s);
+println("pieces: " + i);
+END
+  ;;
+list)
+  awk -v n="$scale" 'BEGIN {
+    print "# A big list literal, summed"
+    printf "var l = ["
+    for (i = 0; i < n; i++)
+      printf "%s%d", (i ? ", " : ""), i % 1000
+    print "];"
+    print "var i = 0;"
+    print "var s = 0;"
+    printf "while i < %d do\n", n
+    print "  s = s + l[i];"
+    print "  i = i + 1;"
+    print "end"
+    print "println(s);"
+  }'
+  ;;
+*)
+  echo "Unknown workload '$workload'" >&2
+  exit 1
+  ;;
+esac
@@ -5,7 +5,50 @@
 
 #include <iostream>
 #include <list>
+#include <set>
 #include <string>
+#include <vector>
+
+#include "Instruction.h"
+
+// The machine the assembly is generated for
+enum class Target
+{
+	X86,   // 32-bit, int 80h system calls (nasm -f elf32)
+	X86_64 // 64-bit, syscall system calls (nasm -f elf64)
+};
+
+// The system calls the runtime procedures make
+enum class Syscall
+{
+	READ, WRITE, EXIT,
+	BRK // Moves the end of the heap. Returns the new end, or the old one if it could not be moved.
+};
+
+// The kinds of entries in the .data section
+enum class DataKind
+{
+	STRING, // A 0 terminated string with a string header, followed by a <name>len equ of its length
+	EQU,    // An assembly time constant
+	WORD,   // A 16-bit integer
+	BYTE    // An 8-bit integer
+};
+
+// An entry of the .data section
+struct Constant
+{
+	std::string name;
+	DataKind kind;
+	std::string text; // The characters of a STRING
+	int value;        // The value of everything else
+};
+
+// An entry of the .bss section
+struct Variable
+{
+	std::string name;
+	int size; // In bytes
+};
 
 class Procedure
 {
@@ -13,37 +56,112 @@ public:
 	// Constructor
 	Procedure(std::string);
 
-	// Add a string instruction
-	void add_instruction(std::string in)
-		{ instructions.push_back(in); };
+	// Add an instruction
+	void add(Op op, const Operand& dst = Operand(), const Operand& src = Operand())
+		{ instructions.push_back(Instruction{op, dst, src}); }
+
+	// Add a label at the current position
+	void add_label(const std::string& label)
+		{ add(Op::LABEL, sym(label)); }
 
 	std::string get_name()
 		{ return name; }
 
+	// Gets the instructions, in order
+	std::vector<Instruction>& get_instructions()
+		{ return instructions; }
+
 private:
 	// Name of this procedure
 	std::string name;
 
-	// List of lines in .text section
-	std::list<std::string> instructions;
+	// The body of the procedure
+	std::vector<Instruction> instructions;
 
 	// To access private members without accessors
-	friend std::ostream& operator<<(std::ostream&, const Procedure&);
+	friend class AsmStructure;
 };
 
 /// A structure that contains all assembly data
+///
+/// A string is the address of its 0 terminated characters, which follow a
+/// header of two words: the capacity, then the length. The runtime procedures
+/// never change the strings they are given; results are new strings on a heap
+/// that grows with brk. Results only live until release is called at the end
+/// of the statement, except for the buffers of string variables, which strset
+/// and strcat grow by doubling and which are never released.
+///
+/// A list is the address of its elements, which follow a word holding their
+/// number, the same as the length of a string. Ints and strings take a word
+/// each and bools a byte. The string elements are buffers owned by the list,
+/// set with strset like string variables. Lists are never released.
 class AsmStructure
 {
 public:
+	// Size in bytes of the shared buffer that words of the input are copied into and numbers
+	// are converted in, including the terminating 0
+	static const int STRING_SIZE = 4096;
+
+	// Size in bytes of the output buffer the print procedures append to
+	static const int OUTPUT_SIZE = 4096;
+
+	// Size in bytes of the input buffer readint and readstr take words from
+	static const int INPUT_SIZE = 65536;
+
+	// Smallest number of bytes the heap grows by
+	static const int HEAP_CHUNK = 0x10000;
+
 	// Constructor
-	AsmStructure();
+	// Takes the machine to generate code for
+	AsmStructure(Target = Target::X86);
 
 	// Destructor
 	~AsmStructure();
 
+	// Gets the machine code is generated for
+	Target get_target()
+		{ return target; }
+
+	// Gets the size in bytes of a register, and of int and bool variables
+	int word_size()
+		{ return target == Target::X86_64 ? 8 : 4; }
+
+	// Gets how far to shift an index left to get the offset of a word
+	int word_shift()
+		{ return target == Target::X86_64 ? 3 : 2; }
+
+	// Sets whether the runtime procedures use SSE2.
+	// They do by default on X86_64, where every CPU has it.
+	void set_sse2(bool s)
+		{ sse2 = s; }
+
+	// Gets whether the runtime procedures use SSE2
+	bool uses_sse2()
+		{ return sse2; }
+
+	// Adds a system call to a procedure.
+	// The arguments are passed in ebx, ecx and edx, and only eax is changed,
+	// the same as int 80h, whatever the target is.
+	void add_syscall(Procedure*, Syscall);
+
 	// Converts the structure into assembly as puts it in the passed in stream
 	void convert(std::ostream&);
 
+	// Renders a single instruction as nasm text for the target
+	std::string render(const Instruction&);
+
+	// Gets the procedures, in order
+	std::list<Procedure*>& get_procedures()
+		{ return procedures; }
+
+	// Gets the entries of the .data section, in order
+	const std::vector<Constant>& get_constants()
+		{ return constants; }
+
+	// Gets the entries of the .bss section, in order
+	const std::vector<Variable>& get_variables()
+		{ return variables; }
+
 	// Add a string constant to the program
 	void add_constant(std::string, std::string);
 
@@ -62,45 +180,82 @@ public:
 	// Adds a buffer variable to the program
 	void add_buffer_variable();
 
+	// Whether printed output is buffered, and so needs a call to flush before exiting
+	bool buffers_output()
+		{ return added.count("flush") > 0; }
+
 	// Adds bool string constants to the program
 	void add_bool_constants();
 
+	// Adds the empty string constant, emptystr, to the program
+	void add_empty_string();
+
+	// Adds the alloc procedure and the heap it allocates from to the program
+	void add_alloc_proc();
+
+	// Adds the release procedure to the program
+	void add_release_proc();
+
+	// Adds the strnew procedure to the program
+	void add_strnew_proc();
+
+	// Adds the strfrom procedure to the program
+	void add_strfrom_proc();
+
+	// Adds the strset procedure to the program
+	void add_strset_proc();
+
+	// Adds the strcat procedure to the program
+	void add_strcat_proc();
+
 	// Adds the print procedure to the program
 	void add_print_proc();
 
 	// Adds the sprint procedure to the program
 	void add_sprint_proc();
 
+	// Adds the bufwrite procedure to the program
+	void add_bufwrite_proc();
+
+	// Adds the flush procedure and the output buffer to the program
+	void add_flush_proc();
+
 	// Adds the bprint procedure to the program
 	void add_bprint_proc();
 
-	// Adds the uiprint procedure to the program
-	void add_uiprint_proc();
+	// Adds the iprint procedure to the program
+	void add_iprint_proc();
+
+	// Adds the todigits procedure and the digit pairs it uses to the program
+	void add_todigits_proc();
 
 	// Adds the sprintLF procedure to the program
 	void add_printLF_proc();
 
-	// Adds the strlen procedure to the program
-	void add_strlen_proc();
-
 	// Adds the readstr procedure to the program
 	void add_readstr_proc();
 
 	// Adds the readint procedure to the program
 	void add_readint_proc();
 
+	// Adds the readword procedure to the program
+	void add_readword_proc();
+
+	// Adds the fill procedure and the input buffer to the program
+	void add_fill_proc();
+
 	// Adds the atoi procedure to the program
 	void add_atoi_proc();
 
 	// Adds the itoa procedure to the program
 	void add_itoa_proc();
 
-	// Adds the strcpy procedure to the program
-	void add_strcpy_proc();
-
 	// Adds the strcmp procedure to the program
 	void add_strcmp_proc();
 
+	// Adds the streq procedure to the program
+	void add_streq_proc();
+
 	// Adds the append procedure to the program
 	void add_append_proc();
 
@@ -113,12 +268,64 @@ public:
 	// Adds the straddbool procedure to the program
 	void add_straddbool_proc();
 
+	// Adds the listnew procedure to the program
+	void add_listnew_proc();
+
+	// Adds the listcopy procedure to the program
+	void add_listcopy_proc();
+
+	// Adds the strlistcopy procedure to the program
+	void add_strlistcopy_proc();
+
+	// Adds the outofbounds procedure to the program
+	void add_outofbounds_proc();
+
+	// Adds the memcopy procedure to the program
+	void add_memcopy_proc();
+
 private:
-	// List of lines in .data section
-	std::list<std::string> constants;
+	// Renders an operand for the target
+	std::string render(const Operand&);
+
+	// Gets the name of a register of the given width on the target
+	std::string register_name(Reg, Size);
+
+	// Gets the length and capacity fields of the string header before the
+	// characters a register points to
+	Operand length_of(Reg r)
+		{ return mem(r, -word_size()); }
+
+	Operand capacity_of(Reg r)
+		{ return mem(r, -2 * word_size()); }
+
+	// Copies ecx bytes from esi to edi, leaving esi and edi after them and ecx 0,
+	// as rep movsb does. With SSE2 this is a call to memcopy.
+	void add_copy(Procedure*);
+
+	// With SSE2, compares the ecx bytes at esi and edi 16 at a time, jumping
+	// to a label at the first block that differs. Fewer than 16 bytes are left
+	// to the .words label, which must come next. Changes eax.
+	// Without SSE2 it adds nothing.
+	void add_block_compare(Procedure*, const std::string&);
+
+	// Returns true the first time it is called with a name, and false after that.
+	// Keeps each runtime procedure and shared constant from being added twice.
+	bool first_use(const std::string&);
+
+	// The machine code is generated for
+	Target target;
+
+	// Whether the runtime procedures use SSE2
+	bool sse2;
+
+	// Entries of the .data section
+	std::vector<Constant> constants;
+
+	// Entries of the .bss section
+	std::vector<Variable> variables;
 
-	// List of lines in .bss section
-	std::list<std::string> variables;
+	// Names passed to first_use
+	std::set<std::string> added;
 
 	// List of procedures
 	std::list<Procedure*> procedures;
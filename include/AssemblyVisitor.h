@@ -3,7 +3,10 @@
 
 // Declares the AssemblyVisitor class
 
+#include <set>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "ast.h"
 #include "AsmStructure.h"
@@ -18,12 +21,16 @@ class AssemblyVisitor : public AbstractVisitor
 {
 public:
   // Constructor
-  // Takes an output stream to print to
-  AssemblyVisitor();
+  // Takes the machine to generate code for
+  AssemblyVisitor(Target = Target::X86);
 
 	// Outputs the created structure
 	void output(std::ostream&);
 
+	// Gets the created structure
+	AsmStructure& get_structure()
+		{ return *asms; }
+
   // The overridden functions from AbstractVisitor
   void visit(StmtList&) override;
   void visit(BasicIf&) override;
@@ -42,6 +49,80 @@ public:
   void visit(NotBoolExpr&) override;
 
 private:
+  // Compares the operands of a relation, leaving only the flags set.
+  // Gets the conditional jump taken when the relation is true.
+  Op compare(ComplexBoolExpr&);
+
+  // Jumps to a label if a boolean expression is true, or if it is false, and
+  // falls through otherwise. The rest of an and or an or is only worked out
+  // when the relation before it does not decide.
+  void branch(BoolExpr&, bool, const std::string&);
+
+  // Whether an expression is integer or boolean arithmetic on variables and
+  // constants, which gen can compile without the stack
+  bool allocatable(Expr&);
+
+  // Gets the Sethi-Ullman number of an allocatable expression: the number of
+  // registers it needs, or 0 if it can be used as an operand directly
+  unsigned need(Expr&);
+
+  // Gets an allocatable expression that needs no registers as an operand
+  Operand operand(Expr&);
+
+  // Gets the type of an allocatable expression
+  Type expr_type(Expr&);
+
+  // Whether an allocatable expression can be compiled straight into the
+  // register of a variable without overwriting it before it is read
+  bool in_place(Expr&, const std::string&);
+
+  // Compiles an allocatable expression into a register,
+  // using only the registers in the mask as scratch
+  void gen(Expr&, Reg, unsigned);
+
+  // Compiles the division of two allocatable expressions into a register
+  void gen_divide(Expr&, Expr&, Reg, unsigned);
+
+  // Compiles an allocatable expression into a register if the scratch
+  // registers are enough for it. Returns whether it did.
+  bool gen_expr(Expr&, Reg);
+
+  // Gets the operand holding the value of an integer or boolean variable
+  Operand variable(const std::string&);
+
+  // Keeps the most used variables of a loop in callee-saved registers,
+  // loading them before it. Returns the variables promoted.
+  std::vector<std::string> promote(WhileStmt&);
+
+  // Stores the promoted variables that were assigned back, and frees their registers
+  void demote(const std::vector<std::string>&);
+
+  // Frees the strings allocated since the last call, if any were
+  void release();
+
+  // Adds a string literal to the program. Returns the name of its constant.
+  std::string literal(const std::string&);
+
+  // Whether an expression is a list variable, used as a whole
+  bool list_variable(Expr&);
+
+  // Gets the size in bytes of an element of a list of a type
+  int element_size(Type);
+
+  // Whether an index is a constant inside a list whose length never changes,
+  // so it needs no bounds check. Gets the constant. No index means the first element.
+  bool known_index(const std::string&, Expr*, long long&);
+
+  // Loads eax with an element of a list. No index means the first element.
+  void load_element(const std::string&, Expr*);
+
+  // Stores the value of an expression in an element of a list. No index means the first element.
+  void store_element(const std::string&, Expr*, Expr&);
+
+  // Gives a list variable a whole list: a list literal, a copy of another list,
+  // or a single value. No expression means an empty list.
+  void define_list(const std::string&, Expr*);
+
   // The assembly structure
   AsmStructure* asms;
 
@@ -53,6 +134,21 @@ private:
 
   // Tracks identifiers and types
   std::unordered_map<std::string,Type> id_map;
+
+  // The variables kept in registers, and their registers
+  std::unordered_map<std::string,Reg> reg_vars;
+
+  // The variables kept in registers that have been assigned to
+  std::set<std::string> reg_dirty;
+
+  // Whether the code since the last release allocates strings
+  bool temps;
+
+  // The list variables, and their length if it never changes, or -1
+  std::unordered_map<std::string, int> lists;
+
+  // The lengths of the lists given to each variable, from VarUseVisitor
+  std::unordered_map<std::string, int> lengths;
 };
 
 #endif // ASSEMBLYVISITOR_H_INCLUDED
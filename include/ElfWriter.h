@@ -0,0 +1,36 @@
+#ifndef ELFWRITER_H_INCLUDED
+#define ELFWRITER_H_INCLUDED
+
+// Declares the ElfWriter class
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "AsmStructure.h"
+
+/// Writes an AsmStructure as a static ELF executable, so no assembler or
+/// linker is needed. The headers and .text share a read-only executable
+/// segment, and .data and .bss share a writable one on the next page.
+class ElfWriter
+{
+public:
+  // Constructor
+  // Takes the structure to write
+  ElfWriter(AsmStructure&);
+
+  // Encodes the structure and writes the executable to the stream
+  void write(std::ostream&);
+
+private:
+  // Appends a little endian value of the native word size
+  void word(std::vector<uint8_t>&, uint64_t);
+
+  // The structure being written
+  AsmStructure& asms;
+
+  // Whether the target is X86_64
+  bool x64;
+};
+
+#endif // ELFWRITER_H_INCLUDED
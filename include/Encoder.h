@@ -0,0 +1,124 @@
+#ifndef ENCODER_H_INCLUDED
+#define ENCODER_H_INCLUDED
+
+// Declares the Encoder class
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "AsmStructure.h"
+
+// Where a symbol is defined
+enum class Section
+{
+  TEXT, DATA, BSS,
+  ABSOLUTE // An equ constant, not an address
+};
+
+// A label, variable or constant the Encoder knows
+struct Symbol
+{
+  // Where it is defined
+  Section section;
+
+  // The offset in its section, or the value of an ABSOLUTE symbol
+  uint64_t value;
+};
+
+/// Translates an AsmStructure into x86 machine code and data, choosing the
+/// same encodings an assembler would for the output of AsmStructure::convert.
+/// Jumps start out short and are made long only when their target is too far
+/// away, so the sizes are settled by layout before any addresses are chosen.
+class Encoder
+{
+public:
+  // Constructor
+  // Takes the structure to encode
+  Encoder(AsmStructure&);
+
+  // Lays out the three sections, settling the size of every instruction
+  void layout();
+
+  // Encodes the .text section for the given section addresses
+  void encode(uint64_t text, uint64_t data, uint64_t bss);
+
+  // Gets the size in bytes of each section. Known after layout.
+  uint64_t text_size()
+    { return text_bytes; }
+
+  uint64_t data_size()
+    { return data.size(); }
+
+  uint64_t bss_size()
+    { return bss_bytes; }
+
+  // Gets the machine code. Filled in by encode.
+  const std::vector<uint8_t>& get_text()
+    { return text; }
+
+  // Gets the contents of the .data section
+  const std::vector<uint8_t>& get_data()
+    { return data; }
+
+  // Gets every symbol, by full name
+  const std::map<std::string, Symbol>& get_symbols()
+    { return symbols; }
+
+  // Gets the address of a symbol, or the value of an ABSOLUTE one
+  uint64_t address(const std::string&);
+
+private:
+  // An instruction or label and where it goes
+  struct Placed
+  {
+    const Instruction* in; // 0 for a label
+    std::string label;     // The full name of a label
+    std::string scope;     // The label local labels are relative to
+    uint64_t offset;       // From the start of .text
+    unsigned size;
+    bool long_jump;        // Jumps only: rel32 instead of rel8
+  };
+
+  // Encodes one instruction at its place
+  void encode(const Placed&, std::vector<uint8_t>&);
+
+  // Appends the prefixes, opcode and ModRM bytes of an instruction with one
+  // register or memory operand, and a register or opcode extension in the reg field
+  void emit(std::vector<uint8_t>&, const std::vector<uint8_t>&, bool, unsigned, bool,
+            const Operand&, const std::string&);
+
+  // Gets the value of an IMM operand, or of the symbol and offset of a SYM or MEM operand.
+  // Sets absolute to whether it is a constant rather than an address.
+  int64_t resolve(const Operand&, const std::string&, bool& absolute);
+
+  // Gets the full name of a label used in a scope
+  std::string full_name(const std::string&, const std::string&);
+
+  // Gets whether an operand is 64 bits wide on the target
+  bool wide(const Operand&);
+
+  // The structure being encoded
+  AsmStructure& asms;
+
+  // Whether the target is X86_64
+  bool x64;
+
+  // Every instruction, in order
+  std::vector<Placed> placed;
+
+  // Every symbol, by full name
+  std::map<std::string, Symbol> symbols;
+
+  // The addresses of the sections, in Section order
+  uint64_t bases[3];
+
+  // The sections
+  std::vector<uint8_t> text;
+  std::vector<uint8_t> data;
+  uint64_t text_bytes;
+  uint64_t bss_bytes;
+};
+
+#endif // ENCODER_H_INCLUDED
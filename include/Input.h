@@ -0,0 +1,54 @@
+#ifndef INPUT_H_INCLUDED
+#define INPUT_H_INCLUDED
+
+// Declares the Input class
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Reads what a stream has ready into a buffer, waiting for at least one byte,
+// as read does on a file descriptor. Gives how many bytes it read, 0 at the end.
+std::streamsize read_some(std::istream&, char*, std::streamsize);
+
+// The Input class reads a stream in large blocks and splits it into the words
+// that readint and readstr take. Every byte up to a space is white space.
+class Input
+{
+public:
+  // Constructor
+  // Takes the stream to read, and the stream to flush before waiting for it
+  Input(std::istream&, std::ostream&);
+
+  // Reads the next word. Gives an empty string at the end of the input.
+  std::string word();
+
+  // Reads the next word as an int: a '-' if it is negative, and the digits
+  // that follow. Gives 0 if the word does not start with them, or at the end of the input.
+  int integer();
+
+private:
+  // Skips white space. Gives whether a word follows.
+  bool skip();
+
+  // Reads the next block of the input. Gives whether there was one.
+  bool fill();
+
+  // Whether a byte is white space
+  static bool space(char c)
+    { return static_cast<unsigned char>(c) <= ' '; }
+
+  // Size in bytes of the biggest block read at once
+  static const std::streamsize SIZE = 65536;
+
+  // The stream read, and the stream flushed before reading
+  std::istream& in;
+  std::ostream& prompt;
+
+  // The block being read, how much of it there is, and how much is used
+  std::vector<char> buffer;
+  std::size_t len;
+  std::size_t pos;
+};
+
+#endif // INPUT_H_INCLUDED
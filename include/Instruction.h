@@ -0,0 +1,138 @@
+#ifndef INSTRUCTION_H_INCLUDED
+#define INSTRUCTION_H_INCLUDED
+
+// Declares the typed instruction representation that procedures are built from
+
+#include <string>
+
+// The operation an Instruction performs
+enum class Op
+{
+  LABEL, // Marks the position of the label in dst, not a machine instruction
+  MOV, MOVZX, LEA, PUSH, POP,
+  ADD, SUB, MUL, IMUL, DIV, IDIV, NEG, NOT, INC, DEC,
+  AND, OR, XOR, SHL, SHR, SAR, CDQ,
+  CMP, TEST,
+  JMP, JE, JNE, JL, JLE, JG, JGE, JB, JBE, JA, JAE,
+  CALL, RET, INT, SYSCALL, REP_MOVSB,
+  MOVDQU, PCMPEQB, PMOVMSKB // SSE2
+};
+
+// The general purpose registers, in hardware encoding order
+enum class Reg
+{
+  AX, CX, DX, BX, SP, BP, SI, DI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+  NONE
+};
+
+// The width of a register or memory operand
+// NATIVE is the register width of the target: 32 bits on X86, 64 bits on X86_64.
+// XMM is the 128-bit SSE register with the same number as the Reg, and
+// 16 bytes of memory.
+enum class Size
+{
+  NATIVE, BYTE, WORD, DWORD, QWORD, XMM
+};
+
+// The kind of value an Operand holds
+enum class OperandKind
+{
+  NONE, // No operand
+  REG,  // A register
+  IMM,  // An integer constant
+  SYM,  // The address of a label, plus an offset
+  MEM   // A memory location: [symbol + base + index + offset]
+};
+
+// One operand of an Instruction
+struct Operand
+{
+  // Constructor
+  // Creates an empty operand
+  Operand();
+
+  // What this operand is
+  OperandKind kind;
+
+  // The width of a REG or MEM operand
+  Size size;
+
+  // The register of REG, and the base register of MEM
+  Reg base;
+
+  // The index register of MEM
+  Reg index;
+
+  // The value of IMM, and the offset of SYM and MEM
+  long long value;
+
+  // The label of SYM, and the label MEM is relative to
+  std::string symbol;
+};
+
+// Compares two operands
+bool operator==(const Operand&, const Operand&);
+bool operator!=(const Operand&, const Operand&);
+
+/// Operand builders
+// A register
+Operand reg(Reg, Size = Size::NATIVE);
+
+// An integer constant
+Operand imm(long long);
+
+// The address of a label, plus an offset
+Operand sym(const std::string&, long long = 0);
+
+// The memory at a label
+Operand mem(const std::string&, Size = Size::NATIVE);
+
+// The memory at a label plus a register
+Operand mem(const std::string&, Reg, Size = Size::NATIVE);
+
+// The memory at a register plus an offset
+Operand mem(Reg, long long = 0, Size = Size::NATIVE);
+
+// The memory at the sum of two registers plus an offset
+Operand mem(Reg, Reg, long long = 0, Size = Size::NATIVE);
+
+// Native width registers, named after their 32-bit forms
+extern const Operand EAX, EBX, ECX, EDX, ESI, EDI, ESP, EBP;
+
+// Low byte registers
+extern const Operand AL, BL, CL, DL;
+
+// SSE registers
+extern const Operand XMM0, XMM1;
+
+// A single instruction
+struct Instruction
+{
+  // The operation
+  Op op;
+
+  // The destination operand, or the only operand
+  Operand dst;
+
+  // The source operand
+  Operand src;
+};
+
+// Whether an operation is a jump, conditional or not
+bool is_jump(Op);
+
+// Gets the bit for a register in a register mask, bit n for Reg n
+inline unsigned bit(Reg r)
+  { return r == Reg::NONE ? 0 : 1u << static_cast<unsigned>(r); }
+
+// Every register in a register mask
+const unsigned ALL_REGS = 0xffff;
+
+// Masks of the registers an instruction reads and writes.
+// Writes to part of a register count as reading it too.
+// What a call does depends on the procedure called, so only the stack pointer is included.
+unsigned reads(const Instruction&);
+unsigned writes(const Instruction&);
+
+#endif // INSTRUCTION_H_INCLUDED
@@ -4,12 +4,64 @@
 // Declares the Interpreter class
 
 #include <forward_list>
+#include <memory>
+#include <unordered_map>
 
+#include "Input.h"
+#include "Profiler.h"
 #include "ast.h"
 #include "environment.h"
 #include "vardata.h"
 #include "all_type.h"
 
+// The fused operations that a node can be quickened into after its first execution
+enum class QuickOp
+{
+  GENERIC,      // No fused form exists, the generic visit is run
+  LOAD_CONST,   // A literal SimpleExpr whose value is cached
+  LOAD_LOCAL,   // An identifier SimpleExpr whose VarData is cached
+  INC_LOCAL,    // id = id + INT or id = id - INT on an int variable
+  APPEND_LOCAL, // id = id + expr on a string variable
+  CMP_LOCAL     // id REL INT on an int variable, without a boolean connector
+};
+
+// The cached, type-specialized form of a node
+struct QuickNode
+{
+  // Constructor
+  // Creates a node that runs the generic visit
+  QuickNode() :
+    op(QuickOp::GENERIC),
+    var(nullptr),
+    var_type(INT),
+    constant(0),
+    rel(TokenType::UNKNOWN),
+    operand(nullptr),
+    value(0)
+  {}
+
+  // The fused operation to perform
+  QuickOp op;
+
+  // The variable the operation works on
+  VarData* var;
+
+  // The type the variable was declared with
+  Type var_type;
+
+  // The integer operand of INC_LOCAL and CMP_LOCAL
+  int constant;
+
+  // The relation of CMP_LOCAL
+  TokenType rel;
+
+  // The operand appended by APPEND_LOCAL
+  Expr* operand;
+
+  // The value of LOAD_CONST
+  all_type value;
+};
+
 // The Interpreter class interprets and executes the AST.
 class Interpreter : public AbstractVisitor
 {
@@ -21,6 +73,21 @@ public:
   // For when there is an error
   void error(const Token&, const std::string&);
 
+  // Turns on counting of executed node shapes
+  void set_op_stats(bool s)
+    { op_stats = s; }
+
+  // Prints how many nodes were executed in all, on a line of its own
+  // ("Executed nodes: N"), then the most frequently executed node shapes and statement pairs
+  void print_op_stats(std::ostream&);
+
+  // Turns on the profiler, which finds the statements the time goes to
+  void set_profile(ProfileMode);
+
+  // Prints the hot statements of a file, and writes its stacks in the folded format
+  void print_profile(std::ostream&, const std::string&);
+  void write_folded(std::ostream&, const std::string&);
+
   // The overridden functions from AbstractVisitor
   void visit(StmtList&) override;
   void visit(BasicIf&) override;
@@ -39,6 +106,20 @@ public:
   void visit(NotBoolExpr&) override;
 
 private:
+  // Finds the VarData of an identifier, or nullptr if it is undeclared
+  VarData* lookup(const std::string&);
+
+  // Evaluates a boolean expression, using the fused compare when the node has one
+  bool test(BoolExpr&);
+
+  // Builds the quickened forms of nodes on their first execution
+  QuickNode& quicken(SimpleExpr&);
+  QuickNode& quicken(AssignStmt&);
+  QuickNode& quicken(ComplexBoolExpr&);
+
+  // Counts one execution of a node shape, when op_stats is on
+  void count_op(const char*, QuickOp, bool);
+
   // Reference to the output stream
   std::ostream& out;
 
@@ -48,8 +129,27 @@ private:
   // Holds the value obtained in an expr
   all_type it;
 
+  // Where readint and readstr take words from
+  Input input;
+
   // Stores references to the environments in a LIFO order
   std::forward_list<std::unique_ptr<Environment<VarData>>> environments;
+
+  // The quickened forms of nodes that have been executed, keyed by node address
+  std::unordered_map<const void*, QuickNode> quick;
+
+  // Whether executed node shapes are counted
+  bool op_stats;
+
+  // Execution counts of node shapes, and of consecutive statement shape pairs
+  std::unordered_map<std::string, unsigned long> op_counts;
+  std::unordered_map<std::string, unsigned long> pair_counts;
+
+  // The shape of the previously executed statement
+  std::string last_stmt;
+
+  // Told when every statement starts and ends, when profiling is on
+  std::unique_ptr<Profiler> profiler;
 };
 
 #endif // INTERPRETER_H_INCLUDED
@@ -0,0 +1,251 @@
+#ifndef IR_H_INCLUDED
+#define IR_H_INCLUDED
+
+// Declares the classes of the SSA intermediate representation
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "all_type.h"
+
+// The operations of the IR
+enum class IrOp
+{
+  UNDEF,              // The value of a variable before it is declared
+  CONST,              // A literal
+  LOAD,               // Reads a variable that is not in SSA form, like a list
+  COPY,               // The same value as its operand
+  PHI,                // Picks an operand by the block control came from
+  ADD, SUB, MUL, DIV, // The math relations, for every type they work on
+  EQ, NE, LT, GT, LE, GE,
+  AND, OR, NOT,
+  READ,               // readint or readstr, with the prompt as the name
+  INDEX,              // Reads an element of a list, or the first one without an index
+  LIST,               // Makes a list of its operands
+  STORE,              // Writes a variable that is not in SSA form, or an element of one
+  PRINT, PRINTLN,
+  JUMP, BRANCH        // End a block
+};
+
+// Gets the name of an operation, as the IR is printed
+const char* ir_name(IrOp);
+
+class IrBlock;
+
+// An instruction, and the value it makes if it makes one
+class IrValue
+{
+public:
+  // Constructor
+  IrValue(unsigned, IrOp, Type);
+
+  // Whether the instruction does nothing but make its value
+  bool pure() const;
+
+  // The number it is printed with
+  unsigned id;
+
+  // What it does
+  IrOp op;
+
+  // The type of the value
+  Type type;
+
+  // The values it uses
+  std::vector<IrValue*> operands;
+
+  // The blocks a PHI's operands come from, or a JUMP or BRANCH goes to
+  std::vector<IrBlock*> targets;
+
+  // The value of a CONST
+  all_type constant;
+
+  // The variable of a LOAD, STORE, INDEX or PHI, or the prompt of a READ
+  std::string name;
+
+  // The first variable given the value. It can stand in for the value where
+  // it still holds it.
+  std::string home;
+
+  // The block it is in, or null once a pass has taken it out
+  IrBlock* block;
+
+  // The value that a pass replaced it with
+  IrValue* replacement;
+};
+
+// A straight run of instructions, ending with a JUMP or BRANCH unless the
+// program ends there
+class IrBlock
+{
+public:
+  // Constructor
+  IrBlock(unsigned);
+
+  // The number it is printed with
+  unsigned id;
+
+  // The instructions, in order
+  std::vector<IrValue*> values;
+
+  // The blocks control comes from and goes to
+  std::vector<IrBlock*> preds;
+  std::vector<IrBlock*> succs;
+
+  // The closest block that control always passes through to get here
+  IrBlock* idom;
+};
+
+// Where a variable in SSA form got its value: an assignment or declaration,
+// or a join of control flow that it was given different values before
+class IrSite
+{
+public:
+  // Constructor
+  // Takes the variable, and the statement and the list it is in for an assignment
+  IrSite(const std::string&, Stmt*, StmtList*);
+
+  // The variable
+  std::string var;
+
+  // The statement that gave the value, or null for a join
+  Stmt* stmt;
+
+  // The list the statement is in
+  StmtList* list;
+
+  // The sites that reach a join
+  std::vector<IrSite*> incoming;
+
+  // Whether the value is read anywhere
+  bool live;
+};
+
+// What a variable in SSA form holds at some point, and where it got it
+struct IrDef
+{
+  IrValue* value;
+  IrSite* site;
+};
+
+// What every variable in SSA form holds at some point
+typedef std::map<std::string, IrDef> IrDefs;
+
+// A variable a loop adds the same constant to on every way around it
+struct IrInduction
+{
+  // The variable
+  std::string var;
+
+  // What it holds each time the condition is tested
+  IrValue* phi;
+
+  // What it holds once the constant is added
+  IrValue* next;
+
+  // The constant
+  int step;
+};
+
+// A while loop
+class IrLoop
+{
+public:
+  // Constructor
+  // Takes the block before the loop, the block testing the condition, and
+  // the statement and the list it is in
+  IrLoop(IrBlock*, IrBlock*, WhileStmt*, StmtList*);
+
+  // The block that only leads into the loop. What does not change in the
+  // loop is worked out here.
+  IrBlock* preheader;
+
+  // The block testing the condition
+  IrBlock* header;
+
+  // Every block in the loop, including the loops in it
+  std::set<IrBlock*> blocks;
+
+  // The statement
+  WhileStmt* stmt;
+
+  // The list it is in
+  StmtList* list;
+
+  // What the variables held before the loop
+  std::shared_ptr<const IrDefs> defs;
+
+  // What the variables hold at the end of the statements in the loop
+  std::shared_ptr<const IrDefs> end_defs;
+
+  // Its induction variables
+  std::vector<IrInduction> inductions;
+};
+
+// A whole program in SSA form
+class IrProgram
+{
+public:
+  // Constructor
+  IrProgram();
+
+  // Adds a block
+  IrBlock* add_block();
+
+  // Adds an instruction to the end of a block
+  IrValue* add(IrBlock*, IrOp, Type, const std::vector<IrValue*>& = {});
+
+  // Adds a site
+  IrSite* add_site(const std::string&, Stmt*, StmtList*);
+
+  // Adds a loop
+  IrLoop* add_loop(IrBlock*, IrBlock*, WhileStmt*, StmtList*);
+
+  // Adds a control flow edge
+  void link(IrBlock*, IrBlock*);
+
+  // Gets the value that stands for a value, following replacements
+  IrValue* resolve(IrValue*);
+
+  // Has every use of a value use another value instead
+  void replace(IrValue*, IrValue*);
+
+  // Makes every operand refer to the value it stands for, and takes
+  // replaced values out of their blocks
+  void forward();
+
+  // Gets the blocks. The first one is where the program starts.
+  const std::vector<std::unique_ptr<IrBlock>>& get_blocks()
+    { return blocks; }
+
+  // Gets every instruction ever added, including the ones taken out
+  const std::vector<std::unique_ptr<IrValue>>& get_values()
+    { return values; }
+
+  // Gets every site
+  const std::vector<std::unique_ptr<IrSite>>& get_sites()
+    { return sites; }
+
+  // Gets the loops, each before the loops in it
+  const std::vector<std::unique_ptr<IrLoop>>& get_loops()
+    { return loops; }
+
+  // Gets the number of instructions still in blocks
+  unsigned size();
+
+  // Prints the program
+  void print(std::ostream&);
+
+private:
+  std::vector<std::unique_ptr<IrBlock>> blocks;
+  std::vector<std::unique_ptr<IrValue>> values;
+  std::vector<std::unique_ptr<IrSite>> sites;
+  std::vector<std::unique_ptr<IrLoop>> loops;
+};
+
+#endif // IR_H_INCLUDED
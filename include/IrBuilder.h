@@ -0,0 +1,153 @@
+#ifndef IRBUILDER_H_INCLUDED
+#define IRBUILDER_H_INCLUDED
+
+// Declares the IrBuilder class
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "Ir.h"
+
+// A place in the AST holding an expression, which the IrRewriter can fill
+// with something simpler
+struct IrSlot
+{
+  // The expression
+  std::shared_ptr<Expr> expr;
+
+  // Puts another expression in its place
+  std::function<void(std::shared_ptr<Expr>)> set;
+
+  // Its value
+  IrValue* value;
+
+  // The block it was worked out in
+  IrBlock* block;
+
+  // The statement it is in
+  Stmt* stmt;
+
+  // What the variables held while it was worked out
+  std::shared_ptr<const IrDefs> defs;
+};
+
+// The IrBuilder class lowers a type checked AST to an IrProgram in SSA form.
+// Scalar variables that are declared once, with a value, are put in SSA form.
+// Lists, and variables declared more than once, are loaded and stored.
+// It remembers where each value came from in the AST, for the IrRewriter.
+class IrBuilder : public AbstractVisitor
+{
+public:
+  // Constructor
+  // Takes the program to build into
+  IrBuilder(IrProgram&);
+
+  // Lowers a whole program
+  void build(StmtList&);
+
+  // Gets the places in the AST that hold expressions, in the order they are worked out
+  std::vector<IrSlot>& get_slots()
+    { return slots; }
+
+  // Gets the site of the value each read of a variable in SSA form reads
+  std::unordered_map<ASTNode*, IrSite*>& get_reads()
+    { return reads; }
+
+  // Gets the declared type of each variable in SSA form
+  const std::map<std::string, Type>& get_tracked()
+    { return tracked; }
+
+  // The overridden functions from AbstractVisitor
+  void visit(StmtList&) override;
+  void visit(BasicIf&) override;
+  void visit(IfStmt&) override;
+  void visit(WhileStmt&) override;
+  void visit(PrintStmt&) override;
+  void visit(VarDecStmt&) override;
+  void visit(AssignStmt&) override;
+  void visit(SimpleExpr&) override;
+  void visit(IndexExpr&) override;
+  void visit(ListExpr&) override;
+  void visit(ReadExpr&) override;
+  void visit(ComplexExpr&) override;
+  void visit(SimpleBoolExpr&) override;
+  void visit(ComplexBoolExpr&) override;
+  void visit(NotBoolExpr&) override;
+
+private:
+  // Finds the variables a list of statements declares and assigns
+  void scan(StmtList&, std::set<std::string>&, bool);
+
+  // Lowers an expression and remembers where it is
+  IrValue* lower(std::shared_ptr<Expr>, std::function<void(std::shared_ptr<Expr>)>);
+
+  // Adds an instruction to the current block
+  IrValue* add(IrOp, Type, const std::vector<IrValue*>& = {});
+
+  // Ends the current block with a jump
+  void jump(IrBlock*);
+
+  // Gives a variable in SSA form a value
+  void bind(const std::string&, IrValue*, Stmt*);
+
+  // Gets the value an assignment gives its variable
+  IrValue* assigned_value(std::shared_ptr<Expr>, std::function<void(std::shared_ptr<Expr>)>);
+
+  // Joins what the variables hold at the ends of blocks, in a block they all lead to
+  std::shared_ptr<IrDefs> join(IrBlock*, const std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>>&);
+
+  // Gets what the variables hold, to change it
+  IrDefs& change_defs();
+
+  // Lowers one condition of an if statement and the statements it runs
+  void lower_arm(BasicIf&, std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>>&);
+
+  // Joins the ends of the arms of an if statement
+  void finish_if(std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>>&);
+
+  // The program being built
+  IrProgram& program;
+
+  // Where instructions are added
+  IrBlock* block;
+
+  // The list of statements being lowered, and the statement
+  StmtList* list;
+  Stmt* statement;
+
+  // What the variables in SSA form hold now
+  std::shared_ptr<IrDefs> defs;
+
+  // The value of the expression last lowered
+  IrValue* value;
+
+  // The value of variables before they are declared
+  IrValue* undef;
+
+  // How many times each variable is declared, and with what type
+  std::map<std::string, int> declarations;
+  std::map<std::string, Type> types;
+
+  // The list variables
+  std::set<std::string> lists;
+
+  // Variables that cannot be in SSA form
+  std::set<std::string> excluded;
+
+  // The variables in SSA form, and their types
+  std::map<std::string, Type> tracked;
+
+  // The places in the AST holding expressions
+  std::vector<IrSlot> slots;
+
+  // The site each read of a variable in SSA form reads
+  std::unordered_map<ASTNode*, IrSite*> reads;
+};
+
+#endif // IRBUILDER_H_INCLUDED
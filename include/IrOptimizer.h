@@ -0,0 +1,74 @@
+#ifndef IROPTIMIZER_H_INCLUDED
+#define IROPTIMIZER_H_INCLUDED
+
+// Declares the IrOptimizer class
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Ir.h"
+
+// The IrOptimizer class runs the passes over an IrProgram, and times them.
+//   constant propagation: works out math and relations on constants
+//   copy propagation:     uses the operand of a COPY, or of a PHI that only has one
+//   value numbering:      uses the first of the values that are worked out the same way
+//   loop invariant code motion: works out what a loop does not change before the loop
+//   induction variables:  finds the variables each loop adds a constant to
+//   dead code elimination: takes out the values that nothing uses
+// The first four run again until none of them changes anything.
+class IrOptimizer
+{
+public:
+  // Constructor
+  // Takes the program to optimize
+  IrOptimizer(IrProgram&);
+
+  // Runs every pass
+  void run();
+
+  // Runs a step and adds how long it took to its time.
+  // The step gives how many things it changed, which is passed on.
+  unsigned time(const std::string&, std::function<unsigned()>);
+
+  // Prints how long each step took, and how much it changed
+  void print_timing(std::ostream&);
+
+private:
+  // The passes. Each gives how many instructions it changed.
+  unsigned constant_propagation();
+  unsigned copy_propagation();
+  unsigned value_numbering();
+  unsigned loop_invariant_code_motion();
+  unsigned induction_variables();
+  unsigned dead_code_elimination();
+
+  // Works out the value of an instruction whose operands are constants.
+  // Gives whether it can.
+  bool fold(IrValue*, all_type&);
+
+  // Finds the immediate dominator of each block, and gives the blocks in reverse postorder
+  std::vector<IrBlock*> dominators();
+
+  // Numbers the values of a block and the blocks it dominates
+  unsigned number(IrBlock*, std::map<IrBlock*, std::vector<IrBlock*>>&, std::map<std::string, IrValue*>&);
+
+  // The program being optimized
+  IrProgram& program;
+
+  // How long a step took in all, how many times it ran, and what it changed
+  struct Timing
+  {
+    std::string step;
+    double seconds;
+    unsigned runs;
+    unsigned changes;
+  };
+
+  // The steps, in the order they first ran
+  std::vector<Timing> timings;
+};
+
+#endif // IROPTIMIZER_H_INCLUDED
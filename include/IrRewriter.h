@@ -0,0 +1,107 @@
+#ifndef IRREWRITER_H_INCLUDED
+#define IRREWRITER_H_INCLUDED
+
+// Declares the IrRewriter class
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "ast.h"
+#include "Ir.h"
+#include "IrBuilder.h"
+
+// The IrRewriter class writes what the IrOptimizer found back into the AST
+// the IrBuilder lowered, so that the Interpreter and the AssemblyVisitor both
+// run the optimized program.
+//  - An expression that is a constant becomes the constant.
+//  - An expression whose value a variable still holds becomes that variable.
+//  - An expression a loop does not change is worked out into a variable of
+//    its own before the loop, and the loop reads the variable.
+//  - An induction variable times a constant is kept in a variable of its
+//    own, which the loop adds to instead of multiplying.
+//  - An assignment that nothing reads is taken out, and so is a declaration
+//    of a variable that nothing uses any more.
+// Only expressions that do nothing but make a value are taken out.
+class IrRewriter : public AbstractVisitor
+{
+public:
+  // Constructor
+  // Takes the optimized program and the builder that made it
+  IrRewriter(IrProgram&, IrBuilder&);
+
+  // Rewrites the AST. Gives how many expressions and statements it changed.
+  unsigned rewrite(StmtList&);
+
+  // The overridden functions from AbstractVisitor.
+  // They find the reads and assignments of each variable.
+  void visit(StmtList&) override;
+  void visit(BasicIf&) override;
+  void visit(IfStmt&) override;
+  void visit(WhileStmt&) override;
+  void visit(PrintStmt&) override;
+  void visit(VarDecStmt&) override;
+  void visit(AssignStmt&) override;
+  void visit(SimpleExpr&) override;
+  void visit(IndexExpr&) override;
+  void visit(ListExpr&) override;
+  void visit(ReadExpr&) override;
+  void visit(ComplexExpr&) override;
+  void visit(SimpleBoolExpr&) override;
+  void visit(ComplexBoolExpr&) override;
+  void visit(NotBoolExpr&) override;
+
+private:
+  // Fills a place in the AST with something simpler, if it can.
+  // Gives whether it did.
+  bool simplify(IrSlot&);
+
+  // Moves an expression a loop does not change out of the loop, if it can.
+  // Gives whether it did.
+  bool hoist(IrSlot&, StmtList&);
+
+  // Replaces an induction variable times a constant with a variable that is
+  // added to as the induction variable is. Gives whether it did.
+  bool reduce(IrSlot&, StmtList&);
+
+  // Whether the variables an expression reads hold the same values before a
+  // loop as where the expression is
+  bool available(Expr&, IrSlot&, IrLoop&);
+
+  // Declares a new variable at the start of the program, and gives its name.
+  // The declaration is marked as made from the given statement.
+  std::string declare(const std::string&, Type, StmtList&, const Token&, Stmt*);
+
+  // Remembers that an expression and the ones in it are no longer where they were
+  void forget(Expr&);
+
+  // Whether an expression does nothing but make its value
+  bool pure(Expr&);
+
+  // Marks the value from a site as read, and the values it joins
+  void mark(IrSite*);
+
+  // The optimized program
+  IrProgram& program;
+
+  // The builder that made it
+  IrBuilder& builder;
+
+  // How many times each variable is read or assigned, not counting declarations
+  std::map<std::string, unsigned> references;
+
+  // The variable holding each value moved out of a loop
+  std::map<std::pair<IrValue*, IrLoop*>, std::string> hoisted;
+
+  // The variable holding each induction variable times a constant
+  std::map<std::pair<IrValue*, long long>, std::string> reduced;
+
+  // How many variables have been declared
+  unsigned declared;
+
+  // The expressions moved out of their loops, or dropped for a variable
+  std::set<ASTNode*> moved;
+};
+
+#endif // IRREWRITER_H_INCLUDED
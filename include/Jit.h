@@ -0,0 +1,53 @@
+#ifndef JIT_H_INCLUDED
+#define JIT_H_INCLUDED
+
+// Declares the Jit class
+
+#include <csetjmp>
+#include <cstdint>
+#include <iostream>
+
+#include "AsmStructure.h"
+
+/// Runs an X86_64 AsmStructure in this process. The structure is encoded into
+/// memory below 2GB, where its absolute addresses fit, and its system calls
+/// are turned into calls back into the host, which reads from and writes to
+/// the host's streams instead of the file descriptors. brk moves the end of
+/// the program within a reservation that follows it.
+class Jit
+{
+public:
+  // Constructor
+  // Takes the structure to run and the streams standing in for stdout and stdin
+  Jit(AsmStructure&, std::ostream&, std::istream&);
+
+  // Encodes the structure and runs it until it exits.
+  // Gives the status it exited with.
+  int run();
+
+private:
+  // Replaces every system call in the structure with a call to host_call
+  void redirect_syscalls();
+
+  // Called by the generated code in place of the syscall instruction, with the
+  // same arguments. Exit does not return, it jumps back into run.
+  static int64_t host_call(int64_t number, int64_t a, int64_t b, int64_t c, Jit*);
+
+  // The structure being run
+  AsmStructure& asms;
+
+  // Where the generated code writes and reads
+  std::ostream& out;
+  std::istream& in;
+
+  // Where exit returns to, and the status it was given
+  std::jmp_buf exit_point;
+  int status;
+
+  // The memory brk can give the program, and how much of it it has
+  uint64_t heap_start;
+  uint64_t heap_break;
+  uint64_t heap_end;
+};
+
+#endif // JIT_H_INCLUDED
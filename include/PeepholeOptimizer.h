@@ -0,0 +1,85 @@
+#ifndef PEEPHOLEOPTIMIZER_H_INCLUDED
+#define PEEPHOLEOPTIMIZER_H_INCLUDED
+
+// Declares the PeepholeOptimizer class
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "AsmStructure.h"
+
+/// Removes redundant instructions from every procedure of an AsmStructure.
+/// Each pattern only looks at a short stretch of straight line code, and
+/// the patterns are repeated until none of them matches any more.
+class PeepholeOptimizer
+{
+public:
+  // Constructor
+  // Takes the structure to optimize
+  PeepholeOptimizer(AsmStructure&);
+
+  // Optimizes every procedure
+  void run();
+
+  // Prints the instruction counts and how often each pattern matched
+  void print_report(std::ostream&);
+
+private:
+  // The patterns. Each returns whether it changed anything.
+  // push r1, ..., pop r2 -> mov r2,r1, ...
+  bool push_pop(std::vector<Instruction>&, const std::string&);
+
+  // mov [x],r1; mov r2,[x] -> mov [x],r1; mov r2,r1
+  bool store_load(std::vector<Instruction>&);
+
+  // mov r,r -> nothing
+  bool self_move(std::vector<Instruction>&);
+
+  // mov r,a; mov r,b -> mov r,b
+  bool dead_move(std::vector<Instruction>&);
+
+  // mov r1,a; mov r2,r1; mov r1,b -> mov r2,a; mov r1,b
+  bool copy_forward(std::vector<Instruction>&);
+
+  // mov r,a when r is known to hold a already -> nothing
+  bool known_value(std::vector<Instruction>&, const std::string&);
+
+  // Jumps to the instruction right after them -> nothing
+  bool jump_to_next(std::vector<Instruction>&, const std::string&);
+
+  // Jumps to a jmp -> jump to where that jmp goes
+  bool jump_thread(std::vector<Instruction>&, const std::string&);
+
+  // Instructions after jmp or ret that no label leads to -> nothing
+  bool dead_code(std::vector<Instruction>&);
+
+  // Finds the full names of every label that is jumped to or called
+  void find_targets();
+
+  // Gets the registers a call to a procedure may change
+  unsigned clobbers(const std::string&);
+
+  // Counts a match of a pattern
+  void hit(const char*);
+
+  // The structure being optimized
+  AsmStructure& asms;
+
+  // Number of instructions before and after optimizing
+  unsigned long before;
+  unsigned long after;
+
+  // Number of matches of each pattern
+  std::map<std::string, unsigned long> hits;
+
+  // The full names of every label that is jumped to or called
+  std::set<std::string> targets;
+
+  // The registers each procedure may change, found by clobbers
+  std::map<std::string, unsigned> clobber_cache;
+};
+
+#endif // PEEPHOLEOPTIMIZER_H_INCLUDED
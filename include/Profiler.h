@@ -0,0 +1,157 @@
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+// Declares the Profiler class
+
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+
+// How the Profiler measures the statements
+enum class ProfileMode
+{
+  OFF,    // Nothing is measured
+  TIME,   // Every execution is counted and timed
+  SAMPLE  // The running statements are sampled with a CPU time timer
+};
+
+// The Profiler class finds where the interpreter spends its time, by statement.
+// The interpreter tells it when every statement starts and ends.
+//
+// In TIME mode each statement gets its execution count, its total time, and its
+// self time: the total without the time of the statements inside it.
+// In SAMPLE mode a SIGPROF timer is asked to go off every millisecond of CPU time,
+// and the statement running when it does gets the sample. Between samples only a stack of
+// the running statements is kept, so the program runs at close to its normal speed.
+//
+// A statement is named by where it is in the file: the line and column of the
+// token already stored on it, or on its condition or expression. Statements the
+// optimizer added are counted as part of the statement they were made from.
+// Statements do not call each other, so a statement always runs inside the
+// same statements. Its stack is the if and while statements around it.
+class Profiler
+{
+public:
+  // Constructor
+  // Takes how to measure. Starts the timer in SAMPLE mode,
+  // or uses TIME mode instead where there is no timer.
+  Profiler(ProfileMode);
+
+  // Whether SAMPLE mode can be used: the timer needs a Linux host
+  static bool can_sample();
+
+  // Destructor. Stops the timer.
+  ~Profiler();
+
+  // A statement starts
+  void enter(Stmt& stmt)
+  {
+    if (mode == ProfileMode::SAMPLE)
+    {
+      if (pending)
+        sample();
+      stack.push_back(Frame{&stmt, nullptr, Clock::time_point(), 0});
+    }
+    else
+      enter_timed(stmt);
+  }
+
+  // The statement that started last ends
+  void leave()
+  {
+    if (mode == ProfileMode::SAMPLE)
+    {
+      if (pending)
+        sample();
+      stack.pop_back();
+    }
+    else
+      leave_timed();
+  }
+
+  // Prints the statements that took the most time, the most first
+  void print_report(std::ostream&, const std::string&);
+
+  // Writes the stacks in the folded format flame graph tools read:
+  //   file:line:col frame;file:line:col frame value
+  // The value is the self time in microseconds, or the samples
+  void write_folded(std::ostream&, const std::string&);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  // What is known of a statement
+  struct Entry
+  {
+    // Where it is, and what it is
+    Token where;
+    std::string name;
+
+    // The statement it runs inside, or nullptr at the top,
+    // and whether that is known yet
+    Entry* parent;
+    bool placed;
+
+    // TIME: How many times it ran, and its total and self times in seconds
+    unsigned long count;
+    double total;
+    double self;
+
+    // SAMPLE: How many samples it got itself, and with the statements inside it
+    unsigned long samples;
+    unsigned long total_samples;
+  };
+
+  // A running statement
+  struct Frame
+  {
+    Stmt* stmt;
+    Entry* entry;
+
+    // TIME: When it started, and the time of the statements inside it so far
+    Clock::time_point start;
+    double inside;
+  };
+
+  // Gets the entry of a statement, making it the first time
+  Entry& find(Stmt&, Entry*);
+
+  // Starts and ends a statement in TIME mode
+  void enter_timed(Stmt&);
+  void leave_timed();
+
+  // Gives the samples taken since the last time to the running statement
+  void sample();
+
+  // The entries that were run, the most time first
+  std::vector<Entry*> sorted();
+
+  // The stack of an entry, as a line of the folded format without the value
+  std::string stack_of(Entry&, const std::string&);
+
+  // How to measure
+  ProfileMode mode;
+
+  // The statements that have run, keyed by address
+  std::unordered_map<const Stmt*, Entry> entries;
+
+  // The running statements, innermost last
+  std::vector<Frame> stack;
+
+  // The CPU time when profiling started
+  std::clock_t cpu_start;
+
+  // The samples the timer took that no statement was given yet
+  static volatile std::sig_atomic_t pending;
+
+  // Adds a sample, from the SIGPROF handler
+  static void on_timer(int);
+};
+
+#endif // PROFILER_H_INCLUDED
@@ -0,0 +1,111 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+// Declares the StopWatch and Stats classes
+
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Measures the wall and CPU time of any number of intervals, added together
+class StopWatch
+{
+public:
+  // Constructor
+  StopWatch();
+
+  // Starts an interval
+  void start();
+
+  // Ends the interval, and adds it to the times
+  void stop();
+
+  // The times so far, in seconds
+  double get_wall() const
+    { return wall; }
+  double get_cpu() const
+    { return cpu; }
+
+private:
+  // When the interval started
+  std::chrono::steady_clock::time_point wall_start;
+  std::clock_t cpu_start;
+
+  // The times of the intervals that ended
+  double wall;
+  double cpu;
+};
+
+// The Stats class collects where the time and memory went while one file was
+// compiled or run, and writes it out as one line of JSON:
+//   {"file":"f.txt","ok":true,"tokens":120,"ast_nodes":85,
+//    "phases":[{"phase":"lex","wall_ms":0.012,"cpu_ms":0.011},...],
+//    "wall_ms":1.5,"cpu_ms":1.4,"allocations":930,"allocated_bytes":61234,"peak_rss_kb":3900}
+// The allocations are the calls to operator new while the file was handled,
+// and the peak RSS is the most memory the process has had so far, or 0 where
+// it cannot be found out (hosts other than Linux).
+class Stats
+{
+public:
+  // Constructor
+  // Takes the file, and whether to measure anything
+  Stats(const std::string&, bool);
+
+  // Runs a phase and adds how long it took to its times.
+  // The phases are written in the order they first ran.
+  void phase(const std::string&, const std::function<void()>&);
+
+  // Sets the counts
+  void set_tokens(unsigned long t)
+    { tokens = t; }
+  void set_nodes(unsigned long n)
+    { nodes = n; }
+
+  // Sets whether the file was handled without an error
+  void set_ok(bool o)
+    { ok = o; }
+
+  // Writes the line
+  void write(std::ostream&);
+
+  // How many times operator new has been called, and how many bytes it was asked for
+  static unsigned long allocations();
+  static unsigned long long allocated_bytes();
+
+private:
+  // The times of a phase
+  struct Phase
+  {
+    std::string name;
+    StopWatch watch;
+  };
+
+  // Finds a phase, adding it if it is new
+  Phase& find(const std::string&);
+
+  // The file
+  std::string file;
+
+  // Whether anything is measured
+  bool enabled;
+
+  // Whether the file was handled without an error
+  bool ok;
+
+  // The counts
+  unsigned long tokens;
+  unsigned long nodes;
+
+  // The phases, in the order they first ran
+  std::vector<Phase> phases;
+
+  // The time from the start to the end, and the allocations before the start
+  StopWatch total;
+  unsigned long start_allocations;
+  unsigned long long start_bytes;
+};
+
+#endif // STATS_H_INCLUDED
@@ -0,0 +1,81 @@
+#ifndef VARUSEVISITOR_H_INCLUDED
+#define VARUSEVISITOR_H_INCLUDED
+
+// Declares the VarUseVisitor class
+
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "ast.h"
+
+// The VarUseVisitor class finds which variables a part of the AST uses, and how much.
+// Uses inside a loop count ten times as much as uses outside it.
+class VarUseVisitor : public AbstractVisitor
+{
+public:
+  // Constructor
+  VarUseVisitor();
+
+  // Gets the weighted number of reads and writes of each variable
+  const std::unordered_map<std::string, unsigned long>& get_uses()
+    { return uses; }
+
+  // Gets the variables that are assigned to
+  const std::set<std::string>& get_assigned()
+    { return assigned; }
+
+  // Gets the variables that are declared
+  const std::set<std::string>& get_declared()
+    { return declared; }
+
+  // Gets the variables that are used as lists
+  const std::set<std::string>& get_indexed()
+    { return indexed; }
+
+  // Gets the length of the lists each variable is given as a whole.
+  // It is -1 when the lengths differ, or are only known when running.
+  const std::unordered_map<std::string, int>& get_lengths()
+    { return lengths; }
+
+  // The overridden functions from AbstractVisitor
+  void visit(StmtList&) override;
+  void visit(BasicIf&) override;
+  void visit(IfStmt&) override;
+  void visit(WhileStmt&) override;
+  void visit(PrintStmt&) override;
+  void visit(VarDecStmt&) override;
+  void visit(AssignStmt&) override;
+  void visit(SimpleExpr&) override;
+  void visit(IndexExpr&) override;
+  void visit(ListExpr&) override;
+  void visit(ReadExpr&) override;
+  void visit(ComplexExpr&) override;
+  void visit(SimpleBoolExpr&) override;
+  void visit(ComplexBoolExpr&) override;
+  void visit(NotBoolExpr&) override;
+
+private:
+  // How much a use counts where the visitor is now
+  unsigned long weight;
+
+  // Weighted uses of each variable
+  std::unordered_map<std::string, unsigned long> uses;
+
+  // Variables that are assigned to
+  std::set<std::string> assigned;
+
+  // Variables that are declared
+  std::set<std::string> declared;
+
+  // Variables that are used as lists
+  std::set<std::string> indexed;
+
+  // The length of the lists given to each variable as a whole
+  std::unordered_map<std::string, int> lengths;
+
+  // Records the length of a list given to a variable
+  void define(const std::string&, int);
+};
+
+#endif // VARUSEVISITOR_H_INCLUDED
@@ -52,12 +52,45 @@ public:
   { return val.compare("true") == 0; }
 };
 
+// The most characters an int is written with, its sign included
+const int INT_CHARS = 11;
+
+// Writes the digits of an int backwards, ending just before end, two at a
+// time from a table of the pairs 00 to 99. Gives where they start.
+inline char* format_int(int val, char* end)
+{
+  static const char pairs[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+  unsigned n = val < 0 ? 0u - static_cast<unsigned>(val) : static_cast<unsigned>(val);
+  while (n >= 100)
+  {
+    const char* pair = pairs + n % 100 * 2;
+    n /= 100;
+    *--end = pair[1];
+    *--end = pair[0];
+  }
+  if (n >= 10)
+  {
+    *--end = pairs[n * 2 + 1];
+    *--end = pairs[n * 2];
+  }
+  else
+    *--end = static_cast<char>('0' + n);
+  if (val < 0)
+    *--end = '-';
+  return end;
+}
+
 // Converts to a string
 class string_visitor : public boost::static_visitor<std::string>
 {
 public:
   std::string operator()(const int val) const
-  { return std::to_string(val); }
+  {
+    char digits[INT_CHARS];
+    return std::string(format_int(val, digits + INT_CHARS), digits + INT_CHARS);
+  }
 
   std::string operator()(const bool val) const
   { return val ? "true" : "false"; }
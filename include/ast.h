@@ -48,16 +48,44 @@ class NotBoolExpr;
 class ASTNode
 {
 public:
+  // Constructor, which counts the node
+  ASTNode()
+    { ++created; }
   // Virtual destructor
   virtual ~ASTNode() {};
   // To implement the Visitor Pattern
   virtual void accept(AbstractVisitor& visitor) = 0;
+
+  // How many nodes have been created
+  static unsigned long count()
+    { return created; }
+
+private:
+  // The count of created nodes
+  static unsigned long created;
 };
 
 // A basic object for defining statements
 // Every child of the head of the AST is derived from this class
 class Stmt : public virtual ASTNode
 {
+public:
+  // Constructor
+  Stmt() :
+    origin(nullptr)
+  {}
+
+  // Set the statement this one was made from, when the optimizer adds it
+  void set_origin(Stmt* o)
+    { origin = o; }
+
+  // Get the statement this one was made from, or nullptr if the program has it
+  Stmt* get_origin()
+    { return origin; }
+
+private:
+  // The statement this one was made from
+  Stmt* origin;
 };
 
 // Every Stmt consists of Expr objects
@@ -101,6 +129,12 @@ public:
   void add_stmt(std::shared_ptr<Stmt> stmt)
     { stmts.push_back(stmt); }
 
+  // Add a Stmt to this list, in front of another, or at the end for nullptr
+  void insert_stmt(Stmt* before, std::shared_ptr<Stmt> stmt);
+
+  // Take a Stmt out of this list
+  void remove_stmt(Stmt* stmt);
+
   // Get the statement list
   std::deque<std::shared_ptr<Stmt>> get_stmts()
     { return stmts; }
@@ -10,8 +10,10 @@
 // Specifies the type of Exception this is.
 // LEXER: The lexer threw an exception.
 // PARSER: The parser threw an exception.
+// ENCODER: Generated code could not be turned into machine code.
+// JIT: Machine code could not be run in this process.
 enum class ExceptionType {
-LEXER, PARSER, VARVISIT
+LEXER, PARSER, VARVISIT, ENCODER, JIT
 };
 
 // Extends the standard exception class for this lexer and parser.
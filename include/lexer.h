@@ -4,6 +4,7 @@
 // Declares the Lexer class
 
 #include <istream>
+#include <vector>
 #include "token.h"
 
 // Reads the opened file and generates tokens
@@ -21,7 +22,18 @@ public:
 	// Returns the next token from input_stream
 	Token next_token();
 
+	// Reads every token up front, so that lexing can be timed apart from parsing.
+	// next_token then gives them out in order.
+	void read_all();
+
+	// Returns how many tokens have been read
+	unsigned long get_count() const
+		{ return count; }
+
 private:
+	// Reads the next token, for next_token
+	Token scan();
+
 	// The reference to the opened file stream
 	std::istream& input_stream;
 
@@ -31,6 +43,13 @@ private:
 	// The current column form the file stream
 	int column;
 
+	// How many tokens have been read
+	unsigned long count;
+
+	// The tokens read up front, and the next one to give out
+	std::vector<Token> tokens;
+	std::size_t next;
+
 	// Internal function that gets the entire string when a quote is found.
 	// Example:
 	//	if (input_stream.get() == '"')
@@ -1,6 +1,9 @@
 #ifndef MIXEDMODEFILTER_H_INCLUDED
 #define MIXEDMODEFILTER_H_INCLUDED
 
+#include <algorithm>
+#include <string>
+
 #include "all_type.h"
 
 // Specialized template to perform boolean operators on various types
@@ -81,7 +84,7 @@ private:
 
   /// Common operators
   void add(T1 a, T2 b)
-    { ret = all_type(a + b); }
+    { ret = all_type(std::move(a) + b); }
 
   void sub(T1 a, T2 b)
     { ret = all_type(a - b); }
@@ -93,25 +96,27 @@ private:
     { ret = all_type(a / b); }
 
 public:
+  // The operands are taken by value and moved through, so a string operand that is
+  // a temporary is appended to in place instead of being copied
   DoMathOperation(T1 a, T2 b, TokenType op) :
     ret(all_type(0))
   {
     switch (op)
     {
       case TokenType::PLUS:
-        add(a, b);
+        add(std::move(a), std::move(b));
         break;
 
       case TokenType::MINUS:
-        sub(a, b);
+        sub(std::move(a), std::move(b));
         break;
 
       case TokenType::MULTIPLY:
-        mul(a, b);
+        mul(std::move(a), std::move(b));
         break;
 
       case TokenType::DIVIDE:
-        div(a, b);
+        div(std::move(a), std::move(b));
         break;
 
       default: break;
@@ -119,8 +124,9 @@ public:
   }
 
   // Gets the output of the operation
+  // Can only be called once, the result is moved out
   all_type get()
-    { return ret; }
+    { return std::move(ret); }
 };
 
 /// Specialized functions follow. Most are here.
@@ -205,7 +211,7 @@ void DoMathOperation<bool, std::string>::div(bool, std::string b)
 /// string and int
 template<>
 void DoMathOperation<std::string, int>::add(std::string a, int b)
-  { ret = all_type(a + std::to_string(b)); }
+  { ret = all_type(std::move(a.append(std::to_string(b)))); }
 
 template<>
 void DoMathOperation<std::string, int>::sub(std::string a, int b)
@@ -214,15 +220,24 @@ void DoMathOperation<std::string, int>::sub(std::string a, int b)
 template<>
 void DoMathOperation<std::string, int>::mul(std::string a, int b)
   {
-    std::ostringstream ss;
-    for (int i = 0; i < std::abs(b); ++i)
-      ss << a;
+    if (b < 0) // then we should reverse the string, which is the same as reversing every copy
+      std::reverse(a.begin(), a.end());
 
-    std::string str = ss.str();
-    if (b < 0) // then we should reverse the string
-      std::reverse(str.begin(), str.end());
+    std::size_t count = (b < 0 ? 0u - static_cast<unsigned>(b) : static_cast<unsigned>(b));
+    std::size_t total = a.size() * count;
 
-    ret = str;
+    // Allocate once, then double the filled part until the whole length is covered
+    std::string str;
+    str.reserve(total);
+    if (total > 0)
+    {
+      str.append(a);
+      while (str.size() * 2 <= total)
+        str.append(str.data(), str.size());
+      str.append(str.data(), total - str.size());
+    }
+
+    ret = std::move(str);
   }
 
 template<>
@@ -232,7 +247,7 @@ void DoMathOperation<std::string, int>::div(std::string a, int b)
 /// string and bool
 template<>
 void DoMathOperation<std::string, bool>::add(std::string a, bool b)
-  { ret = all_type(a + (b ? "true" : "false")); }
+  { ret = all_type(std::move(a.append(b ? "true" : "false"))); }
 
 template<>
 void DoMathOperation<std::string, bool>::sub(std::string a, bool)
@@ -323,13 +338,16 @@ all_type mixed_mode_bool_filter(all_type a, all_type b, TokenType op)
 }
 
 // Gets the current type of both all_type variables and uses DoMathOperation class to perform the boolean operation and return the result
+// String operands are moved out of a and b, so callers should pass temporaries with std::move
 all_type mixed_mode_math_filter(all_type a, all_type b, TokenType op)
 {
   all_type_visitor atv = all_type_visitor();
 
   int_visitor iv = int_visitor();
   bool_visitor bv = bool_visitor();
-  string_visitor sv = string_visitor();
+
+  // Takes the string out of an all_type without copying it
+  auto sv = [](all_type& s) -> std::string&& { return std::move(boost::get<std::string>(s)); };
 
   switch (boost::apply_visitor(atv, a))
   {
@@ -338,7 +356,7 @@ all_type mixed_mode_math_filter(all_type a, all_type b, TokenType op)
       {
         case INT:    return DoMathOperation<int, int>(a.apply_visitor(iv), b.apply_visitor(iv), op).get();
         case BOOL:   return DoMathOperation<int, bool>(a.apply_visitor(iv), b.apply_visitor(bv), op).get();
-        case STRING: return DoMathOperation<int, std::string>(a.apply_visitor(iv), b.apply_visitor(sv), op).get();
+        case STRING: return DoMathOperation<int, std::string>(a.apply_visitor(iv), sv(b), op).get();
       }
 
     case BOOL:
@@ -346,15 +364,15 @@ all_type mixed_mode_math_filter(all_type a, all_type b, TokenType op)
       {
         case INT:    return DoMathOperation<bool, int>(a.apply_visitor(bv), b.apply_visitor(iv), op).get();
         case BOOL:   return DoMathOperation<bool, bool>(a.apply_visitor(bv), b.apply_visitor(bv), op).get();
-        case STRING: return DoMathOperation<bool, std::string>(a.apply_visitor(bv), b.apply_visitor(sv), op).get();
+        case STRING: return DoMathOperation<bool, std::string>(a.apply_visitor(bv), sv(b), op).get();
       }
 
     case STRING:
       switch (boost::apply_visitor(atv, b))
       {
-        case INT:    return DoMathOperation<std::string, int>(a.apply_visitor(sv), b.apply_visitor(iv), op).get();
-        case BOOL:   return DoMathOperation<std::string, bool>(a.apply_visitor(sv), b.apply_visitor(bv), op).get();
-        case STRING: return DoMathOperation<std::string, std::string>(a.apply_visitor(sv), b.apply_visitor(sv), op).get();
+        case INT:    return DoMathOperation<std::string, int>(sv(a), b.apply_visitor(iv), op).get();
+        case BOOL:   return DoMathOperation<std::string, bool>(sv(a), b.apply_visitor(bv), op).get();
+        case STRING: return DoMathOperation<std::string, std::string>(sv(a), sv(b), op).get();
       }
   }
 
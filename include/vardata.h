@@ -47,17 +47,31 @@ public:
     {
       if (index >= len)
         return false;
-      value[index] = val;
+      value[index] = std::move(val);
       return true;
     }
 
   // Get the integer value of this variable
+  // Outside of the list, this is the zero of its type: 0, false or ""
   all_type get_value(unsigned index = 0) const
     {
-      if (index >= len) {std::cerr << "Out of bounds access." << std::endl; return 0;}
+      if (index >= len)
+      {
+        std::cerr << "Out of bounds access." << std::endl;
+        if (data_type == TokenType::STRING)
+          return std::string();
+        if (data_type == TokenType::BOOL)
+          return false;
+        return 0;
+      }
       return value[index];
     }
 
+  // Get a reference to a stored value, so it can be updated in place
+  // The index must be in bounds
+  all_type& get_value_ref(unsigned index = 0)
+    { return value[index]; }
+
   // Assignment overload
   VarData& operator=(const VarData& other)
     {
@@ -67,6 +81,7 @@ public:
       sub_type = other.get_sub_type();
       len = other.get_length();
 
+      delete[] value;
       value = new all_type[len];
 
       for (unsigned i = 0; i < len; ++i)
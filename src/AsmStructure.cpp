@@ -7,23 +7,18 @@
 
 // Constructor
 Procedure::Procedure(std::string n) :
-	name(n)
+	name(n),
+	instructions()
 {
 }
 
-// Print operator for a Procedure object
-std::ostream& operator<<(std::ostream& out, const Procedure& proc)
-{
-	out << proc.name << ":" << std::endl;
-	for (std::string s: proc.instructions)
-		out << s << std::endl;
-	return out;
-}
-
 // Constructor
-AsmStructure::AsmStructure() :
+AsmStructure::AsmStructure(Target t) :
+	target(t),
+	sse2(t == Target::X86_64),
 	constants(),
 	variables(),
+	added(),
 	procedures()
 {
 }
@@ -34,6 +29,12 @@ AsmStructure::~AsmStructure()
   std::for_each(procedures.begin(), procedures.end(), [](Procedure* p){ delete p; });
 }
 
+// Returns true the first time it is called with a name
+bool AsmStructure::first_use(const std::string& name)
+{
+	return added.insert(name).second;
+}
+
 // Converts the structure into assembly and puts it in the passed in stream
 void AsmStructure::convert(std::ostream& out)
 {
@@ -41,8 +42,42 @@ void AsmStructure::convert(std::ostream& out)
 	if (constants.size() > 0)
 	{
 		out << "section .data" << std::endl;
-		std::for_each(constants.begin(), constants.end(),
-			[&](std::string& s) { out << s << std::endl; }); // Print each line to the stream
+		for (const Constant& c: constants)
+		{
+			switch (c.kind)
+			{
+			case DataKind::STRING:
+			{
+				// The header: the capacity and the length, which are the same
+				out << (target == Target::X86_64 ? "dq " : "dd ") << c.text.size() << "," << c.text.size() << std::endl;
+
+				// Quotes and line feeds can't appear inside a quoted string, so they are written as numbers
+				out << c.name << ": db ";
+				std::string part;
+				for (char ch: c.text)
+				{
+					if (ch != '\'' && ch != '\n')
+					{
+						part += ch;
+						continue;
+					}
+					if (!part.empty())
+						out << "'" << part << "',";
+					out << static_cast<int>(ch) << ",";
+					part.clear();
+				}
+				if (!part.empty())
+					out << "'" << part << "',";
+				out << "0" << std::endl
+				    << c.name << "len: equ $-" << c.name << std::endl; // Length of the string
+				break;
+			}
+
+			case DataKind::EQU:  out << c.name << ": equ " << c.value << std::endl; break;
+			case DataKind::WORD: out << c.name << ": dw " << c.value << std::endl; break;
+			case DataKind::BYTE: out << c.name << ": db " << c.value << std::endl; break;
+			}
+		}
 
 		out << std::endl; // End of section
 	}
@@ -51,8 +86,8 @@ void AsmStructure::convert(std::ostream& out)
 	if (variables.size() > 0)
 	{
 		out << "section .bss" << std::endl;
-		std::for_each(variables.begin(), variables.end(),
-				[&](std::string& s) { out << s << std::endl; }); // Print each line to the stream
+		for (const Variable& v: variables)
+			out << v.name << ": resb " << v.size << std::endl;
 
 		out << std::endl; // End of section
 	}
@@ -63,46 +98,227 @@ void AsmStructure::convert(std::ostream& out)
 
 	// Print procedures/subprograms
 	std::for_each(procedures.begin(), procedures.end(),
-			[&](Procedure* p) { out << *p << std::endl; });
+			[&](Procedure* p)
+			{
+				out << p->name << ":" << std::endl;
+				for (const Instruction& in: p->instructions)
+					out << render(in) << std::endl;
+				out << std::endl;
+			});
+}
+
+// Gets the name of a register of the given width on the target
+std::string AsmStructure::register_name(Reg r, Size size)
+{
+	static const char* const legacy[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
+	static const char* const low[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil"};
+
+	if (size == Size::NATIVE)
+		size = target == Target::X86_64 ? Size::QWORD : Size::DWORD;
+
+	unsigned n = static_cast<unsigned>(r);
+	if (size == Size::XMM)
+		return "xmm" + std::to_string(n);
+	if (n >= 8) // r8 to r15
+	{
+		std::string name = "r" + std::to_string(n);
+		switch (size)
+		{
+		case Size::BYTE:  return name + "b";
+		case Size::WORD:  return name + "w";
+		case Size::DWORD: return name + "d";
+		default:          return name;
+		}
+	}
+
+	switch (size)
+	{
+	case Size::BYTE:  return low[n];
+	case Size::WORD:  return legacy[n];
+	case Size::DWORD: return std::string("e") + legacy[n];
+	default:          return std::string("r") + legacy[n];
+	}
+}
+
+// Renders an operand for the target
+std::string AsmStructure::render(const Operand& op)
+{
+	std::string offset;
+	if (op.value > 0)
+		offset = "+" + std::to_string(op.value);
+	else if (op.value < 0)
+		offset = std::to_string(op.value);
+
+	switch (op.kind)
+	{
+	case OperandKind::REG: return register_name(op.base, op.size);
+	case OperandKind::IMM: return std::to_string(op.value);
+	case OperandKind::SYM: return op.symbol + offset;
+
+	case OperandKind::MEM:
+	{
+		std::string out;
+		switch (op.size)
+		{
+		case Size::BYTE:  out = "byte "; break;
+		case Size::WORD:  out = "word "; break;
+		case Size::DWORD: out = "dword "; break;
+		case Size::QWORD: out = "qword "; break;
+		default: break; // The size comes from the other operand
+		}
+
+		std::string address = op.symbol;
+		if (op.base != Reg::NONE)
+			address += (address.empty() ? "" : "+") + register_name(op.base, Size::NATIVE);
+		if (op.index != Reg::NONE)
+			address += "+" + register_name(op.index, Size::NATIVE);
+		return out + "[" + address + offset + "]";
+	}
+
+	default: return "";
+	}
+}
+
+// Renders a single instruction as nasm text for the target
+std::string AsmStructure::render(const Instruction& in)
+{
+	if (in.op == Op::LABEL)
+		return in.dst.symbol + ":";
+
+	std::string name;
+	switch (in.op)
+	{
+	case Op::MOV:       name = "mov"; break;
+	case Op::MOVZX:     name = "movzx"; break;
+	case Op::LEA:       name = "lea"; break;
+	case Op::PUSH:      name = "push"; break;
+	case Op::POP:       name = "pop"; break;
+	case Op::ADD:       name = "add"; break;
+	case Op::SUB:       name = "sub"; break;
+	case Op::MUL:       name = "mul"; break;
+	case Op::IMUL:      name = "imul"; break;
+	case Op::DIV:       name = "div"; break;
+	case Op::IDIV:      name = "idiv"; break;
+	case Op::NEG:       name = "neg"; break;
+	case Op::NOT:       name = "not"; break;
+	case Op::INC:       name = "inc"; break;
+	case Op::DEC:       name = "dec"; break;
+	case Op::AND:       name = "and"; break;
+	case Op::OR:        name = "or"; break;
+	case Op::XOR:       name = "xor"; break;
+	case Op::SHL:       name = "shl"; break;
+	case Op::SHR:       name = "shr"; break;
+	case Op::SAR:       name = "sar"; break;
+	case Op::CDQ:       name = target == Target::X86_64 ? "cqo" : "cdq"; break;
+	case Op::CMP:       name = "cmp"; break;
+	case Op::TEST:      name = "test"; break;
+	case Op::JMP:       name = "jmp"; break;
+	case Op::JE:        name = "je"; break;
+	case Op::JNE:       name = "jne"; break;
+	case Op::JL:        name = "jl"; break;
+	case Op::JLE:       name = "jle"; break;
+	case Op::JG:        name = "jg"; break;
+	case Op::JGE:       name = "jge"; break;
+	case Op::JB:        name = "jb"; break;
+	case Op::JBE:       name = "jbe"; break;
+	case Op::JA:        name = "ja"; break;
+	case Op::JAE:       name = "jae"; break;
+	case Op::CALL:      name = "call"; break;
+	case Op::RET:       name = "ret"; break;
+	case Op::INT:       name = "int"; break;
+	case Op::SYSCALL:   name = "syscall"; break;
+	case Op::REP_MOVSB: name = "rep movsb"; break;
+	case Op::MOVDQU:    name = "movdqu"; break;
+	case Op::PCMPEQB:   name = "pcmpeqb"; break;
+	case Op::PMOVMSKB:  name = "pmovmskb"; break;
+	default: break;
+	}
+
+	if (in.op == Op::INT) // Interrupt numbers read better in hex
+	{
+		std::ostringstream ss;
+		ss << name << " " << std::hex << in.dst.value << "h";
+		return ss.str();
+	}
+
+	if (in.dst.kind != OperandKind::NONE)
+		name += " " + render(in.dst);
+	if (in.src.kind != OperandKind::NONE)
+		name += "," + render(in.src);
+	return name;
+}
+
+// Adds a system call to a procedure
+void AsmStructure::add_syscall(Procedure* proc, Syscall call)
+{
+	if (target == Target::X86)
+	{
+		switch (call)
+		{
+		case Syscall::READ:  proc->add(Op::MOV, EAX, imm(3)); break;
+		case Syscall::WRITE: proc->add(Op::MOV, EAX, imm(4)); break;
+		case Syscall::EXIT:  proc->add(Op::MOV, EAX, imm(1)); break;
+		case Syscall::BRK:   proc->add(Op::MOV, EAX, imm(45)); break;
+		}
+		proc->add(Op::INT, imm(0x80));
+		return;
+	}
+
+	// The 64-bit kernel takes its arguments in rdi, rsi and rdx, and syscall
+	// overwrites rcx and r11, so those are saved to keep the int 80h contract.
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::PUSH, reg(Reg::R11));
+	proc->add(Op::MOV, EDI, EBX);
+	proc->add(Op::MOV, ESI, ECX);
+	switch (call)
+	{
+	case Syscall::READ:  proc->add(Op::MOV, EAX, imm(0)); break;
+	case Syscall::WRITE: proc->add(Op::MOV, EAX, imm(1)); break;
+	case Syscall::EXIT:  proc->add(Op::MOV, EAX, imm(60)); break;
+	case Syscall::BRK:   proc->add(Op::MOV, EAX, imm(12)); break;
+	}
+	proc->add(Op::SYSCALL);
+	proc->add(Op::POP, reg(Reg::R11));
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, ECX);
 }
 
 // Add a string constant to the program
 void AsmStructure::add_constant(std::string name, std::string data)
 {
-	constants.push_back(name +": db '" + data + "',0");
-	constants.push_back(name +"len: equ $-" + name); // Length of the string
+	constants.push_back(Constant{name, DataKind::STRING, data, 0});
 }
 
 // Add an integer constant to the program
 void AsmStructure::add_constant(std::string name, int data, bool eq)
 {
-	constants.push_back(name +": " + (eq ? "equ" : "dw") + " " + std::to_string(data));
+	constants.push_back(Constant{name, eq ? DataKind::EQU : DataKind::WORD, "", data});
 }
 
 // Add a boolean constant to the program
 void AsmStructure::add_constant(std::string name, bool data)
 {
-	constants.push_back(name +": db " + (data ? "1" : "0"));
+	constants.push_back(Constant{name, DataKind::BYTE, "", data ? 1 : 0});
 }
 
 // Add a variable to the program
 void AsmStructure::add_variable(std::string name, int size)
 {
-	variables.push_back(name +": resb " + std::to_string(size));
+	variables.push_back(Variable{name, size});
 }
 
 // Adds a buffer variable to the program
 void AsmStructure::add_buffer_variable()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
+	// Run this code only once
+	if (!first_use("buffer"))
+		return;
 
-		// Add the buffer
-		add_variable("buffer", 255);
-	}
+	// Add the buffer, and a word after it that atoi may read past the digits
+	add_variable("buffer", STRING_SIZE + 8);
 }
 
 // Add a procedure to the program
@@ -114,590 +330,1336 @@ void AsmStructure::add_procedure(Procedure* p)
 // Adds bool string constants to the program
 void AsmStructure::add_bool_constants()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
+	// Run this code only once
+	if (!first_use("boolconsts"))
+		return;
 
-		// Add some constants
-		add_constant("boolt", (std::string)"true");
-		add_constant("boolf", (std::string)"false");
-	}
+	// Add some constants
+	add_constant("boolt", (std::string)"true");
+	add_constant("boolf", (std::string)"false");
+}
+
+// Adds the empty string constant to the program
+void AsmStructure::add_empty_string()
+{
+	// Run this code only once
+	if (!first_use("emptystr"))
+		return;
+
+	add_constant("emptystr", (std::string)"");
+}
+
+// Adds the alloc procedure to the program
+void AsmStructure::add_alloc_proc()
+{
+	// Run this code only once
+	if (!first_use("alloc"))
+		return;
+
+	// Add the heap: the next free byte, the end of the heap, and the
+	// start of what release frees. heaptop is 0 until the first allocation.
+	add_variable("heaptop", word_size());
+	add_variable("heapend", word_size());
+	add_variable("heapmark", word_size());
+
+	// Add the procedure
+	// Loads eax with the address of eax new bytes on the heap.
+	// Exits with status 1 when the heap cannot grow, or when the new top
+	// would be past the end of the address space.
+	Procedure* proc = new Procedure("alloc");
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::MOV, EDX, EAX);
+	proc->add(Op::MOV, ECX, mem("heaptop")); // ecx = the new block
+	proc->add(Op::CMP, ECX, imm(0));
+	proc->add(Op::JNE, sym(".ready"));
+	proc->add(Op::XOR, EBX, EBX); // The heap starts at the current end of the program
+	add_syscall(proc, Syscall::BRK);
+	proc->add(Op::MOV, ECX, EAX);
+	proc->add(Op::MOV, mem("heapend"), EAX);
+	proc->add(Op::MOV, mem("heapmark"), EAX);
+	proc->add_label(".ready");
+	proc->add(Op::ADD, EDX, ECX);
+	proc->add(Op::JB, sym(".full")); // The carry is set when the sum wraps
+	proc->add(Op::ADD, EDX, imm(7));
+	proc->add(Op::JB, sym(".full"));
+	proc->add(Op::AND, EDX, imm(-8)); // edx = the new top, kept aligned
+	proc->add(Op::CMP, EDX, mem("heapend"));
+	proc->add(Op::JBE, sym(".fits"));
+	proc->add(Op::MOV, EBX, EDX);
+	proc->add(Op::ADD, EBX, imm(HEAP_CHUNK));
+	proc->add(Op::JB, sym(".full"));
+	add_syscall(proc, Syscall::BRK);
+	proc->add(Op::CMP, EAX, EBX);
+	proc->add(Op::JB, sym(".full"));
+	proc->add(Op::MOV, mem("heapend"), EAX);
+	proc->add_label(".fits");
+	proc->add(Op::MOV, mem("heaptop"), EDX);
+	proc->add(Op::MOV, EAX, ECX);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::RET);
+	proc->add_label(".full");
+	proc->add(Op::MOV, EBX, imm(1));
+	proc->add(Op::JMP, sym("quit"));
+	add_procedure(proc);
+}
+
+// Adds the release procedure to the program
+void AsmStructure::add_release_proc()
+{
+	// Run this code only once
+	if (!first_use("release"))
+		return;
+
+	// Add dependencies
+	add_alloc_proc();
+
+	// Add the procedure
+	// Frees every string allocated since the last variable buffer
+	Procedure* proc = new Procedure("release");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::MOV, EAX, mem("heapmark"));
+	proc->add(Op::MOV, mem("heaptop"), EAX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the strnew procedure to the program
+void AsmStructure::add_strnew_proc()
+{
+	// Run this code only once
+	if (!first_use("strnew"))
+		return;
+
+	// Add dependencies
+	add_alloc_proc();
+
+	// Add the procedure
+	// Loads eax with a new string with a length and capacity of eax.
+	// Only the terminator is written. Exits with status 1 when the size wraps.
+	Procedure* proc = new Procedure("strnew");
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::MOV, EBX, EAX);
+	proc->add(Op::ADD, EAX, imm(2 * word_size() + 1));
+	proc->add(Op::JB, sym(".full"));
+	proc->add(Op::CALL, sym("alloc"));
+	proc->add(Op::ADD, EAX, imm(2 * word_size()));
+	proc->add(Op::MOV, capacity_of(Reg::AX), EBX);
+	proc->add(Op::MOV, length_of(Reg::AX), EBX);
+	proc->add(Op::MOV, mem(Reg::AX, Reg::BX, 0, Size::BYTE), imm(0));
+	proc->add(Op::POP, EBX);
+	proc->add(Op::RET);
+	proc->add_label(".full");
+	proc->add(Op::MOV, EBX, imm(1));
+	proc->add(Op::JMP, sym("quit"));
+	add_procedure(proc);
+}
+
+// Adds the strfrom procedure to the program
+void AsmStructure::add_strfrom_proc()
+{
+	// Run this code only once
+	if (!first_use("strfrom"))
+		return;
+
+	// Add dependencies
+	add_strnew_proc();
+
+	// Add the procedure
+	// Loads eax with a new string of the ecx bytes at eax
+	Procedure* proc = new Procedure("strfrom");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EAX, ECX);
+	proc->add(Op::CALL, sym("strnew"));
+	proc->add(Op::MOV, EDI, EAX);
+	add_copy(proc);
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the strset procedure to the program
+void AsmStructure::add_strset_proc()
+{
+	// Run this code only once
+	if (!first_use("strset"))
+		return;
+
+	// Add dependencies
+	add_strnew_proc();
+
+	// Add the procedure
+	// Copies the string at ebx into the buffer of the string variable at eax.
+	// A buffer that is too small is replaced by one of at least twice the
+	// capacity, which is kept from then on.
+	Procedure* proc = new Procedure("strset");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, EDX, EAX); // edx = the variable
+	proc->add(Op::MOV, EDI, mem(Reg::DX)); // edi = its buffer
+	proc->add(Op::MOV, ECX, length_of(Reg::BX));
+	proc->add(Op::CMP, EDI, imm(0));
+	proc->add(Op::JE, sym(".exact")); // Not set yet
+	proc->add(Op::CMP, ECX, capacity_of(Reg::DI));
+	proc->add(Op::JBE, sym(".copy"));
+	proc->add(Op::MOV, EAX, capacity_of(Reg::DI));
+	proc->add(Op::ADD, EAX, EAX);
+	proc->add(Op::CMP, EAX, ECX);
+	proc->add(Op::JAE, sym(".grow"));
+	proc->add_label(".exact");
+	proc->add(Op::MOV, EAX, ECX);
+	proc->add_label(".grow");
+	proc->add(Op::CALL, sym("strnew"));
+	proc->add(Op::MOV, EDI, EAX);
+	proc->add(Op::MOV, mem(Reg::DX), EDI);
+	proc->add(Op::MOV, EAX, mem("heaptop"));
+	proc->add(Op::MOV, mem("heapmark"), EAX); // Keep the new buffer from being released
+	proc->add_label(".copy");
+	proc->add(Op::MOV, length_of(Reg::DI), ECX);
+	proc->add(Op::MOV, ESI, EBX);
+	proc->add(Op::INC, ECX); // And the terminator
+	add_copy(proc);
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the strcat procedure to the program
+void AsmStructure::add_strcat_proc()
+{
+	// Run this code only once
+	if (!first_use("strcat"))
+		return;
+
+	// Add dependencies
+	add_strnew_proc();
+
+	// Add the procedure
+	// Appends the string at ebx to the buffer of the string variable at eax.
+	// A full buffer is replaced by one of at least twice the capacity, so
+	// appending in a loop copies each character a constant number of times.
+	Procedure* proc = new Procedure("strcat");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, EDX, EAX); // edx = the variable
+	proc->add(Op::MOV, EAX, mem(Reg::DX)); // eax = its buffer
+	proc->add(Op::MOV, ECX, length_of(Reg::AX));
+	proc->add(Op::ADD, ECX, length_of(Reg::BX)); // ecx = the length afterwards
+	proc->add(Op::CMP, ECX, capacity_of(Reg::AX));
+	proc->add(Op::JBE, sym(".append"));
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::MOV, ESI, EAX); // esi = the old buffer
+	proc->add(Op::MOV, EAX, capacity_of(Reg::SI));
+	proc->add(Op::ADD, EAX, EAX);
+	proc->add(Op::CMP, EAX, ECX);
+	proc->add(Op::JAE, sym(".grow"));
+	proc->add(Op::MOV, EAX, ECX);
+	proc->add_label(".grow");
+	proc->add(Op::CALL, sym("strnew"));
+	proc->add(Op::MOV, mem(Reg::DX), EAX);
+	proc->add(Op::MOV, EDI, EAX);
+	proc->add(Op::MOV, ECX, length_of(Reg::SI));
+	proc->add(Op::MOV, length_of(Reg::DI), ECX);
+	add_copy(proc); // Move what is there over
+	proc->add(Op::MOV, ECX, mem("heaptop"));
+	proc->add(Op::MOV, mem("heapmark"), ECX); // Keep the new buffer from being released
+	proc->add(Op::POP, ECX);
+	proc->add_label(".append");
+	proc->add(Op::MOV, EDI, length_of(Reg::AX));
+	proc->add(Op::MOV, length_of(Reg::AX), ECX);
+	proc->add(Op::SUB, ECX, EDI); // The length of ebx, even if it is this buffer
+	proc->add(Op::ADD, EDI, EAX); // edi = the end of the buffer
+	proc->add(Op::MOV, ESI, EBX);
+	add_copy(proc);
+	proc->add(Op::MOV, mem(Reg::DI, 0, Size::BYTE), imm(0));
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the print procedure to the program
 void AsmStructure::add_print_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add some constants
-		add_constant("LF", 10, true);
-
-		// Add the print buffer
-		add_buffer_variable();
-
-		// Add the print procedure
-		Procedure* proc = new Procedure("print");
-		proc->add_instruction("mov rax,4");
-		proc->add_instruction("mov rbx,1");
-		proc->add_instruction("mov rcx,buffer");
-		proc->add_instruction("int 80h");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("print"))
+		return;
+
+	// Add some constants
+	add_constant("LF", 10, true);
+
+	// Add the print buffer
+	add_buffer_variable();
+
+	// Add the print procedure
+	Procedure* proc = new Procedure("print");
+	proc->add(Op::MOV, EBX, imm(1));
+	proc->add(Op::MOV, ECX, sym("buffer"));
+	add_syscall(proc, Syscall::WRITE);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the sprint procedure to the program
 void AsmStructure::add_sprint_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_strlen_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("sprint");
-		proc->add_instruction("push edx");
-		proc->add_instruction("push ecx");
-		proc->add_instruction("push ebx");
-		proc->add_instruction("push eax");
-		proc->add_instruction("call strlen");
-		proc->add_instruction("mov edx,eax");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("mov ecx,eax");
-		proc->add_instruction("mov ebx,1");
-		proc->add_instruction("mov eax,4");
-		proc->add_instruction("int 80h");
-		proc->add_instruction("pop ebx");
-		proc->add_instruction("pop ecx");
-		proc->add_instruction("pop edx");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("sprint"))
+		return;
+
+	// Add dependencies
+	add_bufwrite_proc();
+
+	// Add the procedure
+	// Prints the string at eax, using the length in its header
+	Procedure* proc = new Procedure("sprint");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::MOV, ECX, length_of(Reg::AX));
+	proc->add(Op::CALL, sym("bufwrite"));
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the bufwrite procedure to the program
+void AsmStructure::add_bufwrite_proc()
+{
+	// Run this code only once
+	if (!first_use("bufwrite"))
+		return;
+
+	// Add dependencies
+	add_flush_proc();
+
+	// Add the procedure
+	// Appends the ecx bytes at eax to the output buffer, flushing it whenever it fills
+	Procedure* proc = new Procedure("bufwrite");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EDX, ECX); // edx = bytes left
+	proc->add_label(".next");
+	proc->add(Op::CMP, EDX, imm(0));
+	proc->add(Op::JE, sym(".done"));
+	proc->add(Op::MOV, ECX, imm(OUTPUT_SIZE));
+	proc->add(Op::SUB, ECX, mem("outlen")); // ecx = room left in the buffer
+	proc->add(Op::JNE, sym(".room"));
+	proc->add(Op::CALL, sym("flush"));
+	proc->add(Op::MOV, ECX, imm(OUTPUT_SIZE));
+	proc->add_label(".room");
+	proc->add(Op::CMP, ECX, EDX);
+	proc->add(Op::JBE, sym(".copy"));
+	proc->add(Op::MOV, ECX, EDX); // Everything left fits
+	proc->add_label(".copy");
+	proc->add(Op::SUB, EDX, ECX);
+	proc->add(Op::MOV, EDI, sym("outbuf"));
+	proc->add(Op::ADD, EDI, mem("outlen"));
+	proc->add(Op::ADD, mem("outlen"), ECX);
+	add_copy(proc);
+	proc->add(Op::JMP, sym(".next"));
+	proc->add_label(".done");
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the flush procedure to the program
+void AsmStructure::add_flush_proc()
+{
+	// Run this code only once
+	if (!first_use("flush"))
+		return;
+
+	// Add the output buffer and the number of bytes in it
+	add_variable("outbuf", OUTPUT_SIZE);
+	add_variable("outlen", word_size());
+
+	// Add the procedure
+	// Writes out and empties the output buffer
+	Procedure* proc = new Procedure("flush");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::MOV, EDX, mem("outlen"));
+	proc->add(Op::CMP, EDX, imm(0));
+	proc->add(Op::JE, sym(".done"));
+	proc->add(Op::MOV, ECX, sym("outbuf"));
+	proc->add(Op::MOV, EBX, imm(1));
+	add_syscall(proc, Syscall::WRITE);
+	proc->add(Op::XOR, EDX, EDX);
+	proc->add(Op::MOV, mem("outlen"), EDX);
+	proc->add_label(".done");
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the iprint procedure to the program
+void AsmStructure::add_iprint_proc()
+{
+	// Run this code only once
+	if (!first_use("iprint"))
+		return;
+
+	// Add dependencies
+	add_buffer_variable();
+	add_todigits_proc();
+	add_bufwrite_proc();
+
+	// Add the procedure
+	// Prints the digits of eax, made at the end of the buffer, in one write
+	Procedure* proc = new Procedure("iprint");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::MOV, EBX, sym("buffer", STRING_SIZE - 1));
+	proc->add(Op::CALL, sym("todigits"));
+	proc->add(Op::MOV, EAX, EBX);
+	proc->add(Op::MOV, ECX, sym("buffer", STRING_SIZE - 1));
+	proc->add(Op::SUB, ECX, EBX);
+	proc->add(Op::CALL, sym("bufwrite"));
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
-// Adds the uiprint procedure to the program
-void AsmStructure::add_uiprint_proc()
+// Adds the todigits procedure and the digit pairs it uses to the program
+void AsmStructure::add_todigits_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
+	// Run this code only once
+	if (!first_use("todigits"))
+		return;
+
+	// Add the digits of 00 to 99, two bytes each
+	std::string pairs;
+	for (int i = 0; i < 100; ++i)
+	{
+		pairs += static_cast<char>('0' + i / 10);
+		pairs += static_cast<char>('0' + i % 10);
+	}
+	add_constant("digitpairs", pairs);
+
+	// Add the procedure
+	// Writes the digits of the signed number in eax backwards, ending just before ebx.
+	// Loads ebx with the address of the first. Each step divides by 100, by
+	// multiplying with its reciprocal, and copies two digits from digitpairs.
+	Procedure* proc = new Procedure("todigits");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::MOV, ESI, EAX); // Keep the sign
+	proc->add(Op::CMP, EAX, imm(0));
+	proc->add(Op::JGE, sym(".pairs"));
+	proc->add(Op::NEG, EAX); // The size of the number, unsigned
+	proc->add_label(".pairs");
+	proc->add(Op::CMP, EAX, imm(100));
+	proc->add(Op::JB, sym(".last"));
+	proc->add(Op::MOV, ECX, EAX);
+	if (target == Target::X86_64)
+	{ // edx = eax / 100
+		proc->add(Op::SHR, EAX, imm(2));
+		proc->add(Op::MOV, EDX, imm(0x28f5c28f5c28f5c3));
+		proc->add(Op::MUL, EDX);
+		proc->add(Op::SHR, EDX, imm(2));
+	}
+	else
 	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_sprint_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("uiprint");
-		proc->add_instruction("push eax");
-		proc->add_instruction("push ecx");
-		proc->add_instruction("push edx");
-		proc->add_instruction("push esi");
-		proc->add_instruction("mov ecx,0");
-		proc->add_instruction(".divideLoop:");
-		proc->add_instruction("inc ecx");
-		proc->add_instruction("mov edx,0");
-		proc->add_instruction("mov esi,10");
-		proc->add_instruction("idiv esi");
-		proc->add_instruction("add edx,48");
-		proc->add_instruction("push edx");
-		proc->add_instruction("cmp eax,0");
-		proc->add_instruction("jnz .divideLoop");
-		proc->add_instruction(".printLoop:");
-		proc->add_instruction("dec ecx");
-		proc->add_instruction("mov eax,esp");
-		proc->add_instruction("call sprint");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("cmp ecx,0");
-		proc->add_instruction("jnz .printLoop");
-		proc->add_instruction("pop esi");
-		proc->add_instruction("pop edx");
-		proc->add_instruction("pop ecx");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("ret");
-		add_procedure(proc);
+		proc->add(Op::MOV, EDX, imm(0x51eb851f));
+		proc->add(Op::MUL, EDX);
+		proc->add(Op::SHR, EDX, imm(5));
 	}
+	proc->add(Op::MOV, EAX, EDX);
+	proc->add(Op::IMUL, EDX, imm(100));
+	proc->add(Op::SUB, ECX, EDX); // ecx = the last two digits
+	proc->add(Op::ADD, ECX, ECX);
+	proc->add(Op::SUB, EBX, imm(2));
+	Operand pair = mem("digitpairs", Reg::CX, Size::BYTE);
+	proc->add(Op::MOV, DL, pair);
+	proc->add(Op::MOV, mem(Reg::BX), DL);
+	pair.value = 1;
+	proc->add(Op::MOV, DL, pair);
+	proc->add(Op::MOV, mem(Reg::BX, 1), DL);
+	proc->add(Op::JMP, sym(".pairs"));
+	proc->add_label(".last");
+	proc->add(Op::CMP, EAX, imm(10));
+	proc->add(Op::JB, sym(".one"));
+	proc->add(Op::ADD, EAX, EAX);
+	proc->add(Op::SUB, EBX, imm(2));
+	pair = mem("digitpairs", Reg::AX, Size::BYTE);
+	proc->add(Op::MOV, DL, pair);
+	proc->add(Op::MOV, mem(Reg::BX), DL);
+	pair.value = 1;
+	proc->add(Op::MOV, DL, pair);
+	proc->add(Op::MOV, mem(Reg::BX, 1), DL);
+	proc->add(Op::JMP, sym(".sign"));
+	proc->add_label(".one");
+	proc->add(Op::ADD, EAX, imm('0'));
+	proc->add(Op::DEC, EBX);
+	proc->add(Op::MOV, mem(Reg::BX), AL);
+	proc->add_label(".sign");
+	proc->add(Op::CMP, ESI, imm(0));
+	proc->add(Op::JGE, sym(".done"));
+	proc->add(Op::DEC, EBX);
+	proc->add(Op::MOV, mem(Reg::BX, 0, Size::BYTE), imm('-'));
+	proc->add_label(".done");
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the bprint procedure to the program
 void AsmStructure::add_bprint_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_bool_constants();
-		add_sprint_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("bprint");
-		proc->add_instruction("cmp eax,0");
-		proc->add_instruction("je .false");
-		proc->add_instruction("mov eax,boolt");
-		proc->add_instruction("call sprint");
-		proc->add_instruction("ret");
-		proc->add_instruction(".false:");
-		proc->add_instruction("mov eax,boolf");
-		proc->add_instruction("call sprint");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("bprint"))
+		return;
+
+	// Add dependencies
+	add_bool_constants();
+	add_sprint_proc();
+
+	// Add the procedure
+	Procedure* proc = new Procedure("bprint");
+	proc->add(Op::CMP, EAX, imm(0));
+	proc->add(Op::JE, sym(".false"));
+	proc->add(Op::MOV, EAX, sym("boolt"));
+	proc->add(Op::CALL, sym("sprint"));
+	proc->add(Op::RET);
+	proc->add_label(".false");
+	proc->add(Op::MOV, EAX, sym("boolf"));
+	proc->add(Op::CALL, sym("sprint"));
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the printLF procedure to the program
 void AsmStructure::add_printLF_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_sprint_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("printLF");
-		proc->add_instruction("push eax");
-		proc->add_instruction("mov eax, 0Ah");
-		proc->add_instruction("push eax");
-		proc->add_instruction("mov eax,esp");
-		proc->add_instruction("call sprint");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
-}
-
-// Adds the strlen procedure to the program
-void AsmStructure::add_strlen_proc()
-{
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add the procedure
-		Procedure* proc = new Procedure("strlen");
-		proc->add_instruction("push ebx");
-		proc->add_instruction("mov ebx,eax");
-		proc->add_instruction(".next:");
-		proc->add_instruction("cmp byte[eax],0");
-		proc->add_instruction("jz .finished");
-		proc->add_instruction("inc eax");
-		proc->add_instruction("jmp .next");
-		proc->add_instruction(".finished:");
-		proc->add_instruction("sub eax,ebx");
-		proc->add_instruction("pop ebx");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("printLF"))
+		return;
+
+	// Add dependencies
+	add_bufwrite_proc();
+
+	// Add the procedure
+	Procedure* proc = new Procedure("printLF");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::MOV, EAX, imm(10));
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::MOV, EAX, ESP);
+	proc->add(Op::MOV, ECX, imm(1));
+	proc->add(Op::CALL, sym("bufwrite"));
+	proc->add(Op::POP, EAX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the readstr procedure to the program
 void AsmStructure::add_readstr_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_buffer_variable();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("readstr");
-    proc->add_instruction("push ebx");
-    proc->add_instruction("push ecx");
-    proc->add_instruction("push edx");
-		proc->add_instruction("mov edx,255");
-		proc->add_instruction("mov ecx,buffer");
-		proc->add_instruction("mov ebx,0");
-		proc->add_instruction("mov eax,3");
-		proc->add_instruction("int 80h");
-		proc->add_instruction("mov eax,buffer");
-		proc->add_instruction("mov ebx,eax");
-		proc->add_instruction("call strlen");
-		proc->add_instruction("mov [ebx+eax-1],byte 0");
-		proc->add_instruction("mov eax,buffer");
-		proc->add_instruction("pop edx");
-		proc->add_instruction("pop ecx");
-		proc->add_instruction("pop ebx");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("readstr"))
+		return;
+
+	// Add dependencies
+	add_readword_proc();
+	add_strfrom_proc();
+
+	// Add the procedure
+	// Loads eax with a new string of the next word of the input
+	Procedure* proc = new Procedure("readstr");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::CALL, sym("readword"));
+	proc->add(Op::MOV, EAX, sym("buffer"));
+	proc->add(Op::CALL, sym("strfrom"));
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the readint procedure to the program
 void AsmStructure::add_readint_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_buffer_variable();
-		add_atoi_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("readint");
-		proc->add_instruction("mov edx,255");
-		proc->add_instruction("mov ecx,buffer");
-		proc->add_instruction("mov ebx,0");
-		proc->add_instruction("mov eax,3");
-		proc->add_instruction("int 80h");
-		proc->add_instruction("mov eax,buffer");
-		proc->add_instruction("call atoi");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("readint"))
+		return;
+
+	// Add dependencies
+	add_readword_proc();
+	add_atoi_proc();
+
+	// Add the procedure
+	// Loads eax with the number in the next word of the input
+	Procedure* proc = new Procedure("readint");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::CALL, sym("readword"));
+	proc->add(Op::MOV, EAX, sym("buffer"));
+	proc->add(Op::CALL, sym("atoi"));
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the readword procedure to the program
+void AsmStructure::add_readword_proc()
+{
+	// Run this code only once
+	if (!first_use("readword"))
+		return;
+
+	// Add dependencies
+	add_buffer_variable();
+	add_fill_proc();
+
+	// Add the procedure
+	// Skips the white space in the input, then copies the word after it into
+	// the buffer, ending it with a 0. Loads ecx with its length, which is 0 at
+	// the end of the input. A word longer than the buffer is left to the next read.
+	// Every byte up to a space is white space.
+	Procedure* proc = new Procedure("readword");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, EDI, sym("buffer"));
+	proc->add(Op::MOV, ESI, mem("inpos")); // esi = the next byte of the input
+	proc->add_label(".skip");
+	proc->add(Op::CMP, ESI, mem("inlen"));
+	proc->add(Op::JAE, sym(".skipfill"));
+	proc->add(Op::MOV, AL, mem("inbuf", Reg::SI, Size::BYTE));
+	proc->add(Op::CMP, AL, imm(' '));
+	proc->add(Op::JA, sym(".copy"));
+	proc->add(Op::INC, ESI);
+	proc->add(Op::JMP, sym(".skip"));
+	proc->add_label(".skipfill");
+	proc->add(Op::CALL, sym("fill"));
+	proc->add(Op::XOR, ESI, ESI);
+	proc->add(Op::CMP, ESI, mem("inlen"));
+	proc->add(Op::JB, sym(".skip"));
+	proc->add(Op::JMP, sym(".done")); // The end of the input
+	proc->add_label(".copy");
+	proc->add(Op::MOV, mem(Reg::DI), AL);
+	proc->add(Op::INC, EDI);
+	proc->add(Op::INC, ESI);
+	proc->add(Op::CMP, EDI, sym("buffer", STRING_SIZE - 1));
+	proc->add(Op::JAE, sym(".done")); // The buffer is full
+	proc->add(Op::CMP, ESI, mem("inlen"));
+	proc->add(Op::JB, sym(".next"));
+	proc->add(Op::CALL, sym("fill"));
+	proc->add(Op::XOR, ESI, ESI);
+	proc->add(Op::CMP, ESI, mem("inlen"));
+	proc->add(Op::JAE, sym(".done"));
+	proc->add_label(".next");
+	proc->add(Op::MOV, AL, mem("inbuf", Reg::SI, Size::BYTE));
+	proc->add(Op::CMP, AL, imm(' '));
+	proc->add(Op::JA, sym(".copy"));
+	proc->add_label(".done");
+	proc->add(Op::MOV, mem("inpos"), ESI);
+	proc->add(Op::MOV, mem(Reg::DI, 0, Size::BYTE), imm(0));
+	proc->add(Op::MOV, ECX, EDI);
+	proc->add(Op::SUB, ECX, sym("buffer"));
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the fill procedure and the input buffer to the program
+void AsmStructure::add_fill_proc()
+{
+	// Run this code only once
+	if (!first_use("fill"))
+		return;
+
+	// Add dependencies
+	add_flush_proc();
+
+	// Add the input buffer, the number of bytes in it, and how many of them are used
+	add_variable("inbuf", INPUT_SIZE);
+	add_variable("inlen", word_size());
+	add_variable("inpos", word_size());
+
+	// Add the procedure
+	// Reads as much of the input as is ready, up to the size of the input
+	// buffer, and starts using it from the start. inlen is 0 at the end of the input.
+	// Prompts are buffered, so they are flushed before waiting for input.
+	Procedure* proc = new Procedure("fill");
+	proc->add(Op::CALL, sym("flush"));
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::MOV, EDX, imm(INPUT_SIZE));
+	proc->add(Op::MOV, ECX, sym("inbuf"));
+	proc->add(Op::MOV, EBX, imm(0));
+	add_syscall(proc, Syscall::READ);
+	proc->add(Op::CMP, EAX, imm(0));
+	proc->add(Op::JG, sym(".read"));
+	proc->add(Op::XOR, EAX, EAX); // Nothing, or an error
+	proc->add_label(".read");
+	proc->add(Op::MOV, mem("inlen"), EAX);
+	proc->add(Op::XOR, EAX, EAX);
+	proc->add(Op::MOV, mem("inpos"), EAX);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the atoi procedure to the program
 void AsmStructure::add_atoi_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
+	// Run this code only once
+	if (!first_use("atoi"))
+		return;
+
+	// A byte repeated across a register
+	const bool x64 = target == Target::X86_64;
+	auto bytes = [x64](unsigned long long b)
+		{ return imm(static_cast<long long>(b * (x64 ? 0x0101010101010101ull : 0x01010101ull))); };
+
+	// Add the procedure
+	// Loads eax with the number in the text at eax, after any blanks and a '-'.
+	// While a whole word of digits is left, they are turned into a number
+	// together (SWAR): the digits are paired up, the pairs into fours, and on
+	// 64-bit the fours into eights, each step a multiply and a shift.
+	// The text may be read a word past where the digits end.
+	Procedure* proc = new Procedure("atoi");
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::XOR, EAX, EAX);
+	proc->add(Op::XOR, EDI, EDI); // edi = 1 if the number is negative
+	proc->add_label(".blanks");
+	proc->add(Op::CMP, mem(Reg::SI, 0, Size::BYTE), imm(' '));
+	proc->add(Op::JE, sym(".blank"));
+	proc->add(Op::CMP, mem(Reg::SI, 0, Size::BYTE), imm('\t'));
+	proc->add(Op::JNE, sym(".sign"));
+	proc->add_label(".blank");
+	proc->add(Op::INC, ESI);
+	proc->add(Op::JMP, sym(".blanks"));
+	proc->add_label(".sign");
+	proc->add(Op::CMP, mem(Reg::SI, 0, Size::BYTE), imm('-'));
+	proc->add(Op::JNE, sym(".words"));
+	proc->add(Op::INC, EDI);
+	proc->add(Op::INC, ESI);
+	proc->add_label(".words");
+	proc->add(Op::MOV, EBX, mem(Reg::SI));
+	proc->add(Op::MOV, ECX, EBX);
+	proc->add(Op::MOV, EDX, bytes('0'));
+	proc->add(Op::SUB, ECX, EDX); // The high bit of a byte below '0' is set
+	proc->add(Op::MOV, EDX, bytes(0x46));
+	proc->add(Op::ADD, EDX, EBX); // And of a byte above '9'
+	proc->add(Op::OR, ECX, EDX);
+	proc->add(Op::MOV, EDX, bytes(0x80));
+	proc->add(Op::TEST, ECX, EDX);
+	proc->add(Op::JNE, sym(".digits"));
+	proc->add(Op::MOV, EDX, bytes(0x0f));
+	proc->add(Op::AND, EBX, EDX); // The digits
+	proc->add(Op::IMUL, EBX, imm(10 * 0x100 + 1));
+	proc->add(Op::SHR, EBX, imm(8)); // Pairs, in every other byte
+	proc->add(Op::MOV, EDX, imm(x64 ? 0x00ff00ff00ff00ff : 0x00ff00ff));
+	proc->add(Op::AND, EBX, EDX);
+	proc->add(Op::IMUL, EBX, imm(100 * 0x10000 + 1));
+	proc->add(Op::SHR, EBX, imm(16)); // Fours, in every other 16 bits
+	if (x64)
 	{
-		added = true; // Prevent this from running again
-
-		// Add the procedure
-		Procedure* proc = new Procedure("atoi");
-		proc->add_instruction("push ebx");
-		proc->add_instruction("push ecx");
-		proc->add_instruction("push edx");
-		proc->add_instruction("push esi");
-		proc->add_instruction("mov esi,eax");
-		proc->add_instruction("mov eax,0");
-		proc->add_instruction("mov ecx,0");
-		proc->add_instruction(".multiplyLoop:");
-		proc->add_instruction("xor ebx,ebx");
-		proc->add_instruction("mov bl,[esi+ecx]");
-		proc->add_instruction("cmp bl,48");
-		proc->add_instruction("jl  .finished");
-		proc->add_instruction("cmp bl,57");
-		proc->add_instruction("jg  .finished");
-		proc->add_instruction("cmp bl,10");
-		proc->add_instruction("je .finished");
-		proc->add_instruction("cmp bl,0");
-		proc->add_instruction("jz .finished");
-		proc->add_instruction("sub bl,48");
-		proc->add_instruction("add eax,ebx");
-		proc->add_instruction("mov ebx,10");
-		proc->add_instruction("mul ebx");
-		proc->add_instruction("inc ecx");
-		proc->add_instruction("jmp .multiplyLoop");
-		proc->add_instruction(".finished:");
-		proc->add_instruction("mov ebx,10");
-		proc->add_instruction("div ebx");
-		proc->add_instruction("pop esi");
-		proc->add_instruction("pop edx");
-		proc->add_instruction("pop ecx");
-		proc->add_instruction("pop ebx");
-		proc->add_instruction("ret");
-		add_procedure(proc);
+		proc->add(Op::MOV, EDX, imm(0x0000ffff0000ffff));
+		proc->add(Op::AND, EBX, EDX);
+		proc->add(Op::MOV, EDX, imm(10000ll * 0x100000000ll + 1));
+		proc->add(Op::IMUL, EBX, EDX);
+		proc->add(Op::SHR, EBX, imm(32)); // Eight
 	}
+	proc->add(Op::IMUL, EAX, imm(x64 ? 100000000 : 10000));
+	proc->add(Op::ADD, EAX, EBX);
+	proc->add(Op::ADD, ESI, imm(word_size()));
+	proc->add(Op::JMP, sym(".words"));
+	proc->add_label(".digits"); // The rest, one at a time
+	proc->add(Op::XOR, EBX, EBX);
+	proc->add(Op::MOV, BL, mem(Reg::SI));
+	proc->add(Op::SUB, EBX, imm('0'));
+	proc->add(Op::CMP, EBX, imm(9));
+	proc->add(Op::JA, sym(".finished"));
+	proc->add(Op::IMUL, EAX, imm(10));
+	proc->add(Op::ADD, EAX, EBX);
+	proc->add(Op::INC, ESI);
+	proc->add(Op::JMP, sym(".digits"));
+	proc->add_label(".finished");
+	proc->add(Op::CMP, EDI, imm(0));
+	proc->add(Op::JE, sym(".done"));
+	proc->add(Op::NEG, EAX);
+	proc->add_label(".done");
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the itoa procedure to the program
 void AsmStructure::add_itoa_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_buffer_variable();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("itoa");
-		proc->add_instruction("push ebx");
-		proc->add_instruction("push ecx");
-		proc->add_instruction("push edx");
-		proc->add_instruction("push esi");
-		proc->add_instruction("mov ebx,buffer+255");
-		proc->add_instruction("mov [ebx],byte 0");
-		proc->add_instruction(".divloop:");
-		proc->add_instruction("dec ebx");
-		proc->add_instruction("mov edx,0");
-		proc->add_instruction("mov esi,10");
-		proc->add_instruction("idiv esi");
-		proc->add_instruction("add edx,0x30");
-		proc->add_instruction("mov [ebx],dl");
-		proc->add_instruction("cmp eax,0");
-		proc->add_instruction("jnz .divloop");
-		proc->add_instruction("mov eax,ebx");
-		proc->add_instruction("pop esi");
-		proc->add_instruction("pop edx");
-		proc->add_instruction("pop ecx");
-		proc->add_instruction("pop ebx");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("itoa"))
+		return;
+
+	// Add dependencies
+	add_buffer_variable();
+	add_todigits_proc();
+	add_strfrom_proc();
+
+	// Add the procedure
+	// Loads eax with a new string of the digits of eax.
+	// They are made at the end of the buffer first.
+	Procedure* proc = new Procedure("itoa");
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::MOV, EBX, sym("buffer", STRING_SIZE - 1));
+	proc->add(Op::CALL, sym("todigits"));
+	proc->add(Op::MOV, EAX, EBX);
+	proc->add(Op::MOV, ECX, sym("buffer", STRING_SIZE - 1));
+	proc->add(Op::SUB, ECX, EBX);
+	proc->add(Op::CALL, sym("strfrom"));
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
-// Adds the strcpy procedure to the program
-void AsmStructure::add_strcpy_proc()
-{
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_strlen_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("strcpy");
-		proc->add_instruction("push eax");
-		proc->add_instruction("mov eax,ebx");
-		proc->add_instruction("call strlen");
-		proc->add_instruction("mov ecx,eax");
-		proc->add_instruction("add ecx,1");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("mov esi,ebx");
-		proc->add_instruction("mov edi,eax");
-		proc->add_instruction("rep movsb");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
-}
 
 // Adds the strcmp procedure to the program
 void AsmStructure::add_strcmp_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add the procedure
-		Procedure* proc = new Procedure("strcmp");
-		proc->add_instruction("push ebx");
-		proc->add_instruction("push ecx");
-		proc->add_instruction(".cmploop:");
-		proc->add_instruction("cmp [eax],byte 0");
-		proc->add_instruction("je .teststr2");
-		proc->add_instruction("cmp [ebx],byte 0");
-		proc->add_instruction("je .more");
-		proc->add_instruction("jmp .maincmp");
-		proc->add_instruction(".teststr2:");
-		proc->add_instruction("cmp [ebx],byte 0");
-		proc->add_instruction("jne .less");
-		proc->add_instruction("mov eax,0x00000000");
-		proc->add_instruction("jmp .done");
-		proc->add_instruction(".maincmp:");
-		proc->add_instruction("mov cx,[ebx]");
-		proc->add_instruction("cmp [eax],cx");
-		proc->add_instruction("jl .less");
-		proc->add_instruction("jg .more");
-		proc->add_instruction("inc eax");
-		proc->add_instruction("inc ebx");
-		proc->add_instruction("jmp .cmploop");
-		proc->add_instruction(".less:");
-		proc->add_instruction("mov eax,0xFFFFFFFF");
-		proc->add_instruction("jmp .done");
-		proc->add_instruction(".more:");
-		proc->add_instruction("mov eax,0x00000001");
-		proc->add_instruction(".done:");
-		proc->add_instruction("pop ecx");
-		proc->add_instruction("pop ebx");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("strcmp"))
+		return;
+
+	// Add the procedure
+	// Compares the strings at eax and ebx a block or a word at a time, up to the
+	// length of the shorter one. The first byte that differs decides, or else the lengths do.
+	// Loads eax with -1 (less), 0 (equal) or 1 (more).
+	Procedure* proc = new Procedure("strcmp");
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, ESI); // Saved, generated code keeps variables in them
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EDI, EBX);
+	proc->add(Op::MOV, ECX, length_of(Reg::SI));
+	proc->add(Op::MOV, EBX, ECX);
+	proc->add(Op::SUB, EBX, length_of(Reg::DI)); // ebx = how much longer the first is
+	proc->add(Op::JLE, sym(".words"));
+	proc->add(Op::MOV, ECX, length_of(Reg::DI)); // ecx = the shorter length
+	add_block_compare(proc, ".words"); // The difference is in the block
+	proc->add_label(".words");
+	proc->add(Op::CMP, ECX, imm(word_size()));
+	proc->add(Op::JB, sym(".bytes"));
+	proc->add(Op::MOV, EAX, mem(Reg::SI));
+	proc->add(Op::CMP, EAX, mem(Reg::DI));
+	proc->add(Op::JNE, sym(".bytes")); // The difference is in this word
+	proc->add(Op::ADD, ESI, imm(word_size()));
+	proc->add(Op::ADD, EDI, imm(word_size()));
+	proc->add(Op::SUB, ECX, imm(word_size()));
+	proc->add(Op::JMP, sym(".words"));
+	proc->add_label(".bytes");
+	proc->add(Op::CMP, ECX, imm(0));
+	proc->add(Op::JE, sym(".lengths"));
+	proc->add(Op::MOV, AL, mem(Reg::SI));
+	proc->add(Op::CMP, AL, mem(Reg::DI));
+	proc->add(Op::JB, sym(".less"));
+	proc->add(Op::JA, sym(".more"));
+	proc->add(Op::INC, ESI);
+	proc->add(Op::INC, EDI);
+	proc->add(Op::DEC, ECX);
+	proc->add(Op::JMP, sym(".bytes"));
+	proc->add_label(".lengths"); // One starts with the other
+	proc->add(Op::CMP, EBX, imm(0));
+	proc->add(Op::JL, sym(".less"));
+	proc->add(Op::JG, sym(".more"));
+	proc->add(Op::MOV, EAX, imm(0));
+	proc->add(Op::JMP, sym(".done"));
+	proc->add_label(".less");
+	proc->add(Op::MOV, EAX, imm(-1));
+	proc->add(Op::JMP, sym(".done"));
+	proc->add_label(".more");
+	proc->add(Op::MOV, EAX, imm(1));
+	proc->add_label(".done");
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the streq procedure to the program
+void AsmStructure::add_streq_proc()
+{
+	// Run this code only once
+	if (!first_use("streq"))
+		return;
+
+	// Add the procedure
+	// Loads eax with 1 if the strings at eax and ebx are the same, and 0 if not.
+	// Strings of different lengths are never compared.
+	Procedure* proc = new Procedure("streq");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, ESI); // Saved, generated code keeps variables in them
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EDI, EBX);
+	proc->add(Op::MOV, ECX, length_of(Reg::SI));
+	proc->add(Op::CMP, ECX, length_of(Reg::DI));
+	proc->add(Op::JNE, sym(".differ"));
+	add_block_compare(proc, ".differ");
+	proc->add_label(".words");
+	proc->add(Op::CMP, ECX, imm(word_size()));
+	proc->add(Op::JB, sym(".bytes"));
+	proc->add(Op::MOV, EAX, mem(Reg::SI));
+	proc->add(Op::CMP, EAX, mem(Reg::DI));
+	proc->add(Op::JNE, sym(".differ"));
+	proc->add(Op::ADD, ESI, imm(word_size()));
+	proc->add(Op::ADD, EDI, imm(word_size()));
+	proc->add(Op::SUB, ECX, imm(word_size()));
+	proc->add(Op::JMP, sym(".words"));
+	proc->add_label(".bytes");
+	proc->add(Op::CMP, ECX, imm(0));
+	proc->add(Op::JE, sym(".same"));
+	proc->add(Op::MOV, AL, mem(Reg::SI));
+	proc->add(Op::CMP, AL, mem(Reg::DI));
+	proc->add(Op::JNE, sym(".differ"));
+	proc->add(Op::INC, ESI);
+	proc->add(Op::INC, EDI);
+	proc->add(Op::DEC, ECX);
+	proc->add(Op::JMP, sym(".bytes"));
+	proc->add_label(".same");
+	proc->add(Op::MOV, EAX, imm(1));
+	proc->add(Op::JMP, sym(".done"));
+	proc->add_label(".differ");
+	proc->add(Op::MOV, EAX, imm(0));
+	proc->add_label(".done");
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the append procedure to the program
 void AsmStructure::add_append_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_strlen_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("append");
-		proc->add_instruction("push eax");
-		proc->add_instruction("push eax");
-		proc->add_instruction("call strlen");
-		proc->add_instruction("mov ecx,eax");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("add eax,ecx");
-		proc->add_instruction("push eax");
-		proc->add_instruction("mov eax,ebx");
-		proc->add_instruction("call strlen");
-		proc->add_instruction("mov ecx,eax");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("mov esi,ebx");
-		proc->add_instruction("mov edi,eax");
-		proc->add_instruction("rep movsb");
-		proc->add_instruction("pop eax");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("append"))
+		return;
+
+	// Add dependencies
+	add_strnew_proc();
+
+	// Add the procedure
+	// Loads eax with a new string of the string at eax followed by the one at ebx
+	Procedure* proc = new Procedure("append");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, ESI); // Saved, generated code keeps variables in them
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EAX, length_of(Reg::SI));
+	proc->add(Op::ADD, EAX, length_of(Reg::BX));
+	proc->add(Op::CALL, sym("strnew"));
+	proc->add(Op::MOV, EDI, EAX);
+	proc->add(Op::MOV, ECX, length_of(Reg::SI));
+	add_copy(proc);
+	proc->add(Op::MOV, ESI, EBX);
+	proc->add(Op::MOV, ECX, length_of(Reg::BX));
+	add_copy(proc); // strnew already wrote the terminator
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the strrev procedure to the program
 void AsmStructure::add_strrev_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_strlen_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("strrev");
-    proc->add_instruction("push eax");
-    proc->add_instruction("push ebx");
-    proc->add_instruction("push ecx");
-    proc->add_instruction("push edx");
-		proc->add_instruction("push eax");
-		proc->add_instruction("mov ebx,eax");
-		proc->add_instruction("mov ecx,2");
-		proc->add_instruction("call strlen");
-		proc->add_instruction("add ebx,eax");
-		proc->add_instruction("sub ebx,1");
-		proc->add_instruction("xor edx,edx");
-		proc->add_instruction("idiv ecx");
-		proc->add_instruction("mov ecx,eax");
-		proc->add_instruction("pop eax");
-		proc->add_instruction(".loop:");
-		proc->add_instruction("cmp ecx,0");
-		proc->add_instruction("je .done");
-		proc->add_instruction("dec ecx");
-		proc->add_instruction("mov dl,[ebx]");
-		proc->add_instruction("push dx");
-		proc->add_instruction("mov dl,[eax]");
-		proc->add_instruction("mov [ebx],dl");
-		proc->add_instruction("pop dx");
-		proc->add_instruction("mov [eax],dl");
-		proc->add_instruction("dec ebx");
-		proc->add_instruction("inc eax");
-		proc->add_instruction("jmp .loop");
-		proc->add_instruction(".done:");
-    proc->add_instruction("pop edx");
-    proc->add_instruction("pop ecx");
-    proc->add_instruction("pop ebx");
-    proc->add_instruction("pop eax");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("strrev"))
+		return;
+
+	// Add the procedure
+	// Reverses the ecx bytes at eax in place, swapping bytes from both ends until they meet
+	Procedure* proc = new Procedure("strrev");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::LEA, ECX, mem(Reg::AX, Reg::CX, -1)); // ecx = last character
+	proc->add_label(".loop");
+	proc->add(Op::CMP, EAX, ECX);
+	proc->add(Op::JAE, sym(".done"));
+	proc->add(Op::MOV, DL, mem(Reg::AX));
+	proc->add(Op::MOV, BL, mem(Reg::CX));
+	proc->add(Op::MOV, mem(Reg::AX), BL);
+	proc->add(Op::MOV, mem(Reg::CX), DL);
+	proc->add(Op::INC, EAX);
+	proc->add(Op::DEC, ECX);
+	proc->add(Op::JMP, sym(".loop"));
+	proc->add_label(".done");
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
 }
 
 // Adds the strmulint procedure to the program
 void AsmStructure::add_strmulint_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
-	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_strrev_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("strmulint");
-    proc->add_instruction("push eax");
-    proc->add_instruction("push ebx");
-    proc->add_instruction("push ecx");
-    proc->add_instruction("push edx");
-    proc->add_instruction("push esi");
-    proc->add_instruction("push edi");
-    proc->add_instruction("cmp bl,0");
-    proc->add_instruction("jge .notneg");
-    proc->add_instruction("call strrev");
-    proc->add_instruction("not bl");
-    proc->add_instruction("inc bl");
-    proc->add_instruction(".notneg:");
-    proc->add_instruction("mov dl,bl");
-    proc->add_instruction("mov ebx,eax");
-    proc->add_instruction("call strlen");
-    proc->add_instruction("mov ecx,eax");
-    proc->add_instruction("mov eax,ebx");
-    proc->add_instruction(".bigloop:");
-    proc->add_instruction("cmp dl,0");
-    proc->add_instruction("je .done");
-    proc->add_instruction("dec dl");
-    proc->add_instruction("push ecx");
-    proc->add_instruction("push ebx");
-    proc->add_instruction("mov esi,ebx");
-    proc->add_instruction("mov edi,eax");
-    proc->add_instruction("rep movsb");
-    proc->add_instruction("pop ebx");
-    proc->add_instruction("pop ecx");
-    proc->add_instruction("add eax,ecx");
-    proc->add_instruction("jmp .bigloop");
-    proc->add_instruction(".done:");
-    proc->add_instruction("mov [eax],byte 0");
-    proc->add_instruction("pop edi");
-    proc->add_instruction("pop esi");
-    proc->add_instruction("pop edx");
-    proc->add_instruction("pop ecx");
-    proc->add_instruction("pop ebx");
-    proc->add_instruction("pop eax");
-		proc->add_instruction("ret");
-		add_procedure(proc);
-	}
+	// Run this code only once
+	if (!first_use("strmulint"))
+		return;
+
+	// Add dependencies
+	add_strnew_proc();
+	add_strrev_proc();
+
+	// Add the procedure
+	// Loads eax with a new string of the string at eax repeated ebx times,
+	// reversed if ebx is negative. One copy is made, then the filled part is
+	// doubled until the whole length is covered. Exits with status 1 when
+	// the length does not fit in a word.
+	Procedure* proc = new Procedure("strmulint");
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::PUSH, ESI);
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EAX, EBX);
+	proc->add(Op::CMP, EAX, imm(0));
+	proc->add(Op::JGE, sym(".positive"));
+	proc->add(Op::NEG, EAX);
+	proc->add_label(".positive");
+	proc->add(Op::IMUL, EAX, length_of(Reg::SI));
+	proc->add(Op::JB, sym(".full")); // The carry is set when the product is cut short
+	proc->add(Op::CALL, sym("strnew"));
+	proc->add(Op::MOV, EDX, length_of(Reg::AX)); // edx = total length
+	proc->add(Op::CMP, EDX, imm(0));
+	proc->add(Op::JE, sym(".done"));
+	proc->add(Op::MOV, EDI, EAX);
+	proc->add(Op::MOV, ECX, length_of(Reg::SI));
+	add_copy(proc); // The first copy
+	proc->add(Op::MOV, ECX, EDI);
+	proc->add(Op::SUB, ECX, EAX); // ecx = bytes filled so far
+	proc->add(Op::CMP, EBX, imm(0));
+	proc->add(Op::JGE, sym(".double"));
+	proc->add(Op::CALL, sym("strrev")); // Reversing the first copy reverses them all
+	proc->add_label(".double");
+	proc->add(Op::CMP, ECX, EDX);
+	proc->add(Op::JAE, sym(".done"));
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EBX, EDX);
+	proc->add(Op::SUB, EBX, ECX); // ebx = bytes still missing
+	proc->add(Op::CMP, ECX, EBX);
+	proc->add(Op::JBE, sym(".copy"));
+	proc->add(Op::MOV, ECX, EBX); // Copy at most what is still missing
+	proc->add_label(".copy");
+	add_copy(proc);
+	proc->add(Op::MOV, ECX, EDI);
+	proc->add(Op::SUB, ECX, EAX);
+	proc->add(Op::JMP, sym(".double"));
+	proc->add_label(".done");
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::RET);
+	proc->add_label(".full");
+	proc->add(Op::MOV, EBX, imm(1));
+	proc->add(Op::JMP, sym("quit"));
+	add_procedure(proc);
 }
 
 // Adds the straddbool procedure to the program
 void AsmStructure::add_straddbool_proc()
 {
-  // Run this code only once
-	static bool added = false;
-	if (!added)
+	// Run this code only once
+	if (!first_use("straddbool"))
+		return;
+
+	// Add dependencies
+	add_bool_constants();
+	add_append_proc();
+
+	// Add the procedure
+	Procedure* proc = new Procedure("straddbool");
+	proc->add(Op::CMP, EBX, imm(1));
+	proc->add(Op::JE, sym(".true"));
+	proc->add(Op::MOV, EBX, sym("boolf"));
+	proc->add(Op::JMP, sym(".done"));
+	proc->add_label(".true");
+	proc->add(Op::MOV, EBX, sym("boolt"));
+	proc->add_label(".done");
+	proc->add(Op::CALL, sym("append"));
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the listnew procedure to the program
+void AsmStructure::add_listnew_proc()
+{
+	// Run this code only once
+	if (!first_use("listnew"))
+		return;
+
+	// Add dependencies
+	add_alloc_proc();
+
+	// Add the procedure
+	// Loads eax with a new list of eax elements of ecx bytes each, all 0
+	Procedure* proc = new Procedure("listnew");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::MOV, EDX, EAX); // edx = the number of elements
+	proc->add(Op::IMUL, ECX, EAX); // ecx = the bytes they take
+	proc->add(Op::MOV, EAX, ECX);
+	proc->add(Op::ADD, EAX, imm(word_size())); // And the length before them
+	proc->add(Op::CALL, sym("alloc"));
+	proc->add(Op::MOV, mem(Reg::AX), EDX);
+	proc->add(Op::ADD, EAX, imm(word_size()));
+	proc->add_label(".clear"); // The heap may have been used before
+	proc->add(Op::CMP, ECX, imm(0));
+	proc->add(Op::JE, sym(".done"));
+	proc->add(Op::DEC, ECX);
+	proc->add(Op::MOV, mem(Reg::AX, Reg::CX, 0, Size::BYTE), imm(0));
+	proc->add(Op::JMP, sym(".clear"));
+	proc->add_label(".done");
+	proc->add(Op::MOV, ECX, mem("heaptop"));
+	proc->add(Op::MOV, mem("heapmark"), ECX); // Keep the list from being released
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the listcopy procedure to the program
+void AsmStructure::add_listcopy_proc()
+{
+	// Run this code only once
+	if (!first_use("listcopy"))
+		return;
+
+	// Add dependencies
+	add_listnew_proc();
+
+	// Add the procedure
+	// Loads eax with a new copy of the list at eax, of elements of ecx bytes
+	Procedure* proc = new Procedure("listcopy");
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, ESI); // Saved, generated code keeps variables in them
+	proc->add(Op::PUSH, EDI);
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EAX, length_of(Reg::SI));
+	proc->add(Op::CALL, sym("listnew"));
+	proc->add(Op::MOV, EDI, EAX);
+	proc->add(Op::IMUL, ECX, length_of(Reg::SI));
+	add_copy(proc);
+	proc->add(Op::POP, EDI);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the strlistcopy procedure to the program
+void AsmStructure::add_strlistcopy_proc()
+{
+	// Run this code only once
+	if (!first_use("strlistcopy"))
+		return;
+
+	// Add dependencies
+	add_listnew_proc();
+	add_strset_proc();
+
+	// Add the procedure
+	// Loads eax with a new list of copies of the strings in the list at eax
+	Procedure* proc = new Procedure("strlistcopy");
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::PUSH, ESI); // Saved, generated code keeps variables in them
+	proc->add(Op::MOV, ESI, EAX);
+	proc->add(Op::MOV, EAX, length_of(Reg::SI));
+	proc->add(Op::MOV, ECX, imm(word_size()));
+	proc->add(Op::CALL, sym("listnew"));
+	proc->add(Op::MOV, EDX, EAX); // edx = the new list
+	proc->add(Op::MOV, ECX, length_of(Reg::SI));
+	proc->add_label(".next");
+	proc->add(Op::CMP, ECX, imm(0));
+	proc->add(Op::JE, sym(".done"));
+	proc->add(Op::DEC, ECX);
+	proc->add(Op::MOV, EAX, ECX);
+	proc->add(Op::SHL, EAX, imm(word_shift()));
+	proc->add(Op::MOV, EBX, mem(Reg::SI, Reg::AX)); // The string to copy
+	proc->add(Op::ADD, EAX, EDX); // The element to copy it into
+	proc->add(Op::CALL, sym("strset"));
+	proc->add(Op::JMP, sym(".next"));
+	proc->add_label(".done");
+	proc->add(Op::MOV, EAX, EDX);
+	proc->add(Op::POP, ESI);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the outofbounds procedure to the program
+void AsmStructure::add_outofbounds_proc()
+{
+	// Run this code only once
+	if (!first_use("outofbounds"))
+		return;
+
+	// Add dependencies
+	add_flush_proc();
+
+	// Add the error message, the same as the interpreter's
+	add_constant("boundsmsg", (std::string)"Out of bounds access.\n");
+
+	// Add the procedure
+	// Writes the error message for an index outside of its list to stderr,
+	// after what has been printed so far
+	Procedure* proc = new Procedure("outofbounds");
+	proc->add(Op::PUSH, EAX);
+	proc->add(Op::PUSH, EBX);
+	proc->add(Op::PUSH, ECX);
+	proc->add(Op::PUSH, EDX);
+	proc->add(Op::CALL, sym("flush"));
+	proc->add(Op::MOV, EBX, imm(2));
+	proc->add(Op::MOV, ECX, sym("boundsmsg"));
+	proc->add(Op::MOV, EDX, sym("boundsmsglen", -1)); // Without the terminator
+	add_syscall(proc, Syscall::WRITE);
+	proc->add(Op::POP, EDX);
+	proc->add(Op::POP, ECX);
+	proc->add(Op::POP, EBX);
+	proc->add(Op::POP, EAX);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Adds the memcopy procedure to the program
+void AsmStructure::add_memcopy_proc()
+{
+	// Run this code only once
+	if (!first_use("memcopy"))
+		return;
+
+	// Add the procedure
+	// Copies ecx bytes from esi to edi 16 at a time, as rep movsb does.
+	// The last block is the last 16 bytes, which may overlap the one before.
+	// Fewer than 16 bytes are left to rep movsb.
+	Procedure* proc = new Procedure("memcopy");
+	proc->add(Op::CMP, ECX, imm(16));
+	proc->add(Op::JB, sym(".bytes"));
+	proc->add_label(".blocks");
+	proc->add(Op::MOVDQU, XMM0, mem(Reg::SI));
+	proc->add(Op::MOVDQU, mem(Reg::DI), XMM0);
+	proc->add(Op::ADD, ESI, imm(16));
+	proc->add(Op::ADD, EDI, imm(16));
+	proc->add(Op::SUB, ECX, imm(16));
+	proc->add(Op::CMP, ECX, imm(16));
+	proc->add(Op::JAE, sym(".blocks"));
+	proc->add(Op::MOVDQU, XMM0, mem(Reg::SI, Reg::CX, -16));
+	proc->add(Op::MOVDQU, mem(Reg::DI, Reg::CX, -16), XMM0);
+	proc->add(Op::ADD, ESI, ECX);
+	proc->add(Op::ADD, EDI, ECX);
+	proc->add(Op::XOR, ECX, ECX);
+	proc->add(Op::RET);
+	proc->add_label(".bytes");
+	proc->add(Op::REP_MOVSB);
+	proc->add(Op::RET);
+	add_procedure(proc);
+}
+
+// Copies ecx bytes from esi to edi
+void AsmStructure::add_copy(Procedure* proc)
+{
+	if (!sse2)
 	{
-		added = true; // Prevent this from running again
-
-		// Add dependencies
-		add_bool_constants();
-		add_append_proc();
-
-		// Add the procedure
-		Procedure* proc = new Procedure("straddbool");
-    proc->add_instruction("cmp ebx,1");
-    proc->add_instruction("je .true");
-    proc->add_instruction("mov ebx,boolf");
-    proc->add_instruction("jmp .done");
-    proc->add_instruction(".true");
-    proc->add_instruction("mov ebx,boolt");
-    proc->add_instruction(".done:");
-    proc->add_instruction("call append");
-		proc->add_instruction("ret");
-		add_procedure(proc);
+		proc->add(Op::REP_MOVSB);
+		return;
 	}
-}
 
+	add_memcopy_proc();
+	proc->add(Op::CALL, sym("memcopy"));
+}
 
+// Compares the bytes at esi and edi 16 at a time
+void AsmStructure::add_block_compare(Procedure* proc, const std::string& differ)
+{
+	if (!sse2)
+		return;
+
+	proc->add_label(".blocks");
+	proc->add(Op::CMP, ECX, imm(16));
+	proc->add(Op::JB, sym(".words"));
+	proc->add(Op::MOVDQU, XMM0, mem(Reg::SI));
+	proc->add(Op::MOVDQU, XMM1, mem(Reg::DI));
+	proc->add(Op::PCMPEQB, XMM0, XMM1); // 0xff in each byte that is the same
+	proc->add(Op::PMOVMSKB, reg(Reg::AX, Size::DWORD), XMM0); // A bit for each
+	proc->add(Op::CMP, reg(Reg::AX, Size::DWORD), imm(0xffff));
+	proc->add(Op::JNE, sym(differ));
+	proc->add(Op::ADD, ESI, imm(16));
+	proc->add(Op::ADD, EDI, imm(16));
+	proc->add(Op::SUB, ECX, imm(16));
+	proc->add(Op::JMP, sym(".blocks"));
+}
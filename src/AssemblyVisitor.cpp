@@ -1,5 +1,8 @@
 // Defines the members of the AssemblyVisitor class
 
+#include <algorithm>
+#include <bitset>
+#include <climits>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -7,17 +10,84 @@
 #include "boost/optional.hpp"
 
 #include "AssemblyVisitor.h"
+#include "VarUseVisitor.h"
 #include "token.h"
 #include "ast.h"
 
+// The registers expressions are computed in. Nothing is kept in them between statements.
+static const unsigned SCRATCH = bit(Reg::AX) | bit(Reg::CX) | bit(Reg::DX) | bit(Reg::BX);
+
+// Gets the first register in a register mask, or Reg::NONE if it is empty
+static Reg first_reg(unsigned mask)
+{
+	for (unsigned r = 0; r < static_cast<unsigned>(Reg::NONE); ++r)
+		if (mask & (1u << r))
+			return static_cast<Reg>(r);
+	return Reg::NONE;
+}
+
+// Gets k if a constant is 2 to the k, or -1
+static int log2_of(long long value)
+{
+	if (value <= 0 || (value & (value - 1)) != 0)
+		return -1;
+	int k = 0;
+	while (value >>= 1)
+		++k;
+	return k;
+}
+
+// Finds the number to multiply by and the shift that divide a signed
+// bits-wide number by a constant of at least 2, without dividing.
+// From "Hacker's Delight" by Henry S. Warren, Jr., section 10-4.
+static void magic(unsigned long long d, int bits, long long& multiplier, int& shift)
+{
+	typedef unsigned long long word;
+	const word mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+	const word top = 1ull << (bits - 1);
+	const word anc = top - 1 - top % d; // The largest multiple of d less one, under top
+	int p = bits - 1;
+	word q1 = top / anc, r1 = top - q1 * anc;
+	word q2 = top / d, r2 = top - q2 * d;
+	word delta;
+	do
+	{
+		++p;
+		q1 = (2 * q1) & mask;
+		r1 = (2 * r1) & mask;
+		if (r1 >= anc)
+		{
+			++q1;
+			r1 -= anc;
+		}
+		q2 = (2 * q2) & mask;
+		r2 = (2 * r2) & mask;
+		if (r2 >= d)
+		{
+			++q2;
+			r2 -= d;
+		}
+		delta = d - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+
+	word m = (q2 + 1) & mask;
+	multiplier = bits == 64 ? static_cast<long long>(m) : static_cast<long long>(static_cast<int>(static_cast<unsigned>(m)));
+	shift = p - bits;
+}
+
 // Constructor
-AssemblyVisitor::AssemblyVisitor() :
+AssemblyVisitor::AssemblyVisitor(Target target) :
 	asms(0),
 	proc(0),
 	type(Type::INT),
-	id_map()
+	id_map(),
+	reg_vars(),
+	reg_dirty(),
+	temps(false),
+	lists(),
+	lengths()
 {
-	asms = new AsmStructure();
+	asms = new AsmStructure(target);
 }
 
 // Outputs the assembly
@@ -29,37 +99,31 @@ void AssemblyVisitor::output(std::ostream& os)
 // Accepts a StmtList reference
 void AssemblyVisitor::visit(StmtList& node)
 {
-	// Start a new procedure
-	static bool initialized = false; // local variables
-	static unsigned count = 0; // Number of procedures created
-	Procedure* local_proc; // Keep track of which procedure this function needs to close
-
-	if (!initialized)
+	// The program is a single procedure.
+	// Nested statement lists are emitted inline, where their statement is.
+	bool program = !proc;
+	if (program)
 	{ // First time through
-		initialized = true;
-		local_proc = proc = new Procedure("_start");
-	}
-	else
-	{ // All other times
-	  proc->add_instruction("call proc" + std::to_string(count)); // Call the procedure about to be created
-		local_proc = proc = new Procedure("proc" + std::to_string(count++));
-	}
+		proc = new Procedure("_start");
+		asms->add_procedure(proc);
 
-	// Add the procedure to the AsmStructure
-	asms->add_procedure(local_proc);
+		// Find the lists whose length never changes
+		VarUseVisitor uses;
+		node.accept(uses);
+		lengths = uses.get_lengths();
+	}
 
 	// Run the statements
 	for (std::shared_ptr<Stmt> s: node.get_stmts())
-		s->accept(*this); // May modify proc
+		s->accept(*this);
 
-  // Close the procedure, as long as it isn't _start
-  if (local_proc->get_name().compare("_start") != 0)
-    local_proc->add_instruction("ret");
-  else
+  if (program)
   { // CLose _start
-    local_proc->add_instruction("xor ebx,ebx");
-    local_proc->add_instruction("quit: mov eax,1");
-    local_proc->add_instruction("int 80h");
+    proc->add(Op::XOR, EBX, EBX);
+    proc->add_label("quit");
+    if (asms->buffers_output())
+      proc->add(Op::CALL, sym("flush")); // Write out what is left of the output
+    asms->add_syscall(proc, Syscall::EXIT);
   }
 }
 
@@ -68,50 +132,37 @@ void AssemblyVisitor::visit(BasicIf& node)
 {
   static unsigned count = 0;
   std::string label = "iflbl" + std::to_string(count++); // Label for this if statement
-  Procedure* local_proc = proc; // Keep track of the local procedure
 
-	node.get_if()->accept(*this); // Loads eax with a boolean value
-	proc->add_instruction("push eax"); // Save the bool for later
-	proc->add_instruction("cmp eax,0"); // Performs comparison
-	proc->add_instruction("je " + label); // Jumps if 0 (false)
+	branch(*node.get_if(), false, label); // Jumps if false
 	node.get_if_stmts()->accept(*this); // Add statements
-	proc = local_proc; // Restore the original state
-	proc->add_instruction(label + ":"); // The label to jump to if false
-	proc->add_instruction("pop eax"); // Get the bool back
+	proc->add_label(label); // The label to jump to if false
 }
 
 // Accepts a IfStmt reference
 void AssemblyVisitor::visit(IfStmt& node)
 {
-
   static unsigned count = 0;
   std::string label = "ifblock" + std::to_string(count++); // Label for this if statement
-  Procedure* local_proc = proc; // Keep track of the local procedure
 
-	node.get_if()->accept(*this); // Run the BasicIf
+  // Each condition is only tested when the ones before it were false
+  std::vector<std::shared_ptr<BasicIf>> arms{node.get_if()};
+  for (auto& elseif: node.get_elseifs())
+    arms.push_back(elseif);
 
-	if (node.get_elseifs().size() > 0) // Then we add them with some other code
+  for (std::size_t i = 0; i < arms.size(); ++i)
   {
-    proc->add_instruction("cmp eax,1"); // Performs comparison
-    proc->add_instruction("je " + label); // Jumps if 1 (true) because the if statement was ran
-
-    for (auto& expr: node.get_elseifs())
-    {
-      expr->accept(*this); // Run the elseif (BasicIf)
-      proc->add_instruction("cmp eax,1"); // Performs comparison
-      proc->add_instruction("je " + label); // Jumps if 1 (true) because an elseif statement was ran
-    }
+    std::string next = label + "arm" + std::to_string(i);
+    branch(*arms[i]->get_if(), false, next); // Jumps to the next arm if false
+    arms[i]->get_if_stmts()->accept(*this);
+    if (i + 1 < arms.size() || node.get_else())
+      proc->add(Op::JMP, sym(label)); // An arm ran, so skip the rest
+    proc->add_label(next);
   }
 
 	if (node.get_else())
-  {
-    proc->add_instruction("cmp eax,1"); // Performs comparison
-      proc->add_instruction("je " + label); // Jumps if 1 (true) because an if block ran
     node.get_else()->accept(*this);
-    proc = local_proc; // Restore the original state
-  }
 
-	proc->add_instruction(label + ":"); // The label to jump to when an if is true
+	proc->add_label(label); // The label to jump to when an if is true
 }
 
 // Accepts a WhileStmt reference
@@ -119,51 +170,64 @@ void AssemblyVisitor::visit(WhileStmt& node)
 {
   static unsigned count = 0; // Number of while loops
   std::string label = "whileloop" + std::to_string(count++);
-  Procedure* local_proc = proc; // Keep track of the local procedure
 
-  proc->add_instruction(label + ":"); // Remain local
+  std::vector<std::string> promoted = promote(node); // Keep the busiest variables in registers
+
+  // The condition is tested at the bottom, so each time around takes one jump
+  proc->add(Op::JMP, sym("test" + label));
+  proc->add_label(label); // Remain local
 
-	node.get_while()->accept(*this); // Loads eax with a bool
-	proc->add_instruction("cmp eax,0"); // Compare with false
-	proc->add_instruction("je done" + label); // Escape if false
+	node.get_stmts()->accept(*this); // The loop body
 
-	node.get_stmts()->accept(*this); // Create a procedure for these statement
-	proc = local_proc; // Restore the original state
-	proc->add_instruction("jmp " + label); // Run again
-	proc->add_instruction("done" + label + ":"); // The end of this while loop
+	proc->add_label("test" + label);
+	branch(*node.get_while(), true, label); // Run again if true
+	demote(promoted);
 }
 
 // Accepts a PrintStmt reference
 void AssemblyVisitor::visit(PrintStmt& node)
 {
-	// Set up printing the argument
-	node.get_expr()->accept(*this); // Loads the value into eax, and determines type
-
-	// What are we printing?
-	switch (type)
+	SimpleExpr* simple = dynamic_cast<SimpleExpr*>(node.get_expr().get());
+	if (simple && simple->get_term().get_type() == TokenType::STRING)
+	{ // The length of a literal is known when assembling, so it is written directly
+		std::string name = literal(simple->get_term().get_lexeme());
+		proc->add(Op::MOV, EAX, sym(name));
+		proc->add(Op::MOV, ECX, sym(name + "len", -1)); // Without the terminator
+		asms->add_bufwrite_proc();
+		proc->add(Op::CALL, sym("bufwrite"));
+	}
+	else
 	{
-  case INT:
-    asms->add_uiprint_proc();
-    proc->add_instruction("call uiprint");
-    break;
-
-  case BOOL:
-    asms->add_bprint_proc();
-    proc->add_instruction("call bprint");
-    break;
-
-  case STRING:
-    asms->add_sprint_proc();
-    proc->add_instruction("call sprint"); // The address is already loaded into eax
-    break;
+		// Set up printing the argument
+		node.get_expr()->accept(*this); // Loads the value into eax, and determines type
+
+		// What are we printing?
+		switch (type)
+		{
+		case INT:
+			asms->add_iprint_proc();
+			proc->add(Op::CALL, sym("iprint"));
+			break;
+
+		case BOOL:
+			asms->add_bprint_proc();
+			proc->add(Op::CALL, sym("bprint"));
+			break;
+
+		case STRING:
+			asms->add_sprint_proc();
+			proc->add(Op::CALL, sym("sprint")); // The address is already loaded into eax
+			break;
+		}
 	}
 
 	// Print line feed if necessary
 	if (node.get_type() == TokenType::PRINTLN)
   {
     asms->add_printLF_proc();
-    proc->add_instruction("call printLF");
+    proc->add(Op::CALL, sym("printLF"));
   }
+	release();
 }
 
 // Accepts a VarDecStmt reference
@@ -183,16 +247,16 @@ void AssemblyVisitor::visit(VarDecStmt& node)
 	{
 	case TokenType::BOOL:
 		var_type = Type::BOOL;
-		asms->add_variable(node.get_id().get_lexeme(), 1);
+		asms->add_variable(node.get_id().get_lexeme(), asms->word_size()); // Stored from a whole register
 		break;
 
 	case TokenType::INT:
-		asms->add_variable(node.get_id().get_lexeme(), 4); // 32-bit numbers
+		asms->add_variable(node.get_id().get_lexeme(), asms->word_size()); // 32 or 64-bit numbers
 		break;
 
 	case TokenType::STRING:
 		var_type = Type::STRING;
-		asms->add_variable(node.get_id().get_lexeme(), 255);
+		asms->add_variable(node.get_id().get_lexeme(), asms->word_size()); // The address of its buffer
 		break;
 
 	default: break;
@@ -201,51 +265,119 @@ void AssemblyVisitor::visit(VarDecStmt& node)
 	// Store type information
 	id_map[node.get_id().get_lexeme()] = var_type;
 
-	if (node.get_assign())
+	if (node.get_sub_type() == TokenType::ARRAY)
+	{ // The variable holds the address of the elements
+		auto length = lengths.find(node.get_id().get_lexeme());
+		lists[node.get_id().get_lexeme()] = length != lengths.end() ? length->second : -1;
+		define_list(node.get_id().get_lexeme(), node.get_assign().get());
+	}
+	else if (node.get_assign())
 	{
-    node.get_assign()->accept(*this); // Loads the value into the eax
+    if (!gen_expr(*node.get_assign(), Reg::AX))
+      node.get_assign()->accept(*this); // Loads the value into the eax
     switch (type)
     {
     case INT:
     case BOOL:
-      proc->add_instruction("mov [" + node.get_id().get_lexeme() + "],eax"); // Move the value into the variable
+      proc->add(Op::MOV, mem(node.get_id().get_lexeme()), EAX); // Move the value into the variable
       break;
 
     case STRING:
-      proc->add_instruction("push eax"); // Store the address
-      proc->add_instruction("mov eax," + node.get_id().get_lexeme()); // Write to the variable address
-      proc->add_instruction("pop ebx"); // Load where to read from
-      asms->add_strcpy_proc();
-      proc->add_instruction("call strcpy"); // Copy the string over
+      proc->add(Op::MOV, EBX, EAX); // Where to read from
+      proc->add(Op::MOV, EAX, sym(node.get_id().get_lexeme())); // The variable to copy into
+      asms->add_strset_proc();
+      proc->add(Op::CALL, sym("strset")); // Copy the string over
       break;
     }
 	}
+	else if (var_type == Type::STRING)
+	{ // Start out empty
+		asms->add_empty_string();
+		proc->add(Op::MOV, EAX, sym("emptystr"));
+		proc->add(Op::MOV, mem(node.get_id().get_lexeme()), EAX);
+	}
+	release();
 }
 
 // Accepts an AssignStmt reference
 void AssemblyVisitor::visit(AssignStmt& node)
 {
-  /// Does not handle lists yet
-	if (node.get_index())
-		node.get_index()->accept(*this);
+  const std::string& name = node.get_id().get_lexeme();
+  Expr& value = *node.get_assign();
+  auto kept = reg_vars.find(name);
+
+  if (lists.count(name))
+  {
+    if (node.get_index() || !(dynamic_cast<ListExpr*>(&value) || list_variable(value)))
+      store_element(name, node.get_index().get(), value); // A single value goes in the first element
+    else
+      define_list(name, &value);
+    release();
+    return;
+  }
+
+  // Compute straight into the register of a promoted variable when possible
+  if (kept != reg_vars.end() && !node.get_index() && allocatable(value) && in_place(value, name)
+      && gen_expr(value, kept->second))
+    return;
+
+  // s = s + x appends to the buffer of s instead of building a new string
+  ComplexExpr* complex = dynamic_cast<ComplexExpr*>(&value);
+  SimpleExpr* first = complex ? dynamic_cast<SimpleExpr*>(complex->get_first_op().get()) : nullptr;
+  if (!node.get_index() && id_map[name] == STRING && complex && complex->get_rel().get_type() == TokenType::PLUS
+      && first && first->get_term().get_type() == TokenType::ID && first->get_term().get_lexeme() == name)
+  {
+    complex->get_rest()->accept(*this); // Loads eax with what to append
+    switch (type)
+    {
+    case INT:
+      asms->add_itoa_proc();
+      proc->add(Op::CALL, sym("itoa"));
+      temps = true;
+      break;
 
-  node.get_assign()->accept(*this); // Loads eax with the value to store
+    case BOOL:
+      proc->add(Op::MOV, EBX, EAX);
+      asms->add_empty_string();
+      proc->add(Op::MOV, EAX, sym("emptystr"));
+      asms->add_straddbool_proc();
+      proc->add(Op::CALL, sym("straddbool"));
+      temps = true;
+      break;
+
+    default: break;
+    }
+    proc->add(Op::MOV, EBX, EAX); // Where to read from
+    proc->add(Op::MOV, EAX, sym(name)); // The variable to append to
+    asms->add_strcat_proc();
+    proc->add(Op::CALL, sym("strcat"));
+    type = STRING;
+    release();
+    return;
+  }
+
+  if (!gen_expr(value, Reg::AX))
+    value.accept(*this); // Loads eax with the value to store
   switch (type)
   {
   case INT:
-  case BOOL: /// bools are only one byte; this won't work
-    proc->add_instruction("mov [" + node.get_id().get_lexeme() + "],eax"); // Save it
+  case BOOL:
+    if (kept != reg_vars.end() && !node.get_index())
+      proc->add(Op::MOV, reg(kept->second), EAX); // Save it in its register
+    else
+      proc->add(Op::MOV, mem(name), EAX); // Save it
     break;
 
   case STRING:
-    proc->add_instruction("mov ebx,eax"); // Where to read from
-    proc->add_instruction("mov eax," + node.get_id().get_lexeme()); // Write to the variable address
-    asms->add_strcpy_proc();
-    proc->add_instruction("call strcpy"); // Copy the string over
+    proc->add(Op::MOV, EBX, EAX); // Where to read from
+    proc->add(Op::MOV, EAX, sym(node.get_id().get_lexeme())); // The variable to copy into
+    asms->add_strset_proc();
+    proc->add(Op::CALL, sym("strset")); // Copy the string over
     break;
 
   default: break;
   }
+  release();
 }
 
 // Accepts a SimpleExpr reference
@@ -254,51 +386,47 @@ void AssemblyVisitor::visit(SimpleExpr& node)
   switch (node.get_term().get_type())
   {
   case TokenType::ID:
+    if (lists.count(node.get_term().get_lexeme()))
+    { // Like the interpreter, a list used as a single value is its first element
+      load_element(node.get_term().get_lexeme(), nullptr);
+      break;
+    }
     type = id_map[node.get_term().get_lexeme()]; // Assign type
     switch (type)
     {
     case INT:
     case BOOL:
-      proc->add_instruction("mov eax,[" + node.get_term().get_lexeme() + "]"); // Move known data to eax
+      proc->add(Op::MOV, EAX, variable(node.get_term().get_lexeme())); // Move known data to eax
       break;
 
     case STRING:
-      proc->add_instruction("mov eax," + node.get_term().get_lexeme() + ""); // Move address of data to eax
+      proc->add(Op::MOV, EAX, mem(node.get_term().get_lexeme())); // Move the address of its buffer to eax
       break;
     }
     break;
 
   case TokenType::INT:
     type = Type::INT;
-    proc->add_instruction("mov eax," + node.get_term().get_lexeme());
+    proc->add(Op::MOV, EAX, imm(std::stoll(node.get_term().get_lexeme())));
     break;
 
 
   case TokenType::BOOL:
     type = Type::BOOL;
     if (node.get_term().get_lexeme().compare("true") == 0)
-      proc->add_instruction("mov eax,1"); // 1 is true
+      proc->add(Op::MOV, EAX, imm(1)); // 1 is true
     else
-      proc->add_instruction("mov eax,0"); // 0 is false
+      proc->add(Op::MOV, EAX, imm(0)); // 0 is false
     break;
 
 
   case TokenType::STRING:
   {
-    static unsigned count = 0; // Keep track of the number of constant strings
     type = Type::STRING;
-    std::string strconst = "strconst" + std::to_string(count++);
-
-    // Load the string address into eax
-    asms->add_constant(strconst, node.get_term().get_lexeme());
-    proc->add_instruction("push ebx");
-    proc->add_instruction("mov ebx," + strconst);
-		asms->add_buffer_variable();
-    proc->add_instruction("mov eax,buffer");
-    asms->add_strcpy_proc();
-    proc->add_instruction("call strcpy");
-    proc->add_instruction("mov eax,buffer");
-    proc->add_instruction("pop ebx");
+
+    // Load the string address into eax.
+    // Strings are never changed in place, so the constant is used as it is.
+    proc->add(Op::MOV, EAX, sym(literal(node.get_term().get_lexeme())));
     break;
   }
 
@@ -309,16 +437,24 @@ void AssemblyVisitor::visit(SimpleExpr& node)
 // Accepts a IndexExpr reference
 void AssemblyVisitor::visit(IndexExpr& node)
 {
-  /// Does not handle lists yet
-	node.get_expr()->accept(*this);
+  load_element(node.get_id().get_lexeme(), node.get_expr().get());
 }
 
 // Accepts a ListExpr reference
+// Only reached where a single value is expected. Like the interpreter, the
+// value is the first element, after every element has been evaluated.
 void AssemblyVisitor::visit(ListExpr& node)
 {
-  /// Does not handle lists yet
-	for (auto& expr: node.get_exprs())
-		expr->accept(*this);
+  std::deque<std::shared_ptr<Expr>> exprs = node.get_exprs();
+  for (unsigned i = 0; i < exprs.size(); ++i)
+  {
+    if (!gen_expr(*exprs[i], Reg::AX))
+      exprs[i]->accept(*this);
+    if (i == 0 && exprs.size() > 1)
+      proc->add(Op::PUSH, EAX);
+  }
+  if (exprs.size() > 1)
+    proc->add(Op::POP, EAX);
 }
 
 // Accepts a ReadExpr reference
@@ -328,13 +464,14 @@ void AssemblyVisitor::visit(ReadExpr& node)
   static unsigned count = 0;
 
   // Add needed procedures
-  asms->add_sprint_proc();
+  asms->add_bufwrite_proc();
 
   // Print the message
   std::string name = "read" + std::to_string(count++);
   asms->add_constant(name, node.get_msg().get_lexeme());
-  proc->add_instruction("mov eax," + name); // Load the address of the print message
-  proc->add_instruction("call sprint"); // Print message
+  proc->add(Op::MOV, EAX, sym(name)); // Load the address of the print message
+  proc->add(Op::MOV, ECX, sym(name + "len", -1)); // Its length, without the terminator
+  proc->add(Op::CALL, sym("bufwrite")); // Print message
 
   // Get the user's input and
   // convert to the proper type, if necessary
@@ -342,14 +479,15 @@ void AssemblyVisitor::visit(ReadExpr& node)
   {
   case TokenType::READINT:
     asms->add_readint_proc();
-    proc->add_instruction("call readint"); // Reads the input and puts the value in eax
+    proc->add(Op::CALL, sym("readint")); // Reads the input and puts the value in eax
     type = INT;
     break;
 
   case TokenType::READSTR:
     asms->add_readstr_proc();
-    proc->add_instruction("call readstr"); // Loads eax with the address of a filled buffer
+    proc->add(Op::CALL, sym("readstr")); // Loads eax with a new string
     type = STRING;
+    temps = true;
     break;
 
   default: break;
@@ -359,8 +497,11 @@ void AssemblyVisitor::visit(ReadExpr& node)
 // Accepts a ComplexExpr reference
 void AssemblyVisitor::visit(ComplexExpr& node)
 {
+	if (gen_expr(node, Reg::AX)) // Arithmetic does not need the stack
+		return;
+
 	node.get_first_op()->accept(*this); // Loads the first expression into eax
-	proc->add_instruction("push eax"); // Saves the value from the first op
+	proc->add(Op::PUSH, EAX); // Saves the value from the first op
 	Type first_type = type;
 	node.get_rest()->accept(*this); // Loads the rest into eax
 
@@ -376,25 +517,26 @@ void AssemblyVisitor::visit(ComplexExpr& node)
       switch (node.get_rel().get_type())
       {
       case TokenType::PLUS: // (int | bool) + (int | bool)
-        proc->add_instruction("pop ebx");
-        proc->add_instruction("add eax,ebx");
+        proc->add(Op::POP, EBX);
+        proc->add(Op::ADD, EAX, EBX);
         break;
 
       case TokenType::MINUS: // (int | bool) - (int | bool)
-        proc->add_instruction("mov ebx,eax");
-        proc->add_instruction("pop eax");
-        proc->add_instruction("sub eax,ebx");
+        proc->add(Op::MOV, EBX, EAX);
+        proc->add(Op::POP, EAX);
+        proc->add(Op::SUB, EAX, EBX);
         break;
 
       case TokenType::DIVIDE: // (int | bool) / (int | bool)
-        proc->add_instruction("mov ebx,eax");
-        proc->add_instruction("pop eax");
-        proc->add_instruction("div ebx");
+        proc->add(Op::MOV, EBX, EAX);
+        proc->add(Op::POP, EAX);
+        proc->add(Op::CDQ); // Sign extend into edx
+        proc->add(Op::IDIV, EBX);
         break;
 
-      case TokenType::MULTIPLY:  // (int | bool) / (int | bool)
-        proc->add_instruction("pop ebx");
-        proc->add_instruction("mul ebx");
+      case TokenType::MULTIPLY:  // (int | bool) * (int | bool)
+        proc->add(Op::POP, EBX);
+        proc->add(Op::IMUL, EAX, EBX); // Leaves edx alone
         break;
 
       default: break;
@@ -417,23 +559,20 @@ void AssemblyVisitor::visit(ComplexExpr& node)
       case TokenType::PLUS: // string + int
         type = STRING;
         asms->add_itoa_proc();
-        proc->add_instruction("call itoa");
-        proc->add_instruction("mov ebx,eax"); // Address of the string of integers into ebx
-        proc->add_instruction("pop eax"); // Get the first operand back
+        proc->add(Op::CALL, sym("itoa"));
+        proc->add(Op::MOV, EBX, EAX); // Address of the string of integers into ebx
+        proc->add(Op::POP, EAX); // Get the first operand back
         asms->add_append_proc();
-        proc->add_instruction("call append");
+        proc->add(Op::CALL, sym("append"));
+        temps = true;
         break;
 
       case TokenType::MULTIPLY: // string * int
-        proc->add_instruction("pop ebx");
-        proc->add_instruction("push eax");
-        asms->add_buffer_variable();
-        proc->add_instruction("mov eax,buffer");
-        asms->add_strcpy_proc();
-        proc->add_instruction("call strcpy");
-        proc->add_instruction("pop ebx");
+        proc->add(Op::MOV, EBX, EAX); // The count
+        proc->add(Op::POP, EAX); // The string
         asms->add_strmulint_proc();
-        proc->add_instruction("call strmulint");
+        proc->add(Op::CALL, sym("strmulint"));
+        temps = true;
         break;
 
       case TokenType::MINUS: // string - int
@@ -449,21 +588,26 @@ void AssemblyVisitor::visit(ComplexExpr& node)
       switch (node.get_rel().get_type())
       {
       case TokenType::PLUS: // string + bool
-        proc->add_instruction("mov ebx,eax");
-        proc->add_instruction("pop eax");
+        proc->add(Op::MOV, EBX, EAX);
+        proc->add(Op::POP, EAX);
         asms->add_straddbool_proc();
-        proc->add_instruction("call straddbool");
+        proc->add(Op::CALL, sym("straddbool"));
+        temps = true;
         break;
 
       case TokenType::MULTIPLY: // string * bool
-        proc->add_instruction("mov ebx,eax");
-        proc->add_instruction("pop eax");
-        proc->add_instruction("strmulbool:");
-        proc->add_instruction("cmp ebx,1"); // is the bool true?
-        proc->add_instruction("jne .done");
-        proc->add_instruction("mov [eax],0");
-        proc->add_instruction(".done");
+      {
+        static unsigned count = 0;
+        proc->add(Op::MOV, EBX, EAX);
+        proc->add(Op::POP, EAX);
+        proc->add_label("strmulbool" + std::to_string(count++)); // Remain local
+        proc->add(Op::CMP, EBX, imm(1)); // is the bool true?
+        proc->add(Op::JE, sym(".done"));
+        asms->add_empty_string();
+        proc->add(Op::MOV, EAX, sym("emptystr"));
+        proc->add_label(".done");
         break;
+      }
 
       case TokenType::MINUS: // string - bool
       case TokenType::DIVIDE: // string / bool
@@ -478,10 +622,11 @@ void AssemblyVisitor::visit(ComplexExpr& node)
       switch (node.get_rel().get_type())
       {
       case TokenType::PLUS: // string + string
-        proc->add_instruction("mov ebx,eax");
-        proc->add_instruction("pop eax"); // Pull the first argument off the stack
+        proc->add(Op::MOV, EBX, EAX);
+        proc->add(Op::POP, EAX); // Pull the first argument off the stack
         asms->add_append_proc();
-        proc->add_instruction("call append"); // Appends ebx to eax
+        proc->add(Op::CALL, sym("append")); // A new string of eax then ebx
+        temps = true;
         break;
 
       case TokenType::MINUS: // string - string
@@ -508,159 +653,760 @@ void AssemblyVisitor::visit(SimpleBoolExpr& node)
 void AssemblyVisitor::visit(ComplexBoolExpr& node)
 {
   static unsigned count = 0; // Count the comparisons
-	node.get_first_op()->accept(*this); // Loads eax with the first operand
+  std::string label = "comparison" + std::to_string(count++);
+
+  // Load eax with the result
+  branch(node, false, label + "false");
+  proc->add(Op::MOV, EAX, imm(1));
+  proc->add(Op::JMP, sym(label + "done"));
+  proc->add_label(label + "false");
+  proc->add(Op::MOV, EAX, imm(0));
+  proc->add_label(label + "done");
+  type = BOOL;
+}
 
-	proc->add_instruction("push eax"); // Save for later
-	Type first_type = type; // Get the type of the first operand
+// Accepts a NotBoolExpr reference
+void AssemblyVisitor::visit(NotBoolExpr& node)
+{
+  static unsigned count = 0;
+	node.get_expr()->accept(*this); // Load eax with bool
+  proc->add_label("not" + std::to_string(count++)); // Remain local
+  proc->add(Op::CMP, EAX, imm(0));
+  proc->add(Op::JNE, sym(".false")); // Invert value
+  proc->add(Op::MOV, EAX, imm(1));
+  proc->add(Op::JMP, sym(".done"));
+  proc->add_label(".false");
+  proc->add(Op::MOV, EAX, imm(0));
+  proc->add_label(".done");
+}
 
-	node.get_second_op()->accept(*this); // Load eax with the second operand
+// Compares the operands of a relation
+Op AssemblyVisitor::compare(ComplexBoolExpr& node)
+{
+  Expr& first = *node.get_first_op();
+  Expr& second = *node.get_second_op();
+  Type first_type;
+  Operand left = EBX, right = EAX; // Where the operands are compared from
+
+  // Integers are compared straight from registers and variables
+  bool in_regs = allocatable(first) && allocatable(second) && expr_type(first) == INT && expr_type(second) == INT
+    && need(first) <= 4 && need(second) <= 3;
+  if (in_regs)
+  {
+    first_type = type = INT;
+    // cmp needs a register on the left
+    left = need(first) == 0 && operand(first).kind == OperandKind::REG ? operand(first) : EAX;
+    if (left == EAX)
+      gen(first, Reg::AX, SCRATCH & ~bit(Reg::AX));
+    right = need(second) == 0 ? operand(second) : EBX;
+    if (right == EBX)
+      gen(second, Reg::BX, SCRATCH & ~bit(Reg::AX) & ~bit(Reg::BX));
+  }
+  else
+  {
+    first.accept(*this); // Loads eax with the first operand
 
-  proc->add_instruction("comparison" + std::to_string(count++) + ":"); // Remain local
-	// Load eax with the result
-	switch (first_type)
-	{ /// All unsupported cases can be removed. They will never be called due to previous type checks.
-  case INT: // integer is the first operand
-    proc->add_instruction("pop ebx"); // Get the first operand
-    switch (type)
+    proc->add(Op::PUSH, EAX); // Save for later
+    first_type = type; // Get the type of the first operand
+
+    second.accept(*this); // Load eax with the second operand
+  }
+
+  if (first_type == STRING)
+  { // string REL string
+    proc->add(Op::MOV, EBX, EAX); // Second operand in ebx
+    proc->add(Op::POP, EAX); // Get the first operand
+    if (node.get_rel() == TokenType::EQUAL || node.get_rel() == TokenType::NOT_EQUAL)
     {
-    case INT: // integer REL integer
-      proc->add_instruction("cmp ebx,eax"); // Compare the two
-      switch (node.get_rel())
-      {
-      case TokenType::EQUAL: // int == int
-        proc->add_instruction("je .comptrue");
-        break;
+      asms->add_streq_proc();
+      proc->add(Op::CALL, sym("streq")); // Loads eax with 1 (eq) or 0, checking the lengths first
+      proc->add(Op::CMP, EAX, imm(0));
+      return node.get_rel() == TokenType::EQUAL ? Op::JNE : Op::JE;
+    }
 
-      case TokenType::NOT_EQUAL: // int != int
-        proc->add_instruction("jne .comptrue");
-        break;
+    asms->add_strcmp_proc();
+    proc->add(Op::CALL, sym("strcmp")); // Loads eax with -1 (lt), 0 (eq), 1(gt)
+    left = EAX;
+    right = imm(0);
+  }
+  else if (!in_regs) // int REL int, or bool REL bool
+    proc->add(Op::POP, EBX); // Get the first operand
+  proc->add(Op::CMP, left, right); // Compare the two
 
-      case TokenType::GREATER_THAN: // int < int
-        proc->add_instruction("jg .comptrue");
-        break;
+  switch (node.get_rel())
+  {
+  case TokenType::EQUAL:              return Op::JE;
+  case TokenType::NOT_EQUAL:          return Op::JNE;
+  case TokenType::LESS_THAN:          return Op::JL;
+  case TokenType::LESS_THAN_EQUAL:    return Op::JLE;
+  case TokenType::GREATER_THAN:       return Op::JG;
+  case TokenType::GREATER_THAN_EQUAL: return Op::JGE;
+  default:                            return Op::JMP;
+  }
+}
 
-      case TokenType::GREATER_THAN_EQUAL: // int <= int
-        proc->add_instruction("jge .comptrue");
-        break;
+// Gets the conditional jump taken when another is not
+static Op opposite(Op jump)
+{
+  switch (jump)
+  {
+  case Op::JE:  return Op::JNE;
+  case Op::JNE: return Op::JE;
+  case Op::JL:  return Op::JGE;
+  case Op::JGE: return Op::JL;
+  case Op::JG:  return Op::JLE;
+  case Op::JLE: return Op::JG;
+  default:      return jump;
+  }
+}
 
-      case TokenType::LESS_THAN: // int > int
-        proc->add_instruction("jl .comptrue");
-        break;
+// Jumps to a label if a boolean expression is true, or if it is false
+void AssemblyVisitor::branch(BoolExpr& node, bool when, const std::string& target)
+{
+  if (NotBoolExpr* negation = dynamic_cast<NotBoolExpr*>(&node))
+  {
+    branch(*negation->get_expr(), !when, target);
+    return;
+  }
 
-      case TokenType::LESS_THAN_EQUAL: // int >= int
-        proc->add_instruction("jle .comptrue");
-        break;
+  ComplexBoolExpr* relation = dynamic_cast<ComplexBoolExpr*>(&node);
+  if (!relation)
+  { // Anything else loads eax with a bool
+    node.accept(*this);
+    release();
+    proc->add(Op::CMP, EAX, imm(0));
+    proc->add(when ? Op::JNE : Op::JE, sym(target));
+    return;
+  }
 
-      default: break;
-      }
-      break;
+  Op taken = compare(*relation);
+  release(); // Keeps the flags
+  if (!relation->get_rest())
+  {
+    proc->add(when ? taken : opposite(taken), sym(target));
+    return;
+  }
 
-    case BOOL: // integer REL boolean
-    case STRING: // integer REL string
-      // Unsupported
-      break;
-    }
-    break;
+  // A true relation decides an or, and a false one an and.
+  // Otherwise the rest decides.
+  bool decides = relation->get_con_type() == TokenType::OR;
+  if (decides == when)
+    proc->add(when ? taken : opposite(taken), sym(target));
+  else
+  { // The relation decides against jumping
+    static unsigned count = 0;
+    std::string label = "connector" + std::to_string(count++);
+    proc->add(decides ? taken : opposite(taken), sym(label));
+    branch(*relation->get_rest(), when, target);
+    proc->add_label(label);
+    return;
+  }
+  branch(*relation->get_rest(), when, target);
+}
 
-  case BOOL: // bool is the first operand
-    // Unsupported
-    break;
+// Whether an expression is integer or boolean arithmetic on variables and constants
+bool AssemblyVisitor::allocatable(Expr& node)
+{
+	if (SimpleExpr* simple = dynamic_cast<SimpleExpr*>(&node))
+		switch (simple->get_term().get_type())
+		{
+		case TokenType::INT:
+		case TokenType::BOOL:
+			return true;
+
+		case TokenType::ID:
+		{
+			auto var = id_map.find(simple->get_term().get_lexeme());
+			return var != id_map.end() && var->second != STRING && lists.count(var->first) == 0;
+		}
+
+		default: return false;
+		}
+
+	if (ComplexExpr* complex = dynamic_cast<ComplexExpr*>(&node))
+		switch (complex->get_rel().get_type())
+		{
+		case TokenType::PLUS:
+		case TokenType::MINUS:
+		case TokenType::MULTIPLY:
+		case TokenType::DIVIDE:
+			return allocatable(*complex->get_first_op()) && allocatable(*complex->get_rest());
+
+		default: return false;
+		}
+
+	return false; // Lists, indexes and input
+}
 
-  case STRING: // string is the first operand
-    switch (type)
-    {
-    case INT: // string REL integer
-    case BOOL: // string REL boolean
-      // Unsupported
-      break;
+// Gets the number of registers an allocatable expression needs
+unsigned AssemblyVisitor::need(Expr& node)
+{
+	ComplexExpr* complex = dynamic_cast<ComplexExpr*>(&node);
+	if (!complex)
+		return 0; // Variables and constants are operands
+
+	unsigned first = need(*complex->get_first_op());
+	unsigned rest = need(*complex->get_rest());
+	unsigned regs;
+	if (first == 0 || rest == 0)
+		regs = std::max(std::max(first, rest), 1u); // The other side is an operand
+	else if (first == rest)
+		regs = first + 1; // One side is held while the other is computed
+	else
+		regs = std::max(first, rest); // The bigger side goes first
 
-    case STRING: // string REL string
-      proc->add_instruction("mov ebx, eax"); // Second operand in ebx
-      proc->add_instruction("pop eax"); // Get the first operand
-      asms->add_strcmp_proc();
-      proc->add_instruction("call strcmp"); // Loads eax with -1 (lt), 0 (eq), 1(gt)
-      proc->add_instruction("cmp eax,0");
-      switch (node.get_rel())
-      {
-      case TokenType::EQUAL: // string == string
-        proc->add_instruction("je .comptrue");
-        break;
+	if (complex->get_rel().get_type() == TokenType::DIVIDE)
+		++regs; // The divisor is held in a register of its own
+	return regs;
+}
 
-      case TokenType::NOT_EQUAL: // string != string
-        proc->add_instruction("jne .comptrue");
-        break;
+// Gets a variable or constant as an operand
+Operand AssemblyVisitor::operand(Expr& node)
+{
+	const Token& term = dynamic_cast<SimpleExpr&>(node).get_term();
+	switch (term.get_type())
+	{
+	case TokenType::INT:
+		return imm(std::stoll(term.get_lexeme()));
 
-      case TokenType::GREATER_THAN: // string < string
-        proc->add_instruction("jl .comptrue");
-        break;
+	case TokenType::BOOL:
+		return imm(term.get_lexeme().compare("true") == 0 ? 1 : 0); // 1 is true
 
-      case TokenType::GREATER_THAN_EQUAL: // string <= string
-        proc->add_instruction("jle .comptrue");
-        break;
+	default:
+		return variable(term.get_lexeme());
+	}
+}
 
-      case TokenType::LESS_THAN: // string > string
-        proc->add_instruction("jg .comptrue");
-        break;
+// Gets the type of an allocatable expression, which is the type of its last operand
+Type AssemblyVisitor::expr_type(Expr& node)
+{
+	if (ComplexExpr* complex = dynamic_cast<ComplexExpr*>(&node))
+		return expr_type(*complex->get_rest());
 
-      case TokenType::LESS_THAN_EQUAL: // string >= string
-        proc->add_instruction("jge .comptrue");
-        break;
+	const Token& term = dynamic_cast<SimpleExpr&>(node).get_term();
+	switch (term.get_type())
+	{
+	case TokenType::INT: return INT;
+	case TokenType::BOOL: return BOOL;
+	default: return id_map[term.get_lexeme()];
+	}
+}
 
-      default: break;
-      }
-      break;
-    }
-    break;
+// Whether an expression can be computed straight into the register of a variable
+bool AssemblyVisitor::in_place(Expr& node, const std::string& name)
+{
+	VarUseVisitor uses;
+	node.accept(uses);
+	if (uses.get_uses().count(name) == 0)
+		return true; // The variable is not read
+
+	ComplexExpr* complex = dynamic_cast<ComplexExpr*>(&node);
+	if (!complex)
+		return true; // x = x
+	if (complex->get_rel().get_type() == TokenType::DIVIDE)
+		return true; // The register is only written after the division
+
+	// x = x op y, which starts with the value already in the register
+	SimpleExpr* first = dynamic_cast<SimpleExpr*>(complex->get_first_op().get());
+	return first && first->get_term().get_type() == TokenType::ID && first->get_term().get_lexeme() == name
+		&& need(*complex->get_rest()) == 0;
+}
+
+// Compiles an allocatable expression into a register
+void AssemblyVisitor::gen(Expr& node, Reg dst, unsigned free)
+{
+	ComplexExpr* complex = dynamic_cast<ComplexExpr*>(&node);
+	if (!complex)
+	{ // A variable or a constant
+		Operand value = operand(node);
+		if (value != reg(dst))
+			proc->add(Op::MOV, reg(dst), value);
+		return;
 	}
-  // Same for all cases
-  proc->add_instruction("mov eax,0");
-  proc->add_instruction("jmp .done");
-  proc->add_instruction(".comptrue:");
-  proc->add_instruction("mov eax,1");
-  proc->add_instruction(".done:");
 
-	// Do boolean connector
-	if (node.get_rest())
-  {
-    proc->add_instruction("push eax"); // Save for later
-    node.get_rest()->accept(*this);
-    proc->add_instruction("pop ebx"); // Get the first operand
-    proc->add_instruction("connector:"); // Remain local
+	Expr& first = *complex->get_first_op();
+	Expr& rest = *complex->get_rest();
+	Op op;
+	switch (complex->get_rel().get_type())
+	{
+	case TokenType::PLUS: op = Op::ADD; break;
+	case TokenType::MINUS: op = Op::SUB; break;
+	case TokenType::MULTIPLY: op = Op::IMUL; break;
+	default:
+		gen_divide(first, rest, dst, free);
+		return;
+	}
 
-    proc->add_instruction("add eax,ebx"); // Same for all cases
-    switch (node.get_con_type())
-    {
-    case TokenType::AND:
-      proc->add_instruction("cmp eax,2");
-      proc->add_instruction("jne .connfalse");
-      break;
+	// Multiplying by 2 to the k is shifting left by k
+	Expr* shifted = nullptr;
+	int shift = -1;
+	if (op == Op::IMUL && need(rest) == 0 && operand(rest).kind == OperandKind::IMM
+	    && (shift = log2_of(operand(rest).value)) >= 0)
+		shifted = &first;
+	else if (op == Op::IMUL && need(first) == 0 && operand(first).kind == OperandKind::IMM
+	         && (shift = log2_of(operand(first).value)) >= 0)
+		shifted = &rest;
+
+	if (shifted)
+	{
+		gen(*shifted, dst, free);
+		if (shift > 0)
+			proc->add(Op::SHL, reg(dst), imm(shift));
+	}
+	else if (need(rest) == 0)
+	{ // dst = first op rest
+		gen(first, dst, free);
+		proc->add(op, reg(dst), operand(rest));
+	}
+	else if (need(first) == 0)
+	{ // dst = rest, then combine with first from the other side
+		gen(rest, dst, free);
+		if (op == Op::SUB)
+		{ // first - dst = -dst + first
+			proc->add(Op::NEG, reg(dst));
+			proc->add(Op::ADD, reg(dst), operand(first));
+		}
+		else
+			proc->add(op, reg(dst), operand(first));
+	}
+	else
+	{ // Both sides need registers. The side that needs more goes first.
+		Reg temp = first_reg(free);
+		unsigned rest_free = free & ~bit(temp);
+		if (need(first) >= need(rest))
+		{
+			gen(first, dst, rest_free);
+			gen(rest, temp, rest_free);
+			proc->add(op, reg(dst), reg(temp));
+		}
+		else
+		{
+			gen(rest, dst, rest_free);
+			gen(first, temp, rest_free);
+			if (op == Op::SUB)
+			{
+				proc->add(Op::SUB, reg(temp), reg(dst));
+				proc->add(Op::MOV, reg(dst), reg(temp));
+			}
+			else
+				proc->add(op, reg(dst), reg(temp));
+		}
+	}
+}
 
-    case TokenType::OR:
-      proc->add_instruction("cmp eax,0");
-      proc->add_instruction("je .connfalse");
-      break;
+// Compiles first / rest into a register.
+// Dividing by a constant needs no idiv. 2 to the k is an arithmetic shift
+// right by k, after adding 2 to the k less one to negative numbers so that
+// they round towards 0, as idiv does. Other constants multiply by a magic
+// number and keep the high half of the product.
+void AssemblyVisitor::gen_divide(Expr& first, Expr& rest, Reg dst, unsigned free)
+{
+	const int bits = asms->word_size() * 8;
+	long long constant = 0;
+	if (need(rest) == 0 && operand(rest).kind == OperandKind::IMM)
+		constant = operand(rest).value;
+	int shift = log2_of(constant);
+	bool by_constant = constant > 0 && constant <= INT_MAX;
+
+	// idiv divides edx:eax by a register or memory operand.
+	// By a constant, the dividend is kept in temp instead.
+	Operand divisor;
+	Reg temp = Reg::NONE;
+	if (need(rest) == 0 && operand(rest).kind != OperandKind::IMM)
+	{
+		divisor = operand(rest);
+		if (divisor.kind == OperandKind::MEM) // Nothing else gives the width
+			divisor.size = asms->get_target() == Target::X86_64 ? Size::QWORD : Size::DWORD;
+	}
+	else if (free & ~bit(Reg::AX) & ~bit(Reg::DX))
+		temp = first_reg(free & ~bit(Reg::AX) & ~bit(Reg::DX));
+	else if ((SCRATCH & bit(dst)) && dst != Reg::AX && dst != Reg::DX)
+		temp = dst; // dst is only needed at the end
+	else
+		temp = Reg::BX; // Borrowed, and saved below
+
+	// Save the registers in use that the division overwrites
+	unsigned clobbered = by_constant && shift >= 0 ? bit(Reg::AX) : bit(Reg::AX) | bit(Reg::DX);
+	unsigned saved = (clobbered | bit(temp)) & SCRATCH & ~free & ~bit(dst);
+	for (unsigned r = 0; r < static_cast<unsigned>(Reg::NONE); ++r)
+		if (saved & (1u << r))
+			proc->add(Op::PUSH, reg(static_cast<Reg>(r)));
+
+	unsigned scratch = (free | saved | (bit(dst) & SCRATCH)) & ~bit(temp);
+	Reg result = Reg::AX;
+	if (by_constant)
+	{
+		gen(first, temp, scratch);
+		if (shift == 0)
+			result = temp; // Dividing by 1
+		else if (shift > 0)
+		{ // eax = (temp + (temp < 0 ? 2^k - 1 : 0)) >> k
+			proc->add(Op::MOV, EAX, reg(temp));
+			if (shift > 1)
+				proc->add(Op::SAR, EAX, imm(bits - 1));
+			proc->add(Op::SHR, EAX, imm(bits - shift));
+			proc->add(Op::ADD, EAX, reg(temp));
+			proc->add(Op::SAR, EAX, imm(shift));
+		}
+		else
+		{ // edx = the high half of temp * multiplier, shifted, plus 1 if temp < 0
+			long long multiplier;
+			int magic_shift;
+			magic(constant, bits, multiplier, magic_shift);
+			proc->add(Op::MOV, EAX, imm(multiplier));
+			proc->add(Op::IMUL, reg(temp)); // edx:eax = eax * temp
+			if (multiplier < 0)
+				proc->add(Op::ADD, EDX, reg(temp));
+			if (magic_shift > 0)
+				proc->add(Op::SAR, EDX, imm(magic_shift));
+			proc->add(Op::MOV, EAX, reg(temp));
+			proc->add(Op::SHR, EAX, imm(bits - 1));
+			proc->add(Op::ADD, EDX, EAX);
+			result = Reg::DX;
+		}
+	}
+	else
+	{
+		if (temp != Reg::NONE)
+		{
+			gen(rest, temp, scratch);
+			divisor = reg(temp);
+		}
+		gen(first, Reg::AX, scratch & ~bit(Reg::AX));
+		proc->add(Op::CDQ); // Sign extend into edx
+		proc->add(Op::IDIV, divisor);
+	}
+	if (dst != result)
+		proc->add(Op::MOV, reg(dst), reg(result));
 
-    default: break;
-    }
-    // Same for all cases
-    proc->add_instruction("mov eax,1");
-    proc->add_instruction("jmp .done");
-    proc->add_instruction(".connfalse:");
-    proc->add_instruction("mov eax,0");
-    proc->add_instruction(".done");
-  }
+	for (unsigned r = static_cast<unsigned>(Reg::NONE); r-- > 0;)
+		if (saved & (1u << r))
+			proc->add(Op::POP, reg(static_cast<Reg>(r)));
 }
 
-// Accepts a NotBoolExpr reference
-void AssemblyVisitor::visit(NotBoolExpr& node)
+// Compiles an allocatable expression into a register if there are enough scratch registers
+bool AssemblyVisitor::gen_expr(Expr& node, Reg dst)
 {
-	node.get_expr()->accept(*this); // Load eax with bool
-  proc->add_instruction("not:"); // Remain local
-  proc->add_instruction("cmp eax,0");
-  proc->add_instruction("jne .false"); // Invert value
-  proc->add_instruction("mov eax,1");
-  proc->add_instruction("jmp .done");
-  proc->add_instruction(".false:");
-  proc->add_instruction("mov eax,0");
-  proc->add_instruction(".done");
+	unsigned free = SCRATCH & ~bit(dst);
+	if (!allocatable(node) || need(node) > std::bitset<16>(free).count() + 1)
+		return false;
+
+	gen(node, dst, free);
+	type = expr_type(node);
+	return true;
+}
+
+// Gets where an integer or boolean variable is
+Operand AssemblyVisitor::variable(const std::string& name)
+{
+	auto kept = reg_vars.find(name);
+	if (kept != reg_vars.end())
+		return reg(kept->second);
+	return mem(name);
+}
+
+// Keeps the most used variables of a loop in registers
+std::vector<std::string> AssemblyVisitor::promote(WhileStmt& node)
+{
+	VarUseVisitor uses;
+	node.accept(uses); // Counts every use in the loop ten times
+
+	// The callee-saved registers that do not hold a variable already
+	std::vector<Reg> pool = {Reg::SI, Reg::DI, Reg::BP};
+	if (asms->get_target() == Target::X86_64)
+		pool.insert(pool.end(), {Reg::R12, Reg::R13, Reg::R14, Reg::R15});
+	for (auto& kept: reg_vars)
+		pool.erase(std::remove(pool.begin(), pool.end(), kept.second), pool.end());
+
+	// Integers and booleans used at least twice each time around, busiest first.
+	// Variables declared in the loop, lists and variables used as lists stay in memory.
+	std::vector<std::pair<unsigned long, std::string>> candidates;
+	for (auto& use: uses.get_uses())
+	{
+		auto var = id_map.find(use.first);
+		if (var != id_map.end() && var->second != STRING && use.second >= 20 && reg_vars.count(use.first) == 0
+				&& uses.get_declared().count(use.first) == 0 && uses.get_indexed().count(use.first) == 0
+				&& lists.count(use.first) == 0)
+			candidates.emplace_back(use.second, use.first);
+	}
+	std::sort(candidates.begin(), candidates.end(),
+		[](const std::pair<unsigned long, std::string>& a, const std::pair<unsigned long, std::string>& b)
+			{ return a.first != b.first ? a.first > b.first : a.second < b.second; });
+
+	std::vector<std::string> promoted;
+	for (auto& candidate: candidates)
+	{
+		if (promoted.size() == pool.size())
+			break;
+		Reg r = pool[promoted.size()];
+		proc->add(Op::MOV, reg(r), mem(candidate.second)); // Load it before the loop
+		reg_vars[candidate.second] = r;
+		if (uses.get_assigned().count(candidate.second))
+			reg_dirty.insert(candidate.second);
+		promoted.push_back(candidate.second);
+	}
+	return promoted;
+}
+
+// Stores promoted variables back after their loop
+void AssemblyVisitor::demote(const std::vector<std::string>& promoted)
+{
+	for (const std::string& name: promoted)
+	{
+		if (reg_dirty.erase(name))
+			proc->add(Op::MOV, mem(name), reg(reg_vars[name]));
+		reg_vars.erase(name);
+	}
+}
+
+// Frees the strings allocated since the last call
+void AssemblyVisitor::release()
+{
+	if (!temps)
+		return;
+
+	asms->add_release_proc();
+	proc->add(Op::CALL, sym("release"));
+	temps = false;
+}
+
+// Adds a string literal to the program
+std::string AssemblyVisitor::literal(const std::string& text)
+{
+	static unsigned count = 0; // Keep track of the number of constant strings
+	std::string name = "strconst" + std::to_string(count++);
+	asms->add_constant(name, text);
+	return name;
+}
+
+// Whether an expression is a list variable, used as a whole
+bool AssemblyVisitor::list_variable(Expr& node)
+{
+	SimpleExpr* simple = dynamic_cast<SimpleExpr*>(&node);
+	return simple && simple->get_term().get_type() == TokenType::ID && lists.count(simple->get_term().get_lexeme());
+}
+
+// Gets the size in bytes of an element of a list
+int AssemblyVisitor::element_size(Type t)
+{
+	return t == BOOL ? 1 : asms->word_size();
+}
+
+// Whether an index is a constant known to be inside its list
+bool AssemblyVisitor::known_index(const std::string& name, Expr* index, long long& element)
+{
+	SimpleExpr* simple = dynamic_cast<SimpleExpr*>(index);
+	if (!index)
+		element = 0;
+	else if (simple && simple->get_term().get_type() == TokenType::INT)
+		element = std::stoll(simple->get_term().get_lexeme());
+	else
+		return false;
+	return element < lists[name]; // Never true for -1, a length that changes
+}
+
+// Loads eax with an element of a list
+void AssemblyVisitor::load_element(const std::string& name, Expr* index)
+{
+	Type element_type = id_map[name];
+	long long element;
+	if (known_index(name, index, element))
+	{ // No bounds check needed
+		proc->add(Op::MOV, EAX, mem(name));
+		if (element_type == BOOL)
+			proc->add(Op::MOVZX, EAX, mem(Reg::AX, element, Size::BYTE));
+		else
+			proc->add(Op::MOV, EAX, mem(Reg::AX, element * asms->word_size()));
+		type = element_type;
+		return;
+	}
+
+	if (!index)
+		proc->add(Op::MOV, EAX, imm(0));
+	else if (!gen_expr(*index, Reg::AX))
+		index->accept(*this); // Loads eax with the index
+
+	static unsigned count = 0;
+	proc->add_label("index" + std::to_string(count++)); // Remain local
+	proc->add(Op::MOV, EBX, mem(name));
+	proc->add(Op::CMP, EAX, mem(Reg::BX, -asms->word_size())); // Negative indexes are too big when unsigned
+	proc->add(Op::JB, sym(".inbounds"));
+	asms->add_outofbounds_proc();
+	proc->add(Op::CALL, sym("outofbounds"));
+	if (element_type == STRING)
+	{ // Like the interpreter, carry on with an empty value
+		asms->add_empty_string();
+		proc->add(Op::MOV, EAX, sym("emptystr"));
+	}
+	else
+		proc->add(Op::MOV, EAX, imm(0));
+	proc->add(Op::JMP, sym(".done"));
+	proc->add_label(".inbounds");
+	if (element_type == BOOL)
+		proc->add(Op::MOVZX, EAX, mem(Reg::BX, Reg::AX, 0, Size::BYTE));
+	else
+	{
+		proc->add(Op::SHL, EAX, imm(asms->word_shift()));
+		proc->add(Op::MOV, EAX, mem(Reg::BX, Reg::AX));
+	}
+	proc->add_label(".done");
+	type = element_type;
+}
+
+// Stores the value of an expression in an element of a list
+void AssemblyVisitor::store_element(const std::string& name, Expr* index, Expr& value)
+{
+	Type element_type = id_map[name];
+	long long element;
+	bool known = known_index(name, index, element);
+	if (!known)
+	{
+		if (!index)
+			proc->add(Op::MOV, EAX, imm(0));
+		else if (!gen_expr(*index, Reg::AX))
+			index->accept(*this); // Loads eax with the index
+
+		// Like the interpreter, writing outside of the list ends the program
+		static unsigned count = 0;
+		proc->add_label("store" + std::to_string(count++)); // Remain local
+		proc->add(Op::MOV, EBX, mem(name));
+		proc->add(Op::CMP, EAX, mem(Reg::BX, -asms->word_size())); // Negative indexes are too big when unsigned
+		proc->add(Op::JB, sym(".inbounds"));
+		asms->add_outofbounds_proc();
+		proc->add(Op::CALL, sym("outofbounds"));
+		proc->add(Op::MOV, EBX, imm(1));
+		proc->add(Op::JMP, sym("quit"));
+		proc->add_label(".inbounds");
+		if (element_type != BOOL)
+			proc->add(Op::SHL, EAX, imm(asms->word_shift()));
+		proc->add(Op::ADD, EAX, EBX);
+		proc->add(Op::PUSH, EAX); // The address of the element
+	}
+
+	if (!gen_expr(value, Reg::AX))
+		value.accept(*this); // Loads eax with the value to store
+
+	if (element_type == STRING)
+	{
+		proc->add(Op::MOV, EBX, EAX); // Where to read from
+		if (known)
+		{
+			proc->add(Op::MOV, EAX, mem(name));
+			if (element > 0)
+				proc->add(Op::ADD, EAX, imm(element * asms->word_size()));
+		}
+		else
+			proc->add(Op::POP, EAX);
+		asms->add_strset_proc();
+		proc->add(Op::CALL, sym("strset")); // Copy the string into the element
+	}
+	else
+	{
+		Operand to = mem(Reg::BX, 0, element_type == BOOL ? Size::BYTE : Size::NATIVE);
+		if (known)
+		{
+			proc->add(Op::MOV, EBX, mem(name));
+			to.value = element * element_size(element_type);
+		}
+		else
+			proc->add(Op::POP, EBX);
+		proc->add(Op::MOV, to, element_type == BOOL ? AL : EAX);
+	}
+	type = element_type;
+}
+
+// Gives a list variable a whole new list
+void AssemblyVisitor::define_list(const std::string& name, Expr* value)
+{
+	Type element_type = id_map[name];
+	int size = element_size(element_type);
+
+	if (value && list_variable(*value))
+	{ // A copy of another list
+		SimpleExpr& other = dynamic_cast<SimpleExpr&>(*value);
+		proc->add(Op::MOV, EAX, mem(other.get_term().get_lexeme()));
+		if (element_type == STRING)
+		{
+			asms->add_strlistcopy_proc();
+			proc->add(Op::CALL, sym("strlistcopy"));
+		}
+		else
+		{
+			proc->add(Op::MOV, ECX, imm(size));
+			asms->add_listcopy_proc();
+			proc->add(Op::CALL, sym("listcopy"));
+		}
+		proc->add(Op::MOV, mem(name), EAX);
+		return;
+	}
+
+	// The elements. A single value makes a list of one, as in the interpreter.
+	std::vector<Expr*> exprs;
+	if (ListExpr* list = dynamic_cast<ListExpr*>(value))
+		for (auto& expr: list->get_exprs())
+			exprs.push_back(expr.get());
+	else if (value)
+		exprs.push_back(value);
+
+	if (exprs.empty())
+	{ // The empty string has a length of 0 before it too
+		asms->add_empty_string();
+		proc->add(Op::MOV, EAX, sym("emptystr"));
+		proc->add(Op::MOV, mem(name), EAX);
+		return;
+	}
+
+	// Every element is worked out before any is stored, since they may read the list
+	for (Expr* expr: exprs)
+	{
+		if (!gen_expr(*expr, Reg::AX))
+			expr->accept(*this);
+		proc->add(Op::PUSH, EAX);
+	}
+
+	asms->add_listnew_proc();
+	if (lists[name] == static_cast<int>(exprs.size()))
+	{ // The length never changes, so the list is only made the first time
+		static unsigned count = 0;
+		proc->add_label("list" + std::to_string(count++)); // Remain local
+		proc->add(Op::MOV, EDX, mem(name));
+		proc->add(Op::CMP, EDX, imm(0));
+		proc->add(Op::JNE, sym(".ready"));
+		proc->add(Op::MOV, EAX, imm(exprs.size()));
+		proc->add(Op::MOV, ECX, imm(size));
+		proc->add(Op::CALL, sym("listnew"));
+		proc->add(Op::MOV, EDX, EAX);
+		proc->add(Op::MOV, mem(name), EDX);
+		proc->add_label(".ready");
+	}
+	else
+	{
+		proc->add(Op::MOV, EAX, imm(exprs.size()));
+		proc->add(Op::MOV, ECX, imm(size));
+		proc->add(Op::CALL, sym("listnew"));
+		proc->add(Op::MOV, EDX, EAX);
+		proc->add(Op::MOV, mem(name), EDX);
+	}
+
+	for (long long i = exprs.size() - 1; i >= 0; --i)
+		switch (element_type)
+		{
+		case INT:
+			proc->add(Op::POP, EAX);
+			proc->add(Op::MOV, mem(Reg::DX, i * size), EAX);
+			break;
+
+		case BOOL:
+			proc->add(Op::POP, EAX);
+			proc->add(Op::MOV, mem(Reg::DX, i, Size::BYTE), AL);
+			break;
+
+		case STRING:
+			proc->add(Op::POP, EBX); // Where to read from
+			proc->add(Op::LEA, EAX, mem(Reg::DX, i * size));
+			asms->add_strset_proc();
+			proc->add(Op::CALL, sym("strset")); // Copy the string into the element
+			break;
+		}
+	type = element_type;
 }
@@ -0,0 +1,188 @@
+// Defines everything in ElfWriter.h
+
+#include <string>
+
+#include "ElfWriter.h"
+#include "Encoder.h"
+
+// Appends a little endian value of the given number of bytes
+static void put(std::vector<uint8_t>& out, uint64_t value, unsigned bytes)
+{
+  for (unsigned i = 0; i < bytes; ++i)
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+// Rounds a value up to a multiple of a power of two
+static uint64_t align(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Constructor
+ElfWriter::ElfWriter(AsmStructure& a) :
+  asms(a),
+  x64(a.get_target() == Target::X86_64)
+{
+}
+
+// Appends a value of the native word size
+void ElfWriter::word(std::vector<uint8_t>& out, uint64_t value)
+{
+  put(out, value, x64 ? 8 : 4);
+}
+
+// Encodes the structure and writes the executable
+void ElfWriter::write(std::ostream& out)
+{
+  // Where ld would put a static executable
+  const uint64_t base = x64 ? 0x400000 : 0x08048000;
+  const uint64_t page = 0x1000;
+  const unsigned header_size = x64 ? 64 : 52;
+  const unsigned program_header_size = x64 ? 56 : 32;
+  const unsigned section_header_size = x64 ? 64 : 40;
+  const unsigned symbol_size = x64 ? 24 : 16;
+  const unsigned program_headers = 3; // Code, data and the stack permissions
+
+  Encoder encoder(asms);
+  encoder.layout();
+
+  // The writable segment starts on a new page, at the same offset into the
+  // page as in the file, so that both can be mapped straight from the file
+  uint64_t text_offset = align(header_size + program_headers * program_header_size, 16);
+  uint64_t text_address = base + text_offset;
+  uint64_t data_offset = align(text_offset + encoder.text_size(), 16);
+  uint64_t data_address = align(text_address + encoder.text_size(), page) + data_offset % page;
+  uint64_t bss_address = align(data_address + encoder.data_size(), 16);
+  encoder.encode(text_address, data_address, bss_address);
+
+  // The symbol table, for debuggers and objdump. Local symbols come first.
+  std::vector<uint8_t> strtab(1, 0);
+  std::vector<uint8_t> symtab(symbol_size, 0);
+  auto add_symbol = [&](const std::string& name, const Symbol& s, bool global)
+  {
+    uint32_t name_offset = strtab.size();
+    strtab.insert(strtab.end(), name.begin(), name.end());
+    strtab.push_back(0);
+
+    uint16_t section = s.section == Section::ABSOLUTE ? 0xfff1 : static_cast<uint16_t>(s.section) + 1;
+    uint64_t value = s.section == Section::ABSOLUTE ? s.value : encoder.address(name);
+    uint8_t info = global ? 0x10 : 0x00;
+    put(symtab, name_offset, 4);
+    if (x64)
+    {
+      put(symtab, info, 1);
+      put(symtab, 0, 1);
+      put(symtab, section, 2);
+      put(symtab, value, 8);
+      put(symtab, 0, 8);
+    }
+    else
+    {
+      put(symtab, value, 4);
+      put(symtab, 0, 4);
+      put(symtab, info, 1);
+      put(symtab, 0, 1);
+      put(symtab, section, 2);
+    }
+  };
+  for (auto& s: encoder.get_symbols())
+    if (s.first != "_start")
+      add_symbol(s.first, s.second, false);
+  uint32_t first_global = symtab.size() / symbol_size;
+  add_symbol("_start", encoder.get_symbols().at("_start"), true);
+
+  // The names of the sections
+  std::vector<uint8_t> shstrtab(1, 0);
+  auto section_name = [&](const std::string& name)
+  {
+    uint32_t name_offset = shstrtab.size();
+    shstrtab.insert(shstrtab.end(), name.begin(), name.end());
+    shstrtab.push_back(0);
+    return name_offset;
+  };
+  uint32_t text_name = section_name(".text");
+  uint32_t data_name = section_name(".data");
+  uint32_t bss_name = section_name(".bss");
+  uint32_t symtab_name = section_name(".symtab");
+  uint32_t strtab_name = section_name(".strtab");
+  uint32_t shstrtab_name = section_name(".shstrtab");
+
+  uint64_t symtab_offset = align(data_offset + encoder.data_size(), 8);
+  uint64_t strtab_offset = symtab_offset + symtab.size();
+  uint64_t shstrtab_offset = strtab_offset + strtab.size();
+  uint64_t section_headers_offset = align(shstrtab_offset + shstrtab.size(), 8);
+
+  // ELF header
+  std::vector<uint8_t> file = {0x7f, 'E', 'L', 'F', static_cast<uint8_t>(x64 ? 2 : 1), 1, 1, 0};
+  file.resize(16, 0);
+  put(file, 2, 2);              // An executable
+  put(file, x64 ? 62 : 3, 2);   // x86-64 or i386
+  put(file, 1, 4);              // Version
+  word(file, encoder.address("_start"));
+  word(file, header_size);      // The program headers follow
+  word(file, section_headers_offset);
+  put(file, 0, 4);              // Flags
+  put(file, header_size, 2);
+  put(file, program_header_size, 2);
+  put(file, program_headers, 2);
+  put(file, section_header_size, 2);
+  put(file, 7, 2);              // Sections
+  put(file, 6, 2);              // .shstrtab
+
+  // Program headers
+  auto segment = [&](uint32_t type, uint32_t flags, uint64_t offset, uint64_t address, uint64_t file_size,
+                     uint64_t memory_size, uint64_t alignment)
+  {
+    put(file, type, 4);
+    if (x64)
+      put(file, flags, 4);
+    word(file, offset);
+    word(file, address);
+    word(file, address);
+    word(file, file_size);
+    word(file, memory_size);
+    if (!x64)
+      put(file, flags, 4);
+    word(file, alignment);
+  };
+  segment(1, 5, 0, base, text_offset + encoder.text_size(), text_offset + encoder.text_size(), page); // r-x
+  segment(1, 6, data_offset, data_address, encoder.data_size(),
+          bss_address + encoder.bss_size() - data_address, page);                                   // rw-
+  segment(0x6474e551, 6, 0, 0, 0, 0, 16); // A stack that is not executable
+
+  // Sections
+  file.resize(text_offset, 0);
+  file.insert(file.end(), encoder.get_text().begin(), encoder.get_text().end());
+  file.resize(data_offset, 0);
+  file.insert(file.end(), encoder.get_data().begin(), encoder.get_data().end());
+  file.resize(symtab_offset, 0);
+  file.insert(file.end(), symtab.begin(), symtab.end());
+  file.insert(file.end(), strtab.begin(), strtab.end());
+  file.insert(file.end(), shstrtab.begin(), shstrtab.end());
+  file.resize(section_headers_offset, 0);
+
+  // Section headers
+  auto section = [&](uint32_t name, uint32_t type, uint64_t flags, uint64_t address, uint64_t offset,
+                     uint64_t size, uint32_t link, uint32_t info, uint64_t alignment, uint64_t entry_size)
+  {
+    put(file, name, 4);
+    put(file, type, 4);
+    word(file, flags);
+    word(file, address);
+    word(file, offset);
+    word(file, size);
+    put(file, link, 4);
+    put(file, info, 4);
+    word(file, alignment);
+    word(file, entry_size);
+  };
+  section(0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  section(text_name, 1, 6, text_address, text_offset, encoder.text_size(), 0, 0, 16, 0);
+  section(data_name, 1, 3, data_address, data_offset, encoder.data_size(), 0, 0, 16, 0);
+  section(bss_name, 8, 3, bss_address, data_offset + encoder.data_size(), encoder.bss_size(), 0, 0, 16, 0);
+  section(symtab_name, 2, 0, 0, symtab_offset, symtab.size(), 5, first_global, 8, symbol_size);
+  section(strtab_name, 3, 0, 0, strtab_offset, strtab.size(), 0, 0, 1, 0);
+  section(shstrtab_name, 3, 0, 0, shstrtab_offset, shstrtab.size(), 0, 0, 1, 0);
+
+  out.write(reinterpret_cast<const char*>(file.data()), file.size());
+}
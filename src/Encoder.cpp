@@ -0,0 +1,627 @@
+// Defines everything in Encoder.h
+
+#include "Encoder.h"
+#include "exception.h"
+
+// Appends a little endian value of the given number of bytes
+static void put(std::vector<uint8_t>& out, uint64_t value, unsigned bytes)
+{
+  for (unsigned i = 0; i < bytes; ++i)
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+// Whether a value fits in a sign extended byte
+static bool fits8(int64_t value)
+{
+  return value >= -128 && value <= 127;
+}
+
+// Whether a value fits in a sign extended double word
+static bool fits32(int64_t value)
+{
+  return value >= -2147483648LL && value <= 2147483647LL;
+}
+
+// Gets the hardware number of a register
+static unsigned number(Reg r)
+{
+  return static_cast<unsigned>(r);
+}
+
+// Whether an operand is memory at a fixed address
+static bool absolute_memory(const Operand& op)
+{
+  return op.kind == OperandKind::MEM && op.base == Reg::NONE && op.index == Reg::NONE;
+}
+
+// Gets the condition code of a conditional jump, as in 0x70 + cc
+static uint8_t condition(Op op)
+{
+  switch (op)
+  {
+  case Op::JB:  return 0x2;
+  case Op::JAE: return 0x3;
+  case Op::JE:  return 0x4;
+  case Op::JNE: return 0x5;
+  case Op::JBE: return 0x6;
+  case Op::JA:  return 0x7;
+  case Op::JL:  return 0xc;
+  case Op::JGE: return 0xd;
+  case Op::JLE: return 0xe;
+  default:      return 0xf; // JG
+  }
+}
+
+// Constructor
+Encoder::Encoder(AsmStructure& a) :
+  asms(a),
+  x64(a.get_target() == Target::X86_64),
+  placed(),
+  symbols(),
+  bases{0, 0, 0},
+  text(),
+  data(),
+  text_bytes(0),
+  bss_bytes(0)
+{
+}
+
+// Lays out the three sections
+void Encoder::layout()
+{
+  placed.clear();
+  symbols.clear();
+  data.clear();
+  bss_bytes = 0;
+
+  // Defines a symbol, which must not be defined already
+  auto define = [this](const std::string& name, Section section, uint64_t value)
+  {
+    if (!symbols.insert(std::make_pair(name, Symbol{section, value})).second)
+      throw Exception("symbol '" + name + "' is defined more than once", 0, 0, ExceptionType::ENCODER);
+  };
+
+  // .data
+  for (const Constant& c: asms.get_constants())
+  {
+    switch (c.kind)
+    {
+    case DataKind::STRING:
+      put(data, c.text.size(), x64 ? 8 : 4); // The header: capacity and length
+      put(data, c.text.size(), x64 ? 8 : 4);
+      define(c.name, Section::DATA, data.size());
+      data.insert(data.end(), c.text.begin(), c.text.end());
+      data.push_back(0);
+      define(c.name + "len", Section::ABSOLUTE, c.text.size() + 1); // Includes the 0
+      break;
+
+    case DataKind::EQU:
+      define(c.name, Section::ABSOLUTE, static_cast<int64_t>(c.value));
+      break;
+
+    case DataKind::WORD:
+      define(c.name, Section::DATA, data.size());
+      put(data, c.value, 2);
+      break;
+
+    case DataKind::BYTE:
+      define(c.name, Section::DATA, data.size());
+      put(data, c.value, 1);
+      break;
+    }
+  }
+
+  // .bss
+  for (const Variable& v: asms.get_variables())
+  {
+    define(v.name, Section::BSS, bss_bytes);
+    bss_bytes += v.size;
+  }
+
+  // .text, with every label defined so instructions can be sized
+  for (Procedure* p: asms.get_procedures())
+  {
+    std::string scope = p->get_name();
+    placed.push_back(Placed{0, scope, scope, 0, 0, false});
+    define(scope, Section::TEXT, 0);
+    for (const Instruction& in: p->get_instructions())
+    {
+      if (in.op != Op::LABEL)
+      {
+        placed.push_back(Placed{&in, "", scope, 0, 0, false});
+        continue;
+      }
+
+      std::string label = full_name(in.dst.symbol, scope);
+      if (in.dst.symbol[0] != '.')
+        scope = label; // A new scope for local labels
+      placed.push_back(Placed{0, label, scope, 0, 0, false});
+      define(label, Section::TEXT, 0);
+    }
+  }
+
+  // Only jumps change size with the layout
+  bases[0] = bases[1] = bases[2] = 0;
+  std::vector<uint8_t> scratch;
+  for (Placed& p: placed)
+  {
+    if (!p.in)
+      continue;
+    if (is_jump(p.in->op))
+    {
+      p.size = 2;
+      continue;
+    }
+    scratch.clear();
+    encode(p, scratch);
+    p.size = scratch.size();
+  }
+
+  // Lengthen the jumps that cannot reach, until none are left.
+  // Lengthening one can push others out of reach.
+  bool changed = true;
+  while (changed)
+  {
+    text_bytes = 0;
+    for (Placed& p: placed)
+    {
+      p.offset = text_bytes;
+      if (!p.in)
+        symbols[p.label].value = text_bytes;
+      text_bytes += p.size;
+    }
+
+    changed = false;
+    for (Placed& p: placed)
+    {
+      if (!p.in || !is_jump(p.in->op) || p.long_jump)
+        continue;
+
+      bool absolute;
+      int64_t distance = resolve(p.in->dst, p.scope, absolute) - static_cast<int64_t>(p.offset + p.size);
+      if (!fits8(distance))
+      {
+        p.long_jump = true;
+        p.size = p.in->op == Op::JMP ? 5 : 6;
+        changed = true;
+      }
+    }
+  }
+}
+
+// Encodes the .text section
+void Encoder::encode(uint64_t text_address, uint64_t data_address, uint64_t bss_address)
+{
+  bases[static_cast<int>(Section::TEXT)] = text_address;
+  bases[static_cast<int>(Section::DATA)] = data_address;
+  bases[static_cast<int>(Section::BSS)] = bss_address;
+
+  text.clear();
+  for (const Placed& p: placed)
+    if (p.in)
+      encode(p, text);
+}
+
+// Gets the address of a symbol
+uint64_t Encoder::address(const std::string& name)
+{
+  Operand op = sym(name);
+  bool absolute;
+  return resolve(op, "", absolute);
+}
+
+// Encodes one instruction
+void Encoder::encode(const Placed& p, std::vector<uint8_t>& out)
+{
+  const Instruction& in = *p.in;
+  const Operand& dst = in.dst;
+  const Operand& src = in.src;
+  const std::string& scope = p.scope;
+  bool absolute = true;
+  int64_t value = 0;
+  if (src.kind == OperandKind::IMM || src.kind == OperandKind::SYM)
+    value = resolve(src, scope, absolute);
+
+  // The operand that decides the width
+  const Operand& sized = dst.kind == OperandKind::REG || src.kind != OperandKind::REG ? dst : src;
+  bool byte = sized.size == Size::BYTE;
+  bool w = wide(sized);
+
+  // The opcode extension of the instructions that have one
+  unsigned ext = 0;
+  switch (in.op)
+  {
+  case Op::ADD: ext = 0; break;
+  case Op::OR:  ext = 1; break;
+  case Op::AND: ext = 4; break;
+  case Op::SUB: ext = 5; break;
+  case Op::XOR: ext = 6; break;
+  case Op::CMP: ext = 7; break;
+  case Op::NOT: ext = 2; break;
+  case Op::NEG: ext = 3; break;
+  case Op::MUL: ext = 4; break;
+  case Op::IMUL: ext = 5; break;
+  case Op::DIV: ext = 6; break;
+  case Op::IDIV: ext = 7; break;
+  case Op::INC: ext = 0; break;
+  case Op::DEC: ext = 1; break;
+  case Op::SHL: ext = 4; break;
+  case Op::SHR: ext = 5; break;
+  case Op::SAR: ext = 7; break;
+  default: break;
+  }
+
+  switch (in.op)
+  {
+  case Op::MOV:
+    if (dst.kind == OperandKind::REG && src.kind == OperandKind::REG)
+      emit(out, {static_cast<uint8_t>(byte ? 0x88 : 0x89)}, w, number(src.base), byte, dst, scope);
+    else if (dst.kind == OperandKind::REG && src.kind == OperandKind::MEM)
+    {
+      if (!x64 && dst.base == Reg::AX && absolute_memory(src))
+      { // mov eax,[address] has its own short form
+        out.push_back(byte ? 0xa0 : 0xa1);
+        put(out, resolve(src, scope, absolute), 4);
+      }
+      else
+        emit(out, {static_cast<uint8_t>(byte ? 0x8a : 0x8b)}, w, number(dst.base), byte, src, scope);
+    }
+    else if (dst.kind == OperandKind::MEM && src.kind == OperandKind::REG)
+    {
+      if (!x64 && src.base == Reg::AX && absolute_memory(dst))
+      { // So does mov [address],eax
+        out.push_back(byte ? 0xa2 : 0xa3);
+        put(out, resolve(dst, scope, absolute), 4);
+      }
+      else
+        emit(out, {static_cast<uint8_t>(byte ? 0x88 : 0x89)}, w, number(src.base), byte, dst, scope);
+    }
+    else if (dst.kind == OperandKind::REG && src.kind != OperandKind::NONE)
+    { // mov reg,constant
+      unsigned r = number(dst.base);
+      if (w && (!absolute || fits32(value)))
+      { // Sign extended from 32 bits
+        emit(out, {0xc7}, true, 0, false, dst, scope);
+        put(out, value, 4);
+        break;
+      }
+      if (x64 && (w || r >= 8 || (byte && r >= 4)))
+        out.push_back(0x40 | (w ? 0x08 : 0) | (r >= 8 ? 0x01 : 0));
+      out.push_back((byte ? 0xb0 : 0xb8) + (r & 7));
+      put(out, value, byte ? 1 : w ? 8 : 4);
+    }
+    else if (dst.kind == OperandKind::MEM && src.kind != OperandKind::NONE)
+    { // mov [memory],constant
+      emit(out, {static_cast<uint8_t>(byte ? 0xc6 : 0xc7)}, w, 0, false, dst, scope);
+      put(out, value, byte ? 1 : 4);
+    }
+    else
+      throw Exception("cannot encode '" + asms.render(in) + "'", 0, 0, ExceptionType::ENCODER);
+    break;
+
+  case Op::MOVZX:
+    emit(out, {0x0f, static_cast<uint8_t>(src.size == Size::WORD ? 0xb7 : 0xb6)}, wide(dst), number(dst.base), false,
+         src, scope);
+    break;
+
+  case Op::LEA:
+    emit(out, {0x8d}, wide(dst), number(dst.base), false, src, scope);
+    break;
+
+  case Op::ADD: case Op::OR: case Op::AND: case Op::SUB: case Op::XOR: case Op::CMP:
+    if (src.kind == OperandKind::REG)
+      emit(out, {static_cast<uint8_t>(ext * 8 + (byte ? 0 : 1))}, w, number(src.base), byte, dst, scope);
+    else if (src.kind == OperandKind::MEM)
+      emit(out, {static_cast<uint8_t>(ext * 8 + (byte ? 2 : 3))}, w, number(dst.base), byte, src, scope);
+    else if (byte && dst.kind == OperandKind::REG && dst.base == Reg::AX)
+    { // op al,constant
+      out.push_back(ext * 8 + 4);
+      put(out, value, 1);
+    }
+    else if (byte)
+    {
+      emit(out, {0x80}, false, ext, false, dst, scope);
+      put(out, value, 1);
+    }
+    else if (absolute && fits8(value))
+    { // A sign extended byte is enough
+      emit(out, {0x83}, w, ext, false, dst, scope);
+      put(out, value, 1);
+    }
+    else if (dst.kind == OperandKind::REG && dst.base == Reg::AX)
+    { // op eax,constant
+      if (w)
+        out.push_back(0x48);
+      out.push_back(ext * 8 + 5);
+      put(out, value, 4);
+    }
+    else
+    {
+      emit(out, {0x81}, w, ext, false, dst, scope);
+      put(out, value, 4);
+    }
+    break;
+
+  case Op::TEST:
+    if (src.kind == OperandKind::REG)
+      emit(out, {static_cast<uint8_t>(byte ? 0x84 : 0x85)}, w, number(src.base), byte, dst, scope);
+    else if (dst.kind == OperandKind::REG && dst.base == Reg::AX)
+    { // test eax,constant
+      if (w)
+        out.push_back(0x48);
+      out.push_back(byte ? 0xa8 : 0xa9);
+      put(out, value, byte ? 1 : 4);
+    }
+    else
+    {
+      emit(out, {static_cast<uint8_t>(byte ? 0xf6 : 0xf7)}, w, 0, false, dst, scope);
+      put(out, value, byte ? 1 : 4);
+    }
+    break;
+
+  case Op::IMUL:
+    if (src.kind == OperandKind::REG || src.kind == OperandKind::MEM)
+    { // imul reg,r/m
+      emit(out, {0x0f, 0xaf}, w, number(dst.base), false, src, scope);
+      break;
+    }
+    if (src.kind != OperandKind::NONE)
+    { // imul reg,reg,constant
+      bool short_form = absolute && fits8(value);
+      emit(out, {static_cast<uint8_t>(short_form ? 0x6b : 0x69)}, w, number(dst.base), false, dst, scope);
+      put(out, value, short_form ? 1 : 4);
+      break;
+    }
+    // Falls through - one operand imul is encoded like mul
+  case Op::MUL: case Op::DIV: case Op::IDIV: case Op::NEG: case Op::NOT:
+    emit(out, {static_cast<uint8_t>(byte ? 0xf6 : 0xf7)}, w, ext, false, dst, scope);
+    break;
+
+  case Op::INC: case Op::DEC:
+    if (!x64 && dst.kind == OperandKind::REG && !byte)
+      out.push_back((in.op == Op::INC ? 0x40 : 0x48) + number(dst.base));
+    else
+      emit(out, {static_cast<uint8_t>(byte ? 0xfe : 0xff)}, w, ext, false, dst, scope);
+    break;
+
+  case Op::SHL: case Op::SHR: case Op::SAR:
+    if (value == 1)
+      emit(out, {static_cast<uint8_t>(byte ? 0xd0 : 0xd1)}, w, ext, false, dst, scope);
+    else
+    {
+      emit(out, {static_cast<uint8_t>(byte ? 0xc0 : 0xc1)}, w, ext, false, dst, scope);
+      put(out, value, 1);
+    }
+    break;
+
+  case Op::CDQ:
+    if (x64)
+      out.push_back(0x48); // cqo
+    out.push_back(0x99);
+    break;
+
+  case Op::PUSH: case Op::POP:
+    if (dst.kind == OperandKind::REG)
+    { // Always the full register, so no REX.W
+      if (number(dst.base) >= 8)
+        out.push_back(0x41);
+      out.push_back((in.op == Op::PUSH ? 0x50 : 0x58) + (number(dst.base) & 7));
+    }
+    else if (in.op == Op::PUSH && dst.kind != OperandKind::MEM)
+    { // push constant
+      bool absolute_dst;
+      int64_t constant = resolve(dst, scope, absolute_dst);
+      bool short_form = absolute_dst && fits8(constant);
+      out.push_back(short_form ? 0x6a : 0x68);
+      put(out, constant, short_form ? 1 : 4);
+    }
+    else
+      throw Exception("cannot encode '" + asms.render(in) + "'", 0, 0, ExceptionType::ENCODER);
+    break;
+
+  case Op::CALL:
+    if (dst.kind == OperandKind::REG || dst.kind == OperandKind::MEM)
+    { // call r/m, always the full width so no REX.W
+      emit(out, {0xff}, false, 2, false, dst, scope);
+      break;
+    }
+    // Falls through - a call to a label is encoded like a jump
+  case Op::JMP: case Op::JE: case Op::JNE: case Op::JL: case Op::JLE: case Op::JG:
+  case Op::JGE: case Op::JB: case Op::JBE: case Op::JA: case Op::JAE:
+  {
+    if (dst.kind != OperandKind::SYM)
+      throw Exception("cannot encode '" + asms.render(in) + "'", 0, 0, ExceptionType::ENCODER);
+
+    bool absolute_dst;
+    int64_t target = resolve(dst, scope, absolute_dst);
+    int64_t here = bases[static_cast<int>(Section::TEXT)] + p.offset;
+    if (in.op == Op::CALL)
+    {
+      out.push_back(0xe8);
+      put(out, target - (here + 5), 4);
+    }
+    else if (!p.long_jump)
+    {
+      out.push_back(in.op == Op::JMP ? 0xeb : 0x70 + condition(in.op));
+      put(out, target - (here + 2), 1);
+    }
+    else if (in.op == Op::JMP)
+    {
+      out.push_back(0xe9);
+      put(out, target - (here + 5), 4);
+    }
+    else
+    {
+      out.push_back(0x0f);
+      out.push_back(0x80 + condition(in.op));
+      put(out, target - (here + 6), 4);
+    }
+    break;
+  }
+
+  case Op::RET:
+    out.push_back(0xc3);
+    break;
+
+  case Op::INT:
+    out.push_back(0xcd);
+    put(out, dst.value, 1);
+    break;
+
+  case Op::SYSCALL:
+    out.push_back(0x0f);
+    out.push_back(0x05);
+    break;
+
+  case Op::REP_MOVSB:
+    out.push_back(0xf3);
+    out.push_back(0xa4);
+    break;
+
+  // The SSE2 instructions have a prefix that comes before any REX prefix
+  case Op::MOVDQU:
+    out.push_back(0xf3);
+    if (dst.kind == OperandKind::REG) // movdqu xmm,xmm/m128
+      emit(out, {0x0f, 0x6f}, false, number(dst.base), false, src, scope);
+    else // movdqu m128,xmm
+      emit(out, {0x0f, 0x7f}, false, number(src.base), false, dst, scope);
+    break;
+
+  case Op::PCMPEQB:
+    out.push_back(0x66);
+    emit(out, {0x0f, 0x74}, false, number(dst.base), false, src, scope);
+    break;
+
+  case Op::PMOVMSKB:
+    out.push_back(0x66);
+    emit(out, {0x0f, 0xd7}, false, number(dst.base), false, src, scope);
+    break;
+
+  case Op::LABEL:
+    break;
+  }
+}
+
+// Appends the prefixes, opcode and ModRM bytes of an instruction
+void Encoder::emit(std::vector<uint8_t>& out, const std::vector<uint8_t>& opcode, bool w, unsigned reg, bool reg_byte,
+                   const Operand& rm, const std::string& scope)
+{
+  // The REX prefix extends the registers to 64 bits and past the first eight
+  uint8_t rex = 0;
+  if (w)
+    rex |= 0x48;
+  if (reg >= 8)
+    rex |= 0x44;
+  if (reg_byte && reg >= 4 && reg < 8)
+    rex |= 0x40; // spl, bpl, sil and dil instead of ah, ch, dh and bh
+  if (rm.kind == OperandKind::REG)
+  {
+    if (number(rm.base) >= 8)
+      rex |= 0x41;
+    if (rm.size == Size::BYTE && number(rm.base) >= 4 && number(rm.base) < 8)
+      rex |= 0x40;
+  }
+  else if (rm.kind == OperandKind::MEM)
+  {
+    if (rm.base != Reg::NONE && number(rm.base) >= 8)
+      rex |= 0x41;
+    if (rm.index != Reg::NONE && number(rm.index) >= 8)
+      rex |= 0x42;
+  }
+  if (rex)
+  {
+    if (!x64)
+      throw Exception("64-bit registers used on a 32-bit target", 0, 0, ExceptionType::ENCODER);
+    out.push_back(rex);
+  }
+  out.insert(out.end(), opcode.begin(), opcode.end());
+
+  uint8_t field = (reg & 7) << 3;
+  if (rm.kind == OperandKind::REG)
+  {
+    out.push_back(0xc0 | field | (number(rm.base) & 7));
+    return;
+  }
+  if (rm.kind != OperandKind::MEM)
+    throw Exception("expected a register or memory operand", 0, 0, ExceptionType::ENCODER);
+
+  // Addresses of labels are always written in full
+  bool absolute = true;
+  int64_t disp = rm.value;
+  if (!rm.symbol.empty())
+    disp = resolve(rm, scope, absolute);
+
+  if (rm.base == Reg::NONE)
+  {
+    if (rm.index != Reg::NONE)
+      throw Exception("cannot encode an index without a base", 0, 0, ExceptionType::ENCODER);
+    if (x64)
+    { // A SIB byte, since ModRM alone would be relative to rip
+      out.push_back(0x04 | field);
+      out.push_back(0x25);
+    }
+    else
+      out.push_back(0x05 | field);
+    put(out, disp, 4);
+    return;
+  }
+
+  unsigned base = number(rm.base) & 7;
+  uint8_t mod;
+  if (absolute && disp == 0 && base != 5) // [ebp] and [r13] always have a displacement
+    mod = 0x00;
+  else if (absolute && fits8(disp))
+    mod = 0x40;
+  else
+    mod = 0x80;
+
+  if (rm.index != Reg::NONE)
+  {
+    out.push_back(mod | field | 0x04);
+    out.push_back(((number(rm.index) & 7) << 3) | base);
+  }
+  else if (base == 4)
+  { // [esp] and [r12] need a SIB byte
+    out.push_back(mod | field | 0x04);
+    out.push_back(0x24);
+  }
+  else
+    out.push_back(mod | field | base);
+
+  if (mod == 0x40)
+    put(out, disp, 1);
+  else if (mod == 0x80)
+    put(out, disp, 4);
+}
+
+// Gets the value of an operand
+int64_t Encoder::resolve(const Operand& op, const std::string& scope, bool& absolute)
+{
+  absolute = true;
+  if (op.kind == OperandKind::IMM)
+    return op.value;
+
+  std::string name = full_name(op.symbol, scope);
+  auto found = symbols.find(name);
+  if (found == symbols.end())
+    throw Exception("symbol '" + name + "' is not defined", 0, 0, ExceptionType::ENCODER);
+
+  const Symbol& s = found->second;
+  if (s.section == Section::ABSOLUTE)
+    return static_cast<int64_t>(s.value) + op.value;
+
+  absolute = false;
+  return static_cast<int64_t>(bases[static_cast<int>(s.section)] + s.value) + op.value;
+}
+
+// Gets the full name of a label used in a scope
+std::string Encoder::full_name(const std::string& label, const std::string& scope)
+{
+  return !label.empty() && label[0] == '.' ? scope + label : label;
+}
+
+// Gets whether an operand is 64 bits wide
+bool Encoder::wide(const Operand& op)
+{
+  return x64 && (op.size == Size::NATIVE || op.size == Size::QWORD);
+}
@@ -0,0 +1,87 @@
+// Defines everything in Input.h
+
+#include "Input.h"
+
+// Reads what a stream has ready into a buffer
+std::streamsize read_some(std::istream& in, char* buffer, std::streamsize size)
+{
+  if (size <= 0 || in.peek() == std::char_traits<char>::eof()) // Waits for a byte
+    return 0;
+
+  std::streamsize count = in.readsome(buffer, size);
+  if (count == 0) // The stream does not say what it has ready
+    buffer[count++] = static_cast<char>(in.get());
+  return count;
+}
+
+// Constructor
+Input::Input(std::istream& i, std::ostream& o) :
+  in(i),
+  prompt(o),
+  buffer(SIZE),
+  len(0),
+  pos(0)
+{
+}
+
+// Reads the next word
+std::string Input::word()
+{
+  std::string text;
+  if (!skip())
+    return text;
+
+  // A word can go on into the next block
+  do
+  {
+    std::size_t start = pos;
+    while (pos < len && !space(buffer[pos]))
+      ++pos;
+    text.append(&buffer[start], pos - start);
+  } while (pos == len && fill());
+  return text;
+}
+
+// Reads the next word as an int
+int Input::integer()
+{
+  if (!skip())
+    return 0;
+
+  bool negative = buffer[pos] == '-';
+  if (negative)
+    ++pos;
+
+  // Wraps around like the compiled code does
+  unsigned value = 0;
+  while ((pos < len || fill()) && buffer[pos] >= '0' && buffer[pos] <= '9')
+    value = value * 10 + (buffer[pos++] - '0');
+
+  // The rest of the word is not used
+  while ((pos < len || fill()) && !space(buffer[pos]))
+    ++pos;
+
+  return static_cast<int>(negative ? 0u - value : value);
+}
+
+// Skips white space
+bool Input::skip()
+{
+  do
+  {
+    while (pos < len && space(buffer[pos]))
+      ++pos;
+    if (pos < len)
+      return true;
+  } while (fill());
+  return false;
+}
+
+// Reads the next block of the input
+bool Input::fill()
+{
+  prompt.flush(); // Prompts are shown before waiting for input
+  len = static_cast<std::size_t>(read_some(in, buffer.data(), SIZE));
+  pos = 0;
+  return len > 0;
+}
@@ -0,0 +1,215 @@
+// Defines everything in Instruction.h
+
+#include "Instruction.h"
+
+// Operand constructor
+Operand::Operand() :
+  kind(OperandKind::NONE),
+  size(Size::NATIVE),
+  base(Reg::NONE),
+  index(Reg::NONE),
+  value(0),
+  symbol()
+{
+}
+
+// Compares two operands
+bool operator==(const Operand& a, const Operand& b)
+{
+  return a.kind == b.kind && a.size == b.size && a.base == b.base && a.index == b.index
+      && a.value == b.value && a.symbol == b.symbol;
+}
+
+bool operator!=(const Operand& a, const Operand& b)
+{
+  return !(a == b);
+}
+
+// A register
+Operand reg(Reg r, Size s)
+{
+  Operand o;
+  o.kind = OperandKind::REG;
+  o.base = r;
+  o.size = s;
+  return o;
+}
+
+// An integer constant
+Operand imm(long long v)
+{
+  Operand o;
+  o.kind = OperandKind::IMM;
+  o.value = v;
+  return o;
+}
+
+// The address of a label, plus an offset
+Operand sym(const std::string& name, long long offset)
+{
+  Operand o;
+  o.kind = OperandKind::SYM;
+  o.symbol = name;
+  o.value = offset;
+  return o;
+}
+
+// The memory at a label
+Operand mem(const std::string& name, Size s)
+{
+  Operand o;
+  o.kind = OperandKind::MEM;
+  o.symbol = name;
+  o.size = s;
+  return o;
+}
+
+// The memory at a label plus a register
+Operand mem(const std::string& name, Reg r, Size s)
+{
+  Operand o = mem(name, s);
+  o.base = r;
+  return o;
+}
+
+// The memory at a register plus an offset
+Operand mem(Reg r, long long offset, Size s)
+{
+  Operand o;
+  o.kind = OperandKind::MEM;
+  o.base = r;
+  o.value = offset;
+  o.size = s;
+  return o;
+}
+
+// The memory at the sum of two registers plus an offset
+Operand mem(Reg r, Reg i, long long offset, Size s)
+{
+  Operand o = mem(r, offset, s);
+  o.index = i;
+  return o;
+}
+
+// Native width registers
+const Operand EAX = reg(Reg::AX);
+const Operand EBX = reg(Reg::BX);
+const Operand ECX = reg(Reg::CX);
+const Operand EDX = reg(Reg::DX);
+const Operand ESI = reg(Reg::SI);
+const Operand EDI = reg(Reg::DI);
+const Operand ESP = reg(Reg::SP);
+const Operand EBP = reg(Reg::BP);
+
+// Low byte registers
+const Operand AL = reg(Reg::AX, Size::BYTE);
+const Operand BL = reg(Reg::BX, Size::BYTE);
+const Operand CL = reg(Reg::CX, Size::BYTE);
+const Operand DL = reg(Reg::DX, Size::BYTE);
+
+// SSE registers
+const Operand XMM0 = reg(Reg::AX, Size::XMM);
+const Operand XMM1 = reg(Reg::CX, Size::XMM);
+
+// Whether an operation is a jump
+bool is_jump(Op op)
+{
+  switch (op)
+  {
+  case Op::JMP: case Op::JE: case Op::JNE: case Op::JL: case Op::JLE: case Op::JG:
+  case Op::JGE: case Op::JB: case Op::JBE: case Op::JA: case Op::JAE:
+    return true;
+
+  default: return false;
+  }
+}
+
+// The registers an operand uses to form an address
+static unsigned address_regs(const Operand& o)
+{
+  return o.kind == OperandKind::MEM ? bit(o.base) | bit(o.index) : 0;
+}
+
+// The general purpose register an operand names, if it is one
+static unsigned reg_bit(const Operand& o)
+{
+  return o.kind == OperandKind::REG && o.size != Size::XMM ? bit(o.base) : 0;
+}
+
+// Whether writing to an operand replaces the whole register
+static bool full_width(const Operand& o)
+{
+  return o.size != Size::BYTE && o.size != Size::WORD;
+}
+
+// Masks of the registers an instruction reads
+unsigned reads(const Instruction& in)
+{
+  unsigned mask = address_regs(in.dst) | address_regs(in.src) | reg_bit(in.src);
+
+  switch (in.op)
+  {
+  case Op::LABEL: return 0;
+
+  case Op::MOV: case Op::MOVZX: case Op::LEA:
+    if (!full_width(in.dst))
+      mask |= reg_bit(in.dst);
+    return mask;
+
+  case Op::PMOVMSKB: return mask;
+
+  case Op::POP:
+    if (!full_width(in.dst))
+      mask |= reg_bit(in.dst);
+    return mask | bit(Reg::SP);
+
+  case Op::PUSH: return mask | reg_bit(in.dst) | bit(Reg::SP);
+  case Op::CALL: case Op::RET: return mask | bit(Reg::SP);
+
+  case Op::MUL: case Op::IMUL: case Op::DIV: case Op::IDIV:
+    if (in.op == Op::IMUL && in.src.kind != OperandKind::NONE)
+      return mask | reg_bit(in.dst); // Two operand form
+    mask |= reg_bit(in.dst) | bit(Reg::AX);
+    if (in.op == Op::DIV || in.op == Op::IDIV)
+      mask |= bit(Reg::DX);
+    return mask;
+
+  case Op::CDQ: return bit(Reg::AX);
+  case Op::REP_MOVSB: return bit(Reg::CX) | bit(Reg::SI) | bit(Reg::DI);
+
+  case Op::INT: case Op::SYSCALL: // The system call number and arguments
+    return bit(Reg::AX) | bit(Reg::BX) | bit(Reg::CX) | bit(Reg::DX)
+         | bit(Reg::SI) | bit(Reg::DI);
+
+  default: return mask | reg_bit(in.dst);
+  }
+}
+
+// Masks of the registers an instruction writes
+unsigned writes(const Instruction& in)
+{
+  switch (in.op)
+  {
+  case Op::MOV: case Op::MOVZX: case Op::LEA:
+  case Op::ADD: case Op::SUB: case Op::AND: case Op::OR: case Op::XOR:
+  case Op::SHL: case Op::SHR: case Op::SAR:
+  case Op::INC: case Op::DEC: case Op::NEG: case Op::NOT:
+  case Op::PMOVMSKB:
+    return reg_bit(in.dst);
+
+  case Op::POP: return reg_bit(in.dst) | bit(Reg::SP);
+  case Op::PUSH: case Op::CALL: case Op::RET: return bit(Reg::SP);
+
+  case Op::MUL: case Op::IMUL: case Op::DIV: case Op::IDIV:
+    if (in.op == Op::IMUL && in.src.kind != OperandKind::NONE)
+      return reg_bit(in.dst); // Two operand form
+    return bit(Reg::AX) | bit(Reg::DX);
+
+  case Op::CDQ: return bit(Reg::DX);
+  case Op::REP_MOVSB: return bit(Reg::CX) | bit(Reg::SI) | bit(Reg::DI);
+  case Op::INT: return bit(Reg::AX);
+  case Op::SYSCALL: return bit(Reg::AX) | bit(Reg::CX) | bit(Reg::R11);
+
+  default: return 0;
+  }
+}
@@ -1,8 +1,10 @@
 // Defines the members of the Interpreter class
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "boost/optional.hpp"
 
@@ -15,11 +17,93 @@ Interpreter::Interpreter(std::ostream& os) :
   out(os),
   cur_var(0),
   it(0),
-  environments(0)
+  input(std::cin, std::cout),
+  environments(0),
+  quick(),
+  op_stats(false),
+  op_counts(),
+  pair_counts(),
+  last_stmt(),
+  profiler()
 {
   environments.push_front(std::make_unique<Environment<VarData>>());
 }
 
+// A helper to make SimpleExpr easier to navigate
+boost::optional<all_type> SimpleExprHelper(TokenType type, all_type data)
+{
+  all_type ret; // The return object
+
+  switch (type)
+  {
+  case TokenType::BOOL:
+    ret = boost::apply_visitor(bool_visitor(), data);
+    break;
+
+  case TokenType::INT:
+    ret = boost::apply_visitor(int_visitor(), data);
+    break;
+
+  case TokenType::STRING:
+    ret = boost::apply_visitor(string_visitor(), data);
+    break;
+
+  default:
+    return boost::none;
+    break;
+  }
+
+  return ret;
+}
+
+// The key a node is quickened under. This is the address of the most derived
+// object, so a node is found whether it is reached as a BoolExpr or a ComplexBoolExpr.
+static const void* quick_key(ASTNode& node)
+{
+  return dynamic_cast<const void*>(&node);
+}
+
+// Maps a declared type to the all_type alternative it is stored as
+static bool stored_type(TokenType t, Type& type)
+{
+  switch (t)
+  {
+  case TokenType::INT:    type = INT;    return true;
+  case TokenType::BOOL:   type = BOOL;   return true;
+  case TokenType::STRING: type = STRING; return true;
+  default: return false;
+  }
+}
+
+// Performs an integer relation
+static bool compare_ints(int a, int b, TokenType rel)
+{
+  switch (rel)
+  {
+  case TokenType::EQUAL:              return a == b;
+  case TokenType::LESS_THAN:          return a < b;
+  case TokenType::GREATER_THAN:       return a > b;
+  case TokenType::LESS_THAN_EQUAL:    return a <= b;
+  case TokenType::GREATER_THAN_EQUAL: return a >= b;
+  case TokenType::NOT_EQUAL:          return a != b;
+  default: return false;
+  }
+}
+
+// The name of a fused operation, for the op stats report
+static const char* quick_op_name(QuickOp op)
+{
+  switch (op)
+  {
+  case QuickOp::LOAD_CONST:   return "LOAD_CONST";
+  case QuickOp::LOAD_LOCAL:   return "LOAD_LOCAL";
+  case QuickOp::INC_LOCAL:    return "INC_LOCAL";
+  case QuickOp::APPEND_LOCAL: return "APPEND_LOCAL";
+  case QuickOp::CMP_LOCAL:    return "CMP_LOCAL";
+  default: return "GENERIC";
+  }
+}
+
 // Interpreter error definition
 void Interpreter::error(const Token& t, const std::string& msg)
 {
@@ -34,9 +118,221 @@ void Interpreter::error(const Token& t, const std::string& msg)
 									ExceptionType::VARVISIT);
 }
 
+// Finds the VarData of an identifier, or nullptr if it is undeclared
+VarData* Interpreter::lookup(const std::string& id)
+{
+  for (const auto& e: environments)
+  { // Check if this environment has this identifier defined
+    std::unique_ptr<VarData>* var_data = e->get_identifier(id);
+    if (var_data != nullptr)
+      return var_data->get();
+  }
+
+  return nullptr;
+}
+
+// Evaluates a boolean expression
+// A quickened id REL INT comparison is performed directly, without going through 'it'
+bool Interpreter::test(BoolExpr& node)
+{
+  auto found = quick.find(quick_key(node));
+  if (found != quick.end() && found->second.op == QuickOp::CMP_LOCAL)
+  {
+    const QuickNode& q = found->second;
+    if (const int* value = boost::get<int>(&q.var->get_value_ref()))
+    {
+      if (op_stats) count_op("ComplexBoolExpr", q.op, false);
+      return compare_ints(*value, q.constant, q.rel);
+    }
+  }
+
+  node.accept(*this);
+  return boost::get<bool>(it);
+}
+
+// Quickens a SimpleExpr
+// Literals cache their converted value and identifiers cache their VarData
+QuickNode& Interpreter::quicken(SimpleExpr& node)
+{
+  auto found = quick.find(quick_key(node));
+  if (found != quick.end())
+    return found->second;
+
+  QuickNode& q = quick[quick_key(node)];
+
+  Token term = node.get_term();
+  boost::optional<all_type> value = SimpleExprHelper(term.get_type(), term.get_lexeme());
+  if (value)
+  { // A literal never changes
+    q.op = QuickOp::LOAD_CONST;
+    q.value = *value;
+  }
+  else if ((q.var = lookup(term.get_lexeme())) && q.var->get_sub_type() != TokenType::ARRAY
+           && stored_type(q.var->get_type(), q.var_type))
+    q.op = QuickOp::LOAD_LOCAL;
+
+  return q;
+}
+
+// Quickens an AssignStmt
+// Recognizes id = id +/- INT on ints and id = id + expr on strings
+QuickNode& Interpreter::quicken(AssignStmt& node)
+{
+  auto found = quick.find(quick_key(node));
+  if (found != quick.end())
+    return found->second;
+
+  QuickNode& q = quick[quick_key(node)];
+
+  if (node.get_index())
+    return q; // Writing to an element of a list
+
+  std::shared_ptr<ComplexExpr> rhs = std::dynamic_pointer_cast<ComplexExpr>(node.get_assign());
+  if (!rhs)
+    return q;
+
+  std::shared_ptr<SimpleExpr> first = std::dynamic_pointer_cast<SimpleExpr>(rhs->get_first_op());
+  if (!first || first->get_term().get_type() != TokenType::ID
+      || first->get_term().get_lexeme() != node.get_id().get_lexeme())
+    return q; // The assigned variable is not the left operand
+
+  VarData* var = lookup(node.get_id().get_lexeme());
+  if (!var || var->get_sub_type() == TokenType::ARRAY)
+    return q;
+
+  TokenType rel = rhs->get_rel().get_type();
+  std::shared_ptr<SimpleExpr> rest = std::dynamic_pointer_cast<SimpleExpr>(rhs->get_rest());
+
+  if (var->get_type() == TokenType::INT && rest && rest->get_term().get_type() == TokenType::INT
+      && (rel == TokenType::PLUS || rel == TokenType::MINUS))
+  { // id = id + INT or id = id - INT
+    int constant = std::stoi(rest->get_term().get_lexeme());
+    q.op = QuickOp::INC_LOCAL;
+    q.var = var;
+    q.constant = (rel == TokenType::PLUS ? constant : -constant);
+  }
+  else if (var->get_type() == TokenType::STRING && rel == TokenType::PLUS)
+  { // id = id + expr
+    q.op = QuickOp::APPEND_LOCAL;
+    q.var = var;
+    q.operand = rhs->get_rest().get();
+  }
+
+  return q;
+}
+
+// Quickens a ComplexBoolExpr
+// Recognizes id REL INT on ints with no boolean connector
+QuickNode& Interpreter::quicken(ComplexBoolExpr& node)
+{
+  auto found = quick.find(quick_key(node));
+  if (found != quick.end())
+    return found->second;
+
+  QuickNode& q = quick[quick_key(node)];
+
+  if (node.get_rest())
+    return q;
+
+  std::shared_ptr<SimpleExpr> first = std::dynamic_pointer_cast<SimpleExpr>(node.get_first_op());
+  std::shared_ptr<SimpleExpr> second = std::dynamic_pointer_cast<SimpleExpr>(node.get_second_op());
+  if (!first || !second || first->get_term().get_type() != TokenType::ID
+      || second->get_term().get_type() != TokenType::INT)
+    return q;
+
+  VarData* var = lookup(first->get_term().get_lexeme());
+  if (!var || var->get_type() != TokenType::INT || var->get_sub_type() == TokenType::ARRAY)
+    return q;
+
+  q.op = QuickOp::CMP_LOCAL;
+  q.var = var;
+  q.constant = std::stoi(second->get_term().get_lexeme());
+  q.rel = node.get_rel();
+
+  return q;
+}
+
+// Counts one execution of a node shape
+// Statements are also counted in pairs with the statement executed before them
+void Interpreter::count_op(const char* name, QuickOp op, bool stmt)
+{
+  std::string shape = name;
+  if (op != QuickOp::GENERIC)
+    shape = shape + "[" + quick_op_name(op) + "]";
+
+  ++op_counts[shape];
+
+  if (stmt)
+  {
+    if (!last_stmt.empty())
+      ++pair_counts[last_stmt + " -> " + shape];
+    last_stmt = shape;
+  }
+}
+
+// Prints how many nodes were executed, then the most frequently executed
+// node shapes and statement pairs
+void Interpreter::print_op_stats(std::ostream& os)
+{
+  typedef std::pair<std::string, unsigned long> Count;
+
+  // Prints the largest entries of a table of counts
+  auto print_table = [&](const std::string& title, const std::unordered_map<std::string, unsigned long>& table)
+  {
+    std::vector<Count> sorted(table.begin(), table.end());
+    std::sort(sorted.begin(), sorted.end(), [](const Count& a, const Count& b)
+      { return a.second > b.second || (a.second == b.second && a.first < b.first); });
+
+    os << title << ":" << std::endl;
+    for (std::size_t i = 0; i < sorted.size() && i < 20; ++i)
+      os << "  " << sorted[i].second << "\t" << sorted[i].first << std::endl;
+  };
+
+  // The total of every shape, not only of the ones printed
+  unsigned long executed = 0;
+  for (const auto& c: op_counts)
+    executed += c.second;
+  os << "Executed nodes: " << executed << std::endl;
+
+  print_table("Executed node shapes", op_counts);
+  print_table("Executed statement pairs", pair_counts);
+}
+
+// Turns on the profiler
+void Interpreter::set_profile(ProfileMode mode)
+{
+  profiler.reset(mode == ProfileMode::OFF ? nullptr : new Profiler(mode));
+}
+
+// Prints the hot statements of a file
+void Interpreter::print_profile(std::ostream& os, const std::string& file)
+{
+  if (profiler)
+    profiler->print_report(os, file);
+}
+
+// Writes the stacks of a file in the folded format
+void Interpreter::write_folded(std::ostream& os, const std::string& file)
+{
+  if (profiler)
+    profiler->write_folded(os, file);
+}
+
 // Accepts a StmtList reference
 void Interpreter::visit(StmtList& node)
 {
+  // Run the statements, telling the profiler when each starts and ends
+  if (profiler)
+  {
+    for (std::shared_ptr<Stmt> s: node.get_stmts())
+    {
+      profiler->enter(*s);
+      s->accept(*this);
+      profiler->leave();
+    }
+    return;
+  }
+
 	// Run the statements
   for (std::shared_ptr<Stmt> s: node.get_stmts())
     s->accept(*this);
@@ -45,9 +341,7 @@ void Interpreter::visit(StmtList& node)
 // Accepts a BasicIf reference
 void Interpreter::visit(BasicIf& node)
 {
-  node.get_if()->accept(*this);
-
-  bool expr = boost::get<bool>(it);
+  bool expr = test(*node.get_if());
 
   if (expr)
     node.get_if_stmts()->accept(*this);
@@ -58,6 +352,8 @@ void Interpreter::visit(BasicIf& node)
 // Accepts a IfStmt reference
 void Interpreter::visit(IfStmt& node)
 {
+  if (op_stats) count_op("IfStmt", QuickOp::GENERIC, true);
+
   node.get_if()->accept(*this); // The if statement always exists
 
   // Whenever 'it' is true, then we ran statements and need to leave this node
@@ -79,65 +375,104 @@ void Interpreter::visit(IfStmt& node)
 // Accepts a WhileStmt reference
 void Interpreter::visit(WhileStmt& node)
 {
-  node.get_while()->accept(*this);
+  if (op_stats) count_op("WhileStmt", QuickOp::GENERIC, true);
 
-  while (boost::get<bool>(it))
-  {
-    node.get_stmts()->accept(*this);
-    node.get_while()->accept(*this);
-  }
+  BoolExpr& cond = *node.get_while();
+  StmtList& stmts = *node.get_stmts();
+
+  while (test(cond))
+    stmts.accept(*this);
 }
 
 // Accepts a PrintStmt reference
 void Interpreter::visit(PrintStmt& node)
 {
-  node.get_expr()->accept(*this);
+  if (op_stats) count_op("PrintStmt", QuickOp::GENERIC, true);
 
-  it = boost::apply_visitor(string_visitor(), it);
+  node.get_expr()->accept(*this);
 
-  switch (node.get_type())
+  // An int is written from its digits, without making a string of them.
+  // Lines are not flushed; std::cin and std::cerr flush std::cout before they are used.
+  char digits[INT_CHARS + 1];
+  char* end = digits + INT_CHARS;
+  const char* start;
+  if (const int* value = boost::get<int>(&it))
+    start = format_int(*value, end);
+  else
   {
-  case TokenType::PRINT:
-    std::cout << it;
-    break;
-  case TokenType::PRINTLN:
-    std::cout << it << std::endl;
-    break;
-
-  default: break;
+    it = boost::apply_visitor(string_visitor(), it);
+    const std::string& text = boost::get<std::string>(it);
+    std::cout.write(text.data(), text.size());
+    start = end;
   }
+
+  if (node.get_type() == TokenType::PRINTLN)
+    *end++ = '\n';
+  std::cout.write(start, end - start);
 }
 
 // Accepts a VarDecStmt reference
 void Interpreter::visit(VarDecStmt& node)
 {
+  if (op_stats) count_op("VarDecStmt", QuickOp::GENERIC, true);
+
   cur_var = new VarData(node.get_type(), node.get_sub_type()); // Create the base VarData object
 
   if (node.get_assign())
   {
     node.get_assign()->accept(*this); // Fill 'it' with the value of the rhs
-    cur_var->set_value(it); // Set the value to VarData
+    cur_var->set_value(std::move(it)); // Set the value to VarData
   }
 
-  environments.front()->add_identifier(node.get_id().get_lexeme(), (*cur_var));
+  // A declaration inside a loop runs again each time around. It assigns the
+  // variable again, as compiled code does, in place so quickened nodes still see it.
+  std::unique_ptr<VarData>* declared = environments.front()->get_identifier(node.get_id().get_lexeme());
+  if (!declared)
+    environments.front()->add_identifier(node.get_id().get_lexeme(), (*cur_var));
+  else if (node.get_assign())
+    **declared = *cur_var;
 }
 
 // Accepts an AssignStmt reference
 void Interpreter::visit(AssignStmt& node)
 {
-  // First, get the VarData for the variable we are assigning to
-  std::unique_ptr<VarData>* vardata;
+  QuickNode& q = quicken(node);
+  if (op_stats) count_op("AssignStmt", q.op, true);
 
-  for (const auto& e: environments)  /// update to std::for_each
-  { // Check if this environment has this identifier defined
-    std::unique_ptr<VarData>* var_data = e->get_identifier(node.get_id().get_lexeme());
-    if (var_data != nullptr)
+  switch (q.op)
+  {
+  case QuickOp::INC_LOCAL:
+    if (int* value = boost::get<int>(&q.var->get_value_ref()))
     {
-      vardata = var_data;
-      break;
+      *value += q.constant;
+      return;
     }
+    break;
+
+  case QuickOp::APPEND_LOCAL:
+    q.operand->accept(*this); // Get the value to append
+    if (std::string* value = boost::get<std::string>(&q.var->get_value_ref()))
+    { // The variable owns its string, so it grows in place
+      if (const std::string* str = boost::get<std::string>(&it))
+        value->append(*str);
+      else
+        value->append(boost::apply_visitor(string_visitor(), it));
+    }
+    else
+    { // Not holding a string yet, so read it as one and add normally
+      all_type held = *SimpleExprHelper(q.var->get_type(), boost::apply_visitor(string_visitor(), q.var->get_value_ref()));
+      q.var->set_value(mixed_mode_math_filter(std::move(held), std::move(it), TokenType::PLUS));
+    }
+    return;
+
+  default: break;
   }
 
+  // First, get the VarData for the variable we are assigning to
+  VarData* var = lookup(node.get_id().get_lexeme());
+  if (!var)
+    error(node.get_id(), "Use of undeclared identifier, ");
+
   int index = 0; // The index to write to
 
   if (node.get_index()) // Then we are writing to a particular element of a list
@@ -148,40 +483,32 @@ void Interpreter::visit(AssignStmt& node)
 
   node.get_assign()->accept(*this); // Get the value that should be assigned
 
-  if (!(*vardata)->set_value(it, index)) // Set the new value to the
+  if (!var->set_value(std::move(it), index)) // Set the new value to the
     error(node.get_id(), "Out of bounds access, ");
 }
 
-// A helper to make SimpleExpr easier to navigate
-boost::optional<all_type> SimpleExprHelper(TokenType type, all_type data)
+// Accepts a SimpleExpr reference
+void Interpreter::visit(SimpleExpr& node)
 {
-  all_type ret; // The return object
+  QuickNode& q = quicken(node);
+  if (op_stats) count_op("SimpleExpr", q.op, false);
 
-  switch (type)
+  if (q.op == QuickOp::LOAD_CONST)
   {
-  case TokenType::BOOL:
-    ret = boost::apply_visitor(bool_visitor(), data);
-    break;
-
-  case TokenType::INT:
-    ret = boost::apply_visitor(int_visitor(), data);
-    break;
-
-  case TokenType::STRING:
-    ret = boost::apply_visitor(string_visitor(), data);
-    break;
-
-  default:
-    return boost::none;
-    break;
+    it = q.value;
+    return;
   }
 
-  return ret;
-}
+  if (q.op == QuickOp::LOAD_LOCAL && q.var->get_length() > 0)
+  {
+    const all_type& value = q.var->get_value_ref();
+    if (boost::apply_visitor(all_type_visitor(), value) == q.var_type)
+      it = value; // Already stored as the declared type
+    else
+      it = *SimpleExprHelper(q.var->get_type(), boost::apply_visitor(string_visitor(), value));
+    return;
+  }
 
-// Accepts a SimpleExpr reference
-void Interpreter::visit(SimpleExpr& node)
-{
   all_type raw = node.get_term().get_lexeme(); // Conversion of string to all_type
 
   boost::optional<all_type> var = SimpleExprHelper(node.get_term().get_type(), raw); // Checking
@@ -242,19 +569,15 @@ void Interpreter::visit(ReadExpr& node)
   {
     case TokenType::READINT:
     { // Reading an int
-      int in;
       std::cout << node.get_msg().get_lexeme();
-      std::cin >> in;
-      it = in;
+      it = input.integer();
       break;
     }
 
     case TokenType::READSTR:
     { // Reading a string
-      std::string in;
       std::cout << node.get_msg().get_lexeme();
-      std::cin >> in;
-      it = in;
+      it = input.word();
       break;
     }
 
@@ -265,13 +588,15 @@ void Interpreter::visit(ReadExpr& node)
 // Accepts a ComplexExpr reference
 void Interpreter::visit(ComplexExpr& node)
 {
+  if (op_stats) count_op("ComplexExpr", QuickOp::GENERIC, false);
+
   node.get_first_op()->accept(*this);
 
-  all_type first = it;
+  all_type first = std::move(it); // Uniquely owned, so it can be appended to in place
 
   node.get_rest()->accept(*this);
 
-  it = mixed_mode_math_filter(first, it, node.get_rel().get_type());
+  it = mixed_mode_math_filter(std::move(first), std::move(it), node.get_rel().get_type());
 }
 
 // Accepts a SimpleBoolExpr reference
@@ -283,32 +608,33 @@ void Interpreter::visit(SimpleBoolExpr& node)
 // Accepts a ComplexBoolExpr reference
 void Interpreter::visit(ComplexBoolExpr& node)
 {
+  QuickNode& q = quicken(node);
+  if (op_stats) count_op("ComplexBoolExpr", q.op, false);
+
+  if (q.op == QuickOp::CMP_LOCAL)
+    if (const int* value = boost::get<int>(&q.var->get_value_ref()))
+    {
+      it = compare_ints(*value, q.constant, q.rel);
+      return;
+    }
+
   node.get_first_op()->accept(*this);
   all_type first = it; // Store the result of the first part
   node.get_second_op()->accept(*this);
+  it = mixed_mode_bool_filter(first, it, node.get_rel());
 
   if (node.get_rest())
   {
-    first = mixed_mode_bool_filter(first, it, node.get_rel()); // store the result of the lhs of the boolean connector
-    node.get_rest()->accept(*this); // Get the rest of the boolean expression
-
-    // We know that both first and it are boolean types because they are in a boolean expression,
+    // The rest of the boolean expression is only run when the relation does
+    // not decide it: a false relation before an and, or a true one before an or.
+    // We know that it is a boolean because it is the result of a relation,
     // so it is safe to use boost::get here.
-    switch (node.get_con_type())
-    {
-      case TokenType::OR:
-        it = boost::get<bool>(first) || boost::get<bool>(it);
-        break;
+    bool relation = boost::get<bool>(it);
+    if (relation == (node.get_con_type() == TokenType::OR))
+      return;
 
-      case TokenType::AND:
-        it = boost::get<bool>(first) && boost::get<bool>(it);
-        break;
-
-      default: break;
-    }
+    it = test(*node.get_rest());
   }
-  else // We are at the end of the boolean expression
-    it = mixed_mode_bool_filter(first, it, node.get_rel());
 }
 
 // Accepts a NotBoolExpr reference
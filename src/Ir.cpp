@@ -0,0 +1,315 @@
+// Defines everything in Ir.h
+
+#include <algorithm>
+
+#include "Ir.h"
+
+// Gets the name of an operation
+const char* ir_name(IrOp op)
+{
+  switch (op)
+  {
+  case IrOp::UNDEF:   return "undef";
+  case IrOp::CONST:   return "const";
+  case IrOp::LOAD:    return "load";
+  case IrOp::COPY:    return "copy";
+  case IrOp::PHI:     return "phi";
+  case IrOp::ADD:     return "add";
+  case IrOp::SUB:     return "sub";
+  case IrOp::MUL:     return "mul";
+  case IrOp::DIV:     return "div";
+  case IrOp::EQ:      return "eq";
+  case IrOp::NE:      return "ne";
+  case IrOp::LT:      return "lt";
+  case IrOp::GT:      return "gt";
+  case IrOp::LE:      return "le";
+  case IrOp::GE:      return "ge";
+  case IrOp::AND:     return "and";
+  case IrOp::OR:      return "or";
+  case IrOp::NOT:     return "not";
+  case IrOp::READ:    return "read";
+  case IrOp::INDEX:   return "index";
+  case IrOp::LIST:    return "list";
+  case IrOp::STORE:   return "store";
+  case IrOp::PRINT:   return "print";
+  case IrOp::PRINTLN: return "println";
+  case IrOp::JUMP:    return "jump";
+  case IrOp::BRANCH:  return "branch";
+  }
+  return "?";
+}
+
+// Whether an operation makes a value
+static bool has_value(IrOp op)
+{
+  switch (op)
+  {
+  case IrOp::STORE:
+  case IrOp::PRINT:
+  case IrOp::PRINTLN:
+  case IrOp::JUMP:
+  case IrOp::BRANCH:
+    return false;
+
+  default:
+    return true;
+  }
+}
+
+// Gets the name of a type
+static const char* type_name(Type t)
+{
+  switch (t)
+  {
+  case INT:    return "int";
+  case BOOL:   return "boolean";
+  case STRING: return "string";
+  }
+  return "?";
+}
+
+//----------------------------------------------------------------------
+// IrValue
+//----------------------------------------------------------------------
+
+// Constructor
+IrValue::IrValue(unsigned i, IrOp o, Type t) :
+  id(i),
+  op(o),
+  type(t),
+  operands(),
+  targets(),
+  constant(0),
+  name(),
+  home(),
+  block(nullptr),
+  replacement(nullptr)
+{
+}
+
+// Whether the instruction does nothing but make its value.
+// Reading a list can print that it is out of bounds, and dividing by 0 stops the program.
+bool IrValue::pure() const
+{
+  switch (op)
+  {
+  case IrOp::DIV:
+  case IrOp::READ:
+  case IrOp::INDEX:
+  case IrOp::LIST:
+    return false;
+
+  default:
+    return has_value(op);
+  }
+}
+
+//----------------------------------------------------------------------
+// IrBlock
+//----------------------------------------------------------------------
+
+// Constructor
+IrBlock::IrBlock(unsigned i) :
+  id(i),
+  values(),
+  preds(),
+  succs(),
+  idom(nullptr)
+{
+}
+
+//----------------------------------------------------------------------
+// IrSite
+//----------------------------------------------------------------------
+
+// Constructor
+IrSite::IrSite(const std::string& v, Stmt* s, StmtList* l) :
+  var(v),
+  stmt(s),
+  list(l),
+  incoming(),
+  live(false)
+{
+}
+
+//----------------------------------------------------------------------
+// IrLoop
+//----------------------------------------------------------------------
+
+// Constructor
+IrLoop::IrLoop(IrBlock* p, IrBlock* h, WhileStmt* s, StmtList* l) :
+  preheader(p),
+  header(h),
+  blocks(),
+  stmt(s),
+  list(l),
+  defs(nullptr),
+  end_defs(nullptr),
+  inductions()
+{
+}
+
+//----------------------------------------------------------------------
+// IrProgram
+//----------------------------------------------------------------------
+
+// Constructor
+IrProgram::IrProgram() :
+  blocks(),
+  values(),
+  sites(),
+  loops()
+{
+}
+
+// Adds a block
+IrBlock* IrProgram::add_block()
+{
+  blocks.push_back(std::make_unique<IrBlock>(blocks.size()));
+  return blocks.back().get();
+}
+
+// Adds an instruction to the end of a block
+IrValue* IrProgram::add(IrBlock* block, IrOp op, Type type, const std::vector<IrValue*>& operands)
+{
+  values.push_back(std::make_unique<IrValue>(values.size(), op, type));
+  IrValue* value = values.back().get();
+  value->operands = operands;
+  value->block = block;
+  block->values.push_back(value);
+  return value;
+}
+
+// Adds a site
+IrSite* IrProgram::add_site(const std::string& var, Stmt* stmt, StmtList* list)
+{
+  sites.push_back(std::make_unique<IrSite>(var, stmt, list));
+  return sites.back().get();
+}
+
+// Adds a loop
+IrLoop* IrProgram::add_loop(IrBlock* preheader, IrBlock* header, WhileStmt* stmt, StmtList* list)
+{
+  loops.push_back(std::make_unique<IrLoop>(preheader, header, stmt, list));
+  return loops.back().get();
+}
+
+// Adds a control flow edge
+void IrProgram::link(IrBlock* from, IrBlock* to)
+{
+  from->succs.push_back(to);
+  to->preds.push_back(from);
+}
+
+// Gets the value that stands for a value
+IrValue* IrProgram::resolve(IrValue* value)
+{
+  IrValue* end = value;
+  while (end->replacement)
+    end = end->replacement;
+
+  // Shorten the chain for next time
+  while (value->replacement && value->replacement != end)
+  {
+    IrValue* next = value->replacement;
+    value->replacement = end;
+    value = next;
+  }
+  return end;
+}
+
+// Has every use of a value use another value instead
+void IrProgram::replace(IrValue* value, IrValue* with)
+{
+  with = resolve(with);
+  if (value != with)
+    value->replacement = with;
+}
+
+// Makes operands refer to the values they stand for
+void IrProgram::forward()
+{
+  for (auto& block: blocks)
+  {
+    for (IrValue* v: block->values)
+      if (v->replacement)
+        v->block = nullptr;
+    block->values.erase(std::remove_if(block->values.begin(), block->values.end(),
+                                       [](IrValue* v) { return !v->block; }),
+                        block->values.end());
+
+    for (IrValue* v: block->values)
+      for (IrValue*& operand: v->operands)
+        operand = resolve(operand);
+  }
+}
+
+// Gets the number of instructions still in blocks
+unsigned IrProgram::size()
+{
+  unsigned count = 0;
+  for (auto& block: blocks)
+    count += block->values.size();
+  return count;
+}
+
+// Prints the program
+void IrProgram::print(std::ostream& out)
+{
+  for (auto& block: blocks)
+  {
+    if (block->values.empty())
+      continue; // Nothing reaches it
+
+    out << "b" << block->id << ":";
+    if (!block->preds.empty())
+    {
+      out << "  ; preds";
+      for (IrBlock* pred: block->preds)
+        out << " b" << pred->id;
+    }
+    out << std::endl;
+
+    for (IrValue* v: block->values)
+    {
+      out << "  ";
+      if (has_value(v->op))
+        out << "%" << v->id << " = " << type_name(v->type) << " ";
+      out << ir_name(v->op);
+
+      switch (v->op)
+      {
+      case IrOp::CONST:
+        if (v->type == STRING)
+          out << " \"" << v->constant << "\"";
+        else
+          out << " " << boost::apply_visitor(string_visitor(), v->constant);
+        break;
+
+      case IrOp::PHI:
+        for (std::size_t i = 0; i < v->operands.size(); ++i)
+          out << (i ? ", " : " ") << "[%" << v->operands[i]->id << ", b" << v->targets[i]->id << "]";
+        break;
+
+      case IrOp::JUMP:
+        out << " b" << v->targets[0]->id;
+        break;
+
+      case IrOp::BRANCH:
+        out << " %" << v->operands[0]->id << ", b" << v->targets[0]->id << ", b" << v->targets[1]->id;
+        break;
+
+      default:
+        if (!v->name.empty())
+          out << (v->op == IrOp::READ ? " \"" + v->name + "\"" : " " + v->name);
+        for (std::size_t i = 0; i < v->operands.size(); ++i)
+          out << (i || !v->name.empty() ? ", " : " ") << "%" << v->operands[i]->id;
+        break;
+      }
+
+      if (v->op == IrOp::PHI || (!v->home.empty() && v->op != IrOp::CONST))
+        out << "    ; " << (v->op == IrOp::PHI ? v->name : v->home);
+      out << std::endl;
+    }
+  }
+}
@@ -0,0 +1,531 @@
+// Defines the members of the IrBuilder class
+
+#include <climits>
+
+#include "IrBuilder.h"
+
+// Gets the type a variable is declared with
+static Type declared_type(TokenType t)
+{
+  switch (t)
+  {
+  case TokenType::BOOL:   return BOOL;
+  case TokenType::STRING: return STRING;
+  default:                return INT;
+  }
+}
+
+// Gets the operation of a math relation
+static IrOp math_op(TokenType t)
+{
+  switch (t)
+  {
+  case TokenType::MINUS:    return IrOp::SUB;
+  case TokenType::MULTIPLY: return IrOp::MUL;
+  case TokenType::DIVIDE:   return IrOp::DIV;
+  default:                  return IrOp::ADD;
+  }
+}
+
+// Gets the operation of a boolean relation
+static IrOp bool_op(TokenType t)
+{
+  switch (t)
+  {
+  case TokenType::NOT_EQUAL:          return IrOp::NE;
+  case TokenType::LESS_THAN:          return IrOp::LT;
+  case TokenType::GREATER_THAN:       return IrOp::GT;
+  case TokenType::LESS_THAN_EQUAL:    return IrOp::LE;
+  case TokenType::GREATER_THAN_EQUAL: return IrOp::GE;
+  default:                            return IrOp::EQ;
+  }
+}
+
+// Constructor
+IrBuilder::IrBuilder(IrProgram& p) :
+  program(p),
+  block(nullptr),
+  list(nullptr),
+  statement(nullptr),
+  defs(),
+  value(nullptr),
+  undef(nullptr),
+  declarations(),
+  types(),
+  lists(),
+  excluded(),
+  tracked(),
+  slots(),
+  reads()
+{
+}
+
+// Lowers a whole program
+void IrBuilder::build(StmtList& ast)
+{
+  excluded.clear();
+  for (;;)
+  {
+    program = IrProgram();
+    declarations.clear();
+    types.clear();
+    lists.clear();
+    tracked.clear();
+    slots.clear();
+    reads.clear();
+
+    std::set<std::string> assigned;
+    scan(ast, assigned, true);
+    for (auto& d: declarations)
+      if (d.second == 1 && !excluded.count(d.first))
+        tracked[d.first] = types[d.first];
+
+    block = program.add_block();
+    undef = add(IrOp::UNDEF, INT);
+    defs = std::make_shared<IrDefs>();
+    list = nullptr;
+
+    // A variable given a value of another type is left out, and the program built again
+    std::size_t before = excluded.size();
+    ast.accept(*this);
+    if (excluded.size() == before)
+      break;
+  }
+}
+
+// Finds the variables a list of statements declares and assigns.
+// The census counts declarations and finds the variables that cannot be in SSA form.
+void IrBuilder::scan(StmtList& stmts, std::set<std::string>& assigned, bool census)
+{
+  for (std::shared_ptr<Stmt> s: stmts.get_stmts())
+  {
+    if (VarDecStmt* dec = dynamic_cast<VarDecStmt*>(s.get()))
+    {
+      const std::string& name = dec->get_id().get_lexeme();
+      assigned.insert(name);
+      if (!census)
+        continue;
+
+      ++declarations[name];
+      types[name] = declared_type(dec->get_type());
+      if (dec->get_sub_type() == TokenType::ARRAY)
+        lists.insert(name);
+      if (dec->get_sub_type() == TokenType::ARRAY || !dec->get_assign())
+        excluded.insert(name); // Reading it before it is given a value differs between backends
+    }
+    else if (AssignStmt* assign = dynamic_cast<AssignStmt*>(s.get()))
+    {
+      assigned.insert(assign->get_id().get_lexeme());
+      if (census && assign->get_index())
+        excluded.insert(assign->get_id().get_lexeme());
+    }
+    else if (IfStmt* ifs = dynamic_cast<IfStmt*>(s.get()))
+    {
+      scan(*ifs->get_if()->get_if_stmts(), assigned, census);
+      for (auto& elseif: ifs->get_elseifs())
+        scan(*elseif->get_if_stmts(), assigned, census);
+      if (ifs->get_else())
+        scan(*ifs->get_else(), assigned, census);
+    }
+    else if (WhileStmt* loop = dynamic_cast<WhileStmt*>(s.get()))
+      scan(*loop->get_stmts(), assigned, census);
+  }
+}
+
+// Lowers an expression. A place that can be filled with something else is remembered.
+IrValue* IrBuilder::lower(std::shared_ptr<Expr> expr, std::function<void(std::shared_ptr<Expr>)> set)
+{
+  expr->accept(*this);
+  if (set)
+    slots.push_back(IrSlot{expr, set, value, block, statement, defs});
+  return value;
+}
+
+// Adds an instruction to the current block
+IrValue* IrBuilder::add(IrOp op, Type type, const std::vector<IrValue*>& operands)
+{
+  return program.add(block, op, type, operands);
+}
+
+// Ends the current block with a jump
+void IrBuilder::jump(IrBlock* to)
+{
+  add(IrOp::JUMP, INT)->targets.push_back(to);
+  program.link(block, to);
+}
+
+// Gets what the variables hold, to change it. Anything remembering the old
+// state keeps it.
+IrDefs& IrBuilder::change_defs()
+{
+  if (defs.use_count() > 1)
+    defs = std::make_shared<IrDefs>(*defs);
+  return *defs;
+}
+
+// Gives a variable in SSA form a value
+void IrBuilder::bind(const std::string& var, IrValue* v, Stmt* stmt)
+{
+  if (v->op != IrOp::UNDEF && v->type != tracked[var])
+    excluded.insert(var);
+  if (v->home.empty())
+    v->home = var;
+  change_defs()[var] = IrDef{v, program.add_site(var, stmt, list)};
+}
+
+// Gets the value an assignment gives its variable.
+// Assigning a variable makes a copy, which copy propagation removes.
+IrValue* IrBuilder::assigned_value(std::shared_ptr<Expr> expr, std::function<void(std::shared_ptr<Expr>)> set)
+{
+  IrValue* v = lower(expr, set);
+  SimpleExpr* simple = dynamic_cast<SimpleExpr*>(expr.get());
+  if (simple && simple->get_term().get_type() == TokenType::ID)
+    v = add(IrOp::COPY, v->type, {v});
+  return v;
+}
+
+// Joins what the variables hold at the ends of blocks, with a PHI for each
+// variable that they give different values
+std::shared_ptr<IrDefs> IrBuilder::join(IrBlock* at, const std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>>& arms)
+{
+  std::set<std::string> vars;
+  for (auto& arm: arms)
+    for (auto& def: *arm.second)
+      vars.insert(def.first);
+
+  auto joined = std::make_shared<IrDefs>();
+  for (const std::string& var: vars)
+  {
+    std::vector<IrDef> incoming;
+    bool same = true;
+    for (auto& arm: arms)
+    {
+      auto found = arm.second->find(var);
+      incoming.push_back(found != arm.second->end() ? found->second : IrDef{undef, nullptr});
+      same = same && incoming.back().site == incoming.front().site;
+    }
+
+    if (same)
+    {
+      (*joined)[var] = incoming.front();
+      continue;
+    }
+
+    IrValue* phi = program.add(at, IrOp::PHI, tracked[var]);
+    phi->name = phi->home = var;
+    IrSite* site = program.add_site(var, nullptr, nullptr);
+    for (std::size_t i = 0; i < arms.size(); ++i)
+    {
+      phi->operands.push_back(incoming[i].value);
+      phi->targets.push_back(arms[i].first);
+      if (incoming[i].site)
+        site->incoming.push_back(incoming[i].site);
+    }
+    (*joined)[var] = IrDef{phi, site};
+  }
+  return joined;
+}
+
+// Accepts a StmtList reference
+void IrBuilder::visit(StmtList& node)
+{
+  StmtList* outer = list;
+  Stmt* outer_statement = statement;
+  list = &node;
+  for (std::shared_ptr<Stmt> s: node.get_stmts())
+  {
+    statement = s.get();
+    s->accept(*this);
+  }
+  list = outer;
+  statement = outer_statement;
+}
+
+// Lowers one condition of an if statement, and the statements it runs.
+// Control is left where the next condition is tested.
+void IrBuilder::lower_arm(BasicIf& node, std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>>& arms)
+{
+  node.get_if()->accept(*this);
+  IrValue* branch = add(IrOp::BRANCH, BOOL, {value});
+  IrBlock* then_block = program.add_block();
+  IrBlock* else_block = program.add_block();
+  branch->targets = {then_block, else_block};
+  program.link(block, then_block);
+  program.link(block, else_block);
+
+  std::shared_ptr<IrDefs> start = defs;
+  block = then_block;
+  node.get_if_stmts()->accept(*this);
+  arms.push_back({block, defs});
+
+  block = else_block;
+  defs = start;
+}
+
+// Joins the ends of the arms of an if statement
+void IrBuilder::finish_if(std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>>& arms)
+{
+  IrBlock* after = program.add_block();
+  for (auto& arm: arms)
+  {
+    block = arm.first;
+    jump(after);
+  }
+  defs = join(after, arms);
+  block = after;
+}
+
+// Accepts a BasicIf reference
+void IrBuilder::visit(BasicIf& node)
+{
+  std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>> arms;
+  lower_arm(node, arms);
+  arms.push_back({block, defs});
+  finish_if(arms);
+}
+
+// Accepts a IfStmt reference
+void IrBuilder::visit(IfStmt& node)
+{
+  std::vector<std::pair<IrBlock*, std::shared_ptr<IrDefs>>> arms;
+  lower_arm(*node.get_if(), arms);
+  for (auto& elseif: node.get_elseifs())
+    lower_arm(*elseif, arms);
+  if (node.get_else())
+    node.get_else()->accept(*this);
+  arms.push_back({block, defs});
+  finish_if(arms);
+}
+
+// Accepts a WhileStmt reference
+void IrBuilder::visit(WhileStmt& node)
+{
+  IrBlock* header = program.add_block();
+  IrBlock* body = program.add_block();
+  IrBlock* exit = program.add_block();
+  IrBlock* entry = block;
+  IrLoop* loop = program.add_loop(entry, header, &node, list);
+  loop->defs = defs;
+  jump(header);
+  block = header;
+
+  // Every variable the loop changes gets a PHI. What it holds at the end of
+  // the loop is only known once the loop is lowered.
+  std::set<std::string> assigned;
+  scan(*node.get_stmts(), assigned, false);
+  std::vector<std::pair<IrValue*, IrSite*>> phis;
+  for (const std::string& var: assigned)
+  {
+    if (!tracked.count(var))
+      continue;
+
+    auto found = defs->find(var);
+    IrDef before = found != defs->end() ? found->second : IrDef{undef, nullptr};
+    IrValue* phi = add(IrOp::PHI, tracked[var], {before.value});
+    phi->name = phi->home = var;
+    phi->targets.push_back(entry);
+    IrSite* site = program.add_site(var, nullptr, nullptr);
+    if (before.site)
+      site->incoming.push_back(before.site);
+    change_defs()[var] = IrDef{phi, site};
+    phis.push_back({phi, site});
+  }
+  std::shared_ptr<IrDefs> at_header = defs;
+
+  node.get_while()->accept(*this);
+  IrValue* branch = add(IrOp::BRANCH, BOOL, {value});
+  branch->targets = {body, exit};
+  program.link(header, body);
+  program.link(header, exit);
+
+  block = body;
+  node.get_stmts()->accept(*this);
+  IrBlock* latch = block;
+  jump(header);
+  loop->end_defs = defs;
+
+  // The loop is every block made for it but the exit
+  for (auto& b: program.get_blocks())
+    if (b.get() != exit && b->id >= header->id)
+      loop->blocks.insert(b.get());
+
+  for (auto& phi: phis)
+  {
+    auto found = defs->find(phi.first->name);
+    IrDef after = found != defs->end() ? found->second : IrDef{undef, nullptr};
+    phi.first->operands.push_back(after.value);
+    phi.first->targets.push_back(latch);
+    if (after.site)
+      phi.second->incoming.push_back(after.site);
+  }
+
+  block = exit;
+  defs = at_header;
+}
+
+// Accepts a PrintStmt reference
+void IrBuilder::visit(PrintStmt& node)
+{
+  PrintStmt* stmt = &node;
+  IrValue* v = lower(node.get_expr(), [stmt](std::shared_ptr<Expr> e) { stmt->set_print_expr(e); });
+  add(node.get_type() == TokenType::PRINTLN ? IrOp::PRINTLN : IrOp::PRINT, v->type, {v});
+}
+
+// Accepts a VarDecStmt reference
+void IrBuilder::visit(VarDecStmt& node)
+{
+  VarDecStmt* stmt = &node;
+  auto set = [stmt](std::shared_ptr<Expr> e) { stmt->set_rhs_expr(e); };
+  const std::string& name = node.get_id().get_lexeme();
+
+  if (tracked.count(name))
+  {
+    bind(name, assigned_value(node.get_assign(), set), &node);
+    return;
+  }
+
+  IrValue* v = nullptr;
+  if (node.get_assign())
+    v = lower(node.get_assign(), node.get_sub_type() == TokenType::ARRAY ? std::function<void(std::shared_ptr<Expr>)>() : set);
+  else if (node.get_sub_type() == TokenType::ARRAY)
+    v = add(IrOp::LIST, types[name]);
+  if (v)
+    add(IrOp::STORE, types[name], {v})->name = name;
+}
+
+// Accepts an AssignStmt reference
+void IrBuilder::visit(AssignStmt& node)
+{
+  AssignStmt* stmt = &node;
+  auto set = [stmt](std::shared_ptr<Expr> e) { stmt->set_rhs_expr(e); };
+  const std::string& name = node.get_id().get_lexeme();
+
+  if (tracked.count(name))
+  {
+    bind(name, assigned_value(node.get_assign(), set), &node);
+    return;
+  }
+
+  std::vector<IrValue*> operands;
+  if (node.get_index())
+    operands.push_back(lower(node.get_index(), [stmt](std::shared_ptr<Expr> e) { stmt->set_index_expr(e); }));
+  operands.push_back(lower(node.get_assign(), set));
+  add(IrOp::STORE, types[name], operands)->name = name;
+}
+
+// Accepts a SimpleExpr reference
+void IrBuilder::visit(SimpleExpr& node)
+{
+  Token term = node.get_term();
+  switch (term.get_type())
+  {
+  case TokenType::INT:
+  {
+    long long constant = std::stoll(term.get_lexeme());
+    if (constant > INT_MAX)
+    { // Too big for the interpreter, so it is left alone
+      value = add(IrOp::LOAD, INT);
+      value->name = term.get_lexeme();
+      break;
+    }
+    value = add(IrOp::CONST, INT);
+    value->constant = static_cast<int>(constant);
+    break;
+  }
+
+  case TokenType::BOOL:
+    value = add(IrOp::CONST, BOOL);
+    value->constant = term.get_lexeme() == "true";
+    break;
+
+  case TokenType::STRING:
+    value = add(IrOp::CONST, STRING);
+    value->constant = term.get_lexeme();
+    break;
+
+  default:
+  {
+    const std::string& name = term.get_lexeme();
+    if (tracked.count(name))
+    {
+      auto found = defs->find(name);
+      value = found != defs->end() ? found->second.value : undef;
+      reads[&node] = found != defs->end() ? found->second.site : nullptr;
+    }
+    else
+    { // A whole list is its first element
+      value = add(lists.count(name) ? IrOp::INDEX : IrOp::LOAD, types[name]);
+      value->name = name;
+    }
+    break;
+  }
+  }
+}
+
+// Accepts a IndexExpr reference
+void IrBuilder::visit(IndexExpr& node)
+{
+  IndexExpr* expr = &node;
+  IrValue* index = lower(node.get_expr(), [expr](std::shared_ptr<Expr> e) { expr->set_index_expr(e); });
+  value = add(IrOp::INDEX, types[node.get_id().get_lexeme()], {index});
+  value->name = node.get_id().get_lexeme();
+}
+
+// Accepts a ListExpr reference
+void IrBuilder::visit(ListExpr& node)
+{
+  std::vector<IrValue*> elements;
+  for (auto& e: node.get_exprs())
+    elements.push_back(lower(e, nullptr));
+  value = add(IrOp::LIST, elements.empty() ? INT : elements.front()->type, elements);
+}
+
+// Accepts a ReadExpr reference
+void IrBuilder::visit(ReadExpr& node)
+{
+  value = add(IrOp::READ, node.get_type() == TokenType::READINT ? INT : STRING);
+  value->name = node.get_msg().get_lexeme();
+}
+
+// Accepts a ComplexExpr reference
+// The result always has the type of the first operand
+void IrBuilder::visit(ComplexExpr& node)
+{
+  ComplexExpr* expr = &node;
+  IrValue* first = lower(node.get_first_op(), [expr](std::shared_ptr<Expr> e) { expr->set_first_op(e); });
+  IrValue* rest = lower(node.get_rest(), [expr](std::shared_ptr<Expr> e) { expr->set_rest(e); });
+  value = add(math_op(node.get_rel().get_type()), first->type, {first, rest});
+}
+
+// Accepts a SimpleBoolExpr reference
+void IrBuilder::visit(SimpleBoolExpr& node)
+{
+  SimpleBoolExpr* expr = &node;
+  lower(node.get_expr_term(), [expr](std::shared_ptr<Expr> e) { expr->set_expr_term(e); });
+}
+
+// Accepts a ComplexBoolExpr reference
+void IrBuilder::visit(ComplexBoolExpr& node)
+{
+  ComplexBoolExpr* expr = &node;
+  IrValue* first = lower(node.get_first_op(), [expr](std::shared_ptr<Expr> e) { expr->set_first_op(e); });
+  IrValue* second = lower(node.get_second_op(), [expr](std::shared_ptr<Expr> e) { expr->set_second_op(e); });
+  IrValue* relation = add(bool_op(node.get_rel()), BOOL, {first, second});
+
+  // The backends only run the rest when the relation does not decide. Lowering
+  // it as a value is still sound, as the only thing in it that is not pure is
+  // a READ, which no pass moves or takes out.
+  if (node.get_rest())
+  {
+    node.get_rest()->accept(*this);
+    relation = add(node.get_con_type() == TokenType::AND ? IrOp::AND : IrOp::OR, BOOL, {relation, value});
+  }
+  value = relation;
+}
+
+// Accepts a NotBoolExpr reference
+void IrBuilder::visit(NotBoolExpr& node)
+{
+  node.get_expr()->accept(*this);
+  value = add(IrOp::NOT, BOOL, {value});
+}
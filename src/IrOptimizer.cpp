@@ -0,0 +1,531 @@
+// Defines the members of the IrOptimizer class
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#include "IrOptimizer.h"
+
+// How long a constant string can get by adding constants together
+static const std::size_t MAX_FOLDED_STRING = 256;
+
+// Constructor
+IrOptimizer::IrOptimizer(IrProgram& p) :
+  program(p),
+  timings()
+{
+}
+
+// Runs every pass
+void IrOptimizer::run()
+{
+  // Each of these can make more work for the others
+  for (unsigned round = 0; round < 10; ++round)
+  {
+    unsigned changes = time("constant propagation", [this] { return constant_propagation(); });
+    changes += time("copy propagation", [this] { return copy_propagation(); });
+    changes += time("value numbering", [this] { return value_numbering(); });
+    changes += time("loop invariant code motion", [this] { return loop_invariant_code_motion(); });
+    if (changes == 0)
+      break;
+  }
+  time("induction variables", [this] { return induction_variables(); });
+  time("dead code elimination", [this] { return dead_code_elimination(); });
+}
+
+// Runs a step and adds how long it took to its time
+unsigned IrOptimizer::time(const std::string& step, std::function<unsigned()> run_step)
+{
+  auto start = std::chrono::steady_clock::now();
+  unsigned changes = run_step();
+  std::chrono::duration<double> taken = std::chrono::steady_clock::now() - start;
+
+  auto found = std::find_if(timings.begin(), timings.end(), [&](const Timing& t) { return t.step == step; });
+  if (found == timings.end())
+    timings.push_back(Timing{step, taken.count(), 1, changes});
+  else
+  {
+    found->seconds += taken.count();
+    ++found->runs;
+    found->changes += changes;
+  }
+  return changes;
+}
+
+// Prints how long each step took, and how much it changed
+void IrOptimizer::print_timing(std::ostream& out)
+{
+  std::ostringstream table;
+  table << std::fixed << std::setprecision(3);
+  double total = 0;
+  for (const Timing& t: timings)
+  {
+    table << "  " << std::left << std::setw(28) << t.step << std::right << std::setw(9) << t.seconds * 1000 << " ms"
+          << std::setw(4) << t.runs << (t.runs == 1 ? " run " : " runs") << std::setw(6) << t.changes << " changed"
+          << std::endl;
+    total += t.seconds;
+  }
+  table << "  " << std::left << std::setw(28) << "total" << std::right << std::setw(9) << total * 1000 << " ms"
+        << std::endl;
+
+  out << "Pass timing:" << std::endl << table.str();
+}
+
+// Works out the value of an instruction whose operands are constants.
+// Only what every backend works out the same way is folded. Compiled code
+// prints negative numbers differently, and has wider ints on X86_64.
+bool IrOptimizer::fold(IrValue* v, all_type& result)
+{
+  for (IrValue* operand: v->operands)
+    if (operand->op != IrOp::CONST)
+      return false;
+
+  const int* a = v->operands.size() > 0 ? boost::get<int>(&v->operands[0]->constant) : nullptr;
+  const int* b = v->operands.size() > 1 ? boost::get<int>(&v->operands[1]->constant) : nullptr;
+  const bool* p = v->operands.size() > 0 ? boost::get<bool>(&v->operands[0]->constant) : nullptr;
+  const bool* q = v->operands.size() > 1 ? boost::get<bool>(&v->operands[1]->constant) : nullptr;
+
+  switch (v->op)
+  {
+  case IrOp::ADD:
+  case IrOp::SUB:
+  case IrOp::MUL:
+  case IrOp::DIV:
+  {
+    const std::string* s = boost::get<std::string>(&v->operands[0]->constant);
+    const std::string* t = boost::get<std::string>(&v->operands[1]->constant);
+    if (v->op == IrOp::ADD && s && t && s->size() + t->size() <= MAX_FOLDED_STRING)
+    {
+      result = *s + *t;
+      return true;
+    }
+    if (!a || !b || (v->op == IrOp::DIV && *b == 0))
+      return false;
+
+    long long x = *a, y = *b, r = 0;
+    switch (v->op)
+    {
+    case IrOp::ADD: r = x + y; break;
+    case IrOp::SUB: r = x - y; break;
+    case IrOp::MUL: r = x * y; break;
+    default:        r = x / y; break;
+    }
+    if (r < 0 || r > INT_MAX)
+      return false;
+    result = static_cast<int>(r);
+    return true;
+  }
+
+  case IrOp::EQ:
+  case IrOp::NE:
+  case IrOp::LT:
+  case IrOp::GT:
+  case IrOp::LE:
+  case IrOp::GE:
+    if (!a || !b)
+      return false;
+    switch (v->op)
+    {
+    case IrOp::EQ: result = *a == *b; break;
+    case IrOp::NE: result = *a != *b; break;
+    case IrOp::LT: result = *a < *b;  break;
+    case IrOp::GT: result = *a > *b;  break;
+    case IrOp::LE: result = *a <= *b; break;
+    default:       result = *a >= *b; break;
+    }
+    return true;
+
+  case IrOp::AND:
+  case IrOp::OR:
+    if (!p || !q)
+      return false;
+    result = v->op == IrOp::AND ? (*p && *q) : (*p || *q);
+    return true;
+
+  case IrOp::NOT:
+    if (!p)
+      return false;
+    result = !*p;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+// Constant propagation.
+// Instructions whose operands are constants become constants, and so do
+// PHIs whose operands are all the same constant.
+unsigned IrOptimizer::constant_propagation()
+{
+  unsigned changes = 0;
+  for (auto& block: program.get_blocks())
+    for (IrValue* v: block->values)
+    {
+      all_type result;
+      if (v->op == IrOp::PHI)
+      {
+        IrValue* first = nullptr;
+        bool same = true;
+        for (IrValue* operand: v->operands)
+        {
+          operand = program.resolve(operand);
+          if (operand->op == IrOp::UNDEF || operand == v)
+            continue; // Nothing reads a variable before it has a value
+          if (operand->op != IrOp::CONST || (first && (first->type != operand->type || !(first->constant == operand->constant))))
+            same = false;
+          first = operand;
+        }
+        if (!same || !first)
+          continue;
+        v->type = first->type;
+        result = first->constant;
+      }
+      else if (v->operands.empty() || !fold(v, result))
+        continue;
+
+      v->op = IrOp::CONST;
+      v->operands.clear();
+      v->targets.clear();
+      v->constant = result;
+      ++changes;
+    }
+  return changes;
+}
+
+// Copy propagation.
+// A COPY is replaced by its operand, and a PHI by its only operand.
+unsigned IrOptimizer::copy_propagation()
+{
+  unsigned changes = 0;
+  for (auto& block: program.get_blocks())
+    for (IrValue* v: block->values)
+    {
+      if (v->op == IrOp::COPY)
+      {
+        program.replace(v, v->operands[0]);
+        ++changes;
+      }
+      else if (v->op == IrOp::PHI)
+      {
+        IrValue* only = nullptr;
+        bool trivial = true;
+        for (IrValue* operand: v->operands)
+        {
+          operand = program.resolve(operand);
+          if (operand == v)
+            continue; // Unchanged around a loop
+          if (only && operand != only)
+            trivial = false;
+          only = operand;
+        }
+        if (trivial && only)
+        {
+          program.replace(v, only);
+          ++changes;
+        }
+      }
+    }
+  program.forward();
+  return changes;
+}
+
+// Finds the immediate dominator of each block, and gives the blocks that can
+// be reached in reverse postorder.
+// From "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy.
+std::vector<IrBlock*> IrOptimizer::dominators()
+{
+  std::vector<IrBlock*> postorder;
+  std::map<IrBlock*, unsigned> number;
+  std::vector<std::pair<IrBlock*, std::size_t>> stack;
+  IrBlock* entry = program.get_blocks().front().get();
+
+  for (auto& block: program.get_blocks())
+    block->idom = nullptr;
+
+  std::set<IrBlock*> seen = {entry};
+  stack.push_back({entry, 0});
+  while (!stack.empty())
+  {
+    IrBlock* block = stack.back().first;
+    std::size_t next = stack.back().second++;
+    if (next < block->succs.size())
+    {
+      if (seen.insert(block->succs[next]).second)
+        stack.push_back({block->succs[next], 0});
+      continue;
+    }
+    number[block] = postorder.size();
+    postorder.push_back(block);
+    stack.pop_back();
+  }
+  std::vector<IrBlock*> order(postorder.rbegin(), postorder.rend());
+
+  auto intersect = [&](IrBlock* a, IrBlock* b)
+  {
+    while (a != b)
+    {
+      while (number[a] < number[b])
+        a = a->idom;
+      while (number[b] < number[a])
+        b = b->idom;
+    }
+    return a;
+  };
+
+  entry->idom = entry;
+  for (bool changed = true; changed; )
+  {
+    changed = false;
+    for (IrBlock* block: order)
+    {
+      if (block == entry)
+        continue;
+
+      IrBlock* idom = nullptr;
+      for (IrBlock* pred: block->preds)
+        if (pred->idom)
+          idom = idom ? intersect(pred, idom) : pred;
+      if (idom != block->idom)
+      {
+        block->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  return order;
+}
+
+// Global value numbering.
+// Walks down the dominator tree, so a value is only replaced by one that is
+// always worked out before it.
+unsigned IrOptimizer::value_numbering()
+{
+  std::vector<IrBlock*> order = dominators();
+  std::map<IrBlock*, std::vector<IrBlock*>> children;
+  for (IrBlock* block: order)
+    if (block->idom != block)
+      children[block->idom].push_back(block);
+
+  std::map<std::string, IrValue*> table;
+  unsigned changes = number(order.front(), children, table);
+  program.forward();
+  return changes;
+}
+
+// Numbers the values of a block and the blocks it dominates
+unsigned IrOptimizer::number(IrBlock* block, std::map<IrBlock*, std::vector<IrBlock*>>& children,
+                             std::map<std::string, IrValue*>& table)
+{
+  unsigned changes = 0;
+  std::vector<std::string> added;
+  for (IrValue* v: block->values)
+  {
+    switch (v->op)
+    {
+    case IrOp::CONST:
+    case IrOp::PHI:
+    case IrOp::ADD:
+    case IrOp::SUB:
+    case IrOp::MUL:
+    case IrOp::DIV:
+    case IrOp::EQ:
+    case IrOp::NE:
+    case IrOp::LT:
+    case IrOp::GT:
+    case IrOp::LE:
+    case IrOp::GE:
+    case IrOp::AND:
+    case IrOp::OR:
+    case IrOp::NOT:
+      break;
+
+    default:
+      continue; // Reads memory or has an effect
+    }
+
+    std::vector<unsigned> operands;
+    for (IrValue* operand: v->operands)
+      operands.push_back(program.resolve(operand)->id);
+
+    // The order does not matter to these. Adding strings joins them, so the order matters there.
+    bool commutes = v->op == IrOp::EQ || v->op == IrOp::NE || v->op == IrOp::AND || v->op == IrOp::OR
+                    || ((v->op == IrOp::ADD || v->op == IrOp::MUL) && v->type == INT
+                        && program.resolve(v->operands[1])->type == INT);
+    if (commutes)
+      std::sort(operands.begin(), operands.end());
+
+    std::ostringstream key;
+    key << static_cast<int>(v->op) << " " << v->type;
+    if (v->op == IrOp::CONST)
+      key << " " << boost::apply_visitor(string_visitor(), v->constant);
+    if (v->op == IrOp::PHI)
+      key << " b" << block->id; // PHIs in different blocks pick from different places
+    for (unsigned operand: operands)
+      key << " %" << operand;
+
+    auto found = table.find(key.str());
+    if (found != table.end())
+    {
+      program.replace(v, found->second);
+      ++changes;
+    }
+    else
+    {
+      table[key.str()] = v;
+      added.push_back(key.str());
+    }
+  }
+
+  for (IrBlock* child: children[block])
+    changes += number(child, children, table);
+
+  for (const std::string& key: added)
+    table.erase(key);
+  return changes;
+}
+
+// Loop invariant code motion.
+// A value whose operands all come from outside a loop is worked out before
+// it, in the preheader, which every way into the loop passes through. It is
+// then worked out even if the loop does not run, so only what cannot fail
+// and has no effect is moved. String + and * allocate, and a string repeat
+// can ask for any size, so only int math is. Counts the values moved that
+// are not constants.
+unsigned IrOptimizer::loop_invariant_code_motion()
+{
+  unsigned changes = 0;
+  for (bool moved = true; moved; )
+  {
+    moved = false;
+    for (auto& loop: program.get_loops())
+      for (auto& b: program.get_blocks())
+      {
+        IrBlock* block = b.get();
+        if (!loop->blocks.count(block))
+          continue;
+
+        for (std::size_t i = 0; i < block->values.size(); )
+        {
+          IrValue* v = block->values[i];
+          bool invariant = false;
+          switch (v->op)
+          {
+          case IrOp::ADD:
+          case IrOp::MUL:
+            if (v->type != INT)
+              break; // Allocates a string
+            // Fall through
+          case IrOp::CONST:
+          case IrOp::SUB:
+          case IrOp::EQ:
+          case IrOp::NE:
+          case IrOp::LT:
+          case IrOp::GT:
+          case IrOp::LE:
+          case IrOp::GE:
+          case IrOp::AND:
+          case IrOp::OR:
+          case IrOp::NOT:
+            invariant = std::none_of(v->operands.begin(), v->operands.end(),
+                                     [&](IrValue* operand) { return loop->blocks.count(operand->block); });
+            break;
+
+          default:
+            break; // Reads memory, has an effect, or can fail
+          }
+
+          if (!invariant)
+          {
+            ++i;
+            continue;
+          }
+
+          // Goes in just before the jump into the loop
+          block->values.erase(block->values.begin() + i);
+          std::vector<IrValue*>& before = loop->preheader->values;
+          before.insert(before.end() - 1, v);
+          v->block = loop->preheader;
+          moved = true;
+          if (v->op != IrOp::CONST)
+            ++changes;
+        }
+      }
+  }
+  return changes;
+}
+
+// Induction variable detection.
+// A PHI at the top of a loop that the end of the loop gives itself plus a
+// constant is an induction variable. The IrRewriter turns multiplying one by
+// a constant into adding to a variable of its own. Gives how many it found.
+unsigned IrOptimizer::induction_variables()
+{
+  unsigned found = 0;
+  for (auto& loop: program.get_loops())
+  {
+    loop->inductions.clear();
+    for (IrValue* phi: loop->header->values)
+    {
+      if (phi->op != IrOp::PHI || phi->type != INT || phi->operands.size() != 2
+          || program.resolve(phi->operands[0])->op == IrOp::UNDEF)
+        continue;
+
+      IrValue* next = program.resolve(phi->operands[1]);
+      if (next->op != IrOp::ADD || next->type != INT)
+        continue;
+
+      IrValue* a = program.resolve(next->operands[0]);
+      IrValue* b = program.resolve(next->operands[1]);
+      IrValue* step = a == phi ? b : b == phi ? a : nullptr;
+      if (!step || step->op != IrOp::CONST || !boost::get<int>(&step->constant))
+        continue;
+
+      loop->inductions.push_back(IrInduction{phi->name, phi, next, boost::get<int>(step->constant)});
+      ++found;
+    }
+  }
+  return found;
+}
+
+// Dead code elimination.
+// Keeps everything with an effect, and everything they use.
+unsigned IrOptimizer::dead_code_elimination()
+{
+  std::set<IrValue*> live;
+  std::vector<IrValue*> work;
+  for (auto& block: program.get_blocks())
+    for (IrValue* v: block->values)
+      if (!v->pure())
+      {
+        live.insert(v);
+        work.push_back(v);
+      }
+
+  while (!work.empty())
+  {
+    IrValue* v = work.back();
+    work.pop_back();
+    for (IrValue* operand: v->operands)
+      if (live.insert(operand).second)
+        work.push_back(operand);
+  }
+
+  unsigned changes = 0;
+  for (auto& block: program.get_blocks())
+  {
+    for (IrValue* v: block->values)
+      if (!live.count(v))
+      {
+        v->block = nullptr;
+        ++changes;
+      }
+    block->values.erase(std::remove_if(block->values.begin(), block->values.end(),
+                                       [](IrValue* v) { return !v->block; }),
+                        block->values.end());
+  }
+  return changes;
+}
@@ -0,0 +1,429 @@
+// Defines the members of the IrRewriter class
+
+#include <algorithm>
+#include <climits>
+
+#include "IrRewriter.h"
+
+// Constructor
+IrRewriter::IrRewriter(IrProgram& p, IrBuilder& b) :
+  program(p),
+  builder(b),
+  references(),
+  hoisted(),
+  reduced(),
+  declared(0),
+  moved()
+{
+}
+
+// Rewrites the AST
+unsigned IrRewriter::rewrite(StmtList& ast)
+{
+  unsigned changes = 0;
+  for (IrSlot& slot: builder.get_slots())
+    if (simplify(slot))
+      ++changes;
+
+  // The slots of an expression come after the slots in it, so going
+  // backwards moves the most out of a loop at once
+  std::vector<IrSlot>& slots = builder.get_slots();
+  for (auto slot = slots.rbegin(); slot != slots.rend(); ++slot)
+    if (hoist(*slot, ast))
+      ++changes;
+
+  for (IrSlot& slot: slots)
+    if (reduce(slot, ast))
+      ++changes;
+
+  // Taking a statement out can leave what it read unread, so look again
+  for (bool removed = true; removed; )
+  {
+    removed = false;
+    for (auto& site: program.get_sites())
+      site->live = false;
+    references.clear();
+    ast.accept(*this);
+
+    for (auto& site: program.get_sites())
+    {
+      if (!site->stmt || site->live)
+        continue;
+
+      AssignStmt* assign = dynamic_cast<AssignStmt*>(site->stmt);
+      VarDecStmt* dec = dynamic_cast<VarDecStmt*>(site->stmt);
+      if ((assign && pure(*assign->get_assign())) || (dec && !references[site->var] && pure(*dec->get_assign())))
+      {
+        site->list->remove_stmt(site->stmt);
+        site->stmt = nullptr;
+        removed = true;
+        ++changes;
+      }
+    }
+  }
+  return changes;
+}
+
+// Fills a place in the AST with something simpler
+bool IrRewriter::simplify(IrSlot& slot)
+{
+  IrValue* v = program.resolve(slot.value);
+  const std::map<std::string, Type>& tracked = builder.get_tracked();
+
+  // Only reads of variables in SSA form and math are replaced
+  std::string var;
+  Type type = slot.value->type;
+  Token where;
+  if (SimpleExpr* simple = dynamic_cast<SimpleExpr*>(slot.expr.get()))
+  {
+    auto found = tracked.find(simple->get_term().get_lexeme());
+    if (simple->get_term().get_type() != TokenType::ID || found == tracked.end())
+      return false;
+    var = found->first;
+    type = found->second; // What it is read as
+    where = simple->get_term();
+  }
+  else if (ComplexExpr* math = dynamic_cast<ComplexExpr*>(slot.expr.get()))
+    where = math->get_rel();
+  else
+    return false;
+
+  std::shared_ptr<SimpleExpr> replacement = std::make_shared<SimpleExpr>();
+  if (v->op == IrOp::CONST)
+  {
+    if (v->type != type)
+      return false;
+    TokenType token = type == INT ? TokenType::INT : type == BOOL ? TokenType::BOOL : TokenType::STRING;
+    replacement->set_token(Token(token, boost::apply_visitor(string_visitor(), v->constant),
+                                 where.get_line(), where.get_column()));
+    slot.set(replacement);
+    slot.expr = replacement;
+    return true;
+  }
+
+  // The interpreter adds booleans as ints, so boolean math is left alone
+  if (v->op == IrOp::UNDEF || v->home.empty() || v->home == var || (var.empty() && type == BOOL))
+    return false;
+
+  // The variable the value was first given to must still hold it
+  auto holder = slot.defs->find(v->home);
+  if (holder == slot.defs->end() || program.resolve(holder->second.value) != v || tracked.at(v->home) != type)
+    return false;
+
+  replacement->set_token(Token(TokenType::ID, v->home, where.get_line(), where.get_column()));
+  builder.get_reads()[replacement.get()] = holder->second.site;
+  slot.set(replacement);
+  slot.expr = replacement;
+  return true;
+}
+
+// Moves an expression a loop does not change out of the loop.
+// The IrOptimizer moved its value before the outermost loop it could. The
+// expression is assigned to a new variable there, declared at the start of
+// the program, so that the loop only reads the variable.
+bool IrRewriter::hoist(IrSlot& slot, StmtList& ast)
+{
+  ComplexExpr* math = dynamic_cast<ComplexExpr*>(slot.expr.get());
+  IrValue* v = program.resolve(slot.value);
+  if (!math || moved.count(math) || !v->block || v->op == IrOp::CONST || v->type == BOOL)
+    return false; // The interpreter adds booleans as ints, so boolean math is left alone
+
+  for (auto& loop: program.get_loops())
+  {
+    if (!loop->blocks.count(slot.block) || loop->blocks.count(v->block) || !available(*math, slot, *loop))
+      continue;
+
+    Token where = math->get_rel();
+    std::string& name = hoisted[{v, loop.get()}];
+    if (name.empty())
+    {
+      name = declare("_licm", v->type, ast, where, slot.stmt);
+
+      std::shared_ptr<AssignStmt> assign = std::make_shared<AssignStmt>();
+      assign->set_origin(slot.stmt);
+      assign->set_lhs_id(Token(TokenType::ID, name, where.get_line(), where.get_column()));
+      assign->set_rhs_expr(slot.expr);
+      loop->list->insert_stmt(loop->stmt, assign);
+    }
+    forget(*math);
+
+    std::shared_ptr<SimpleExpr> replacement = std::make_shared<SimpleExpr>();
+    replacement->set_token(Token(TokenType::ID, name, where.get_line(), where.get_column()));
+    slot.set(replacement);
+    slot.expr = replacement;
+    return true;
+  }
+  return false;
+}
+
+// Replaces an induction variable times a constant with a variable of its own.
+// Before the loop it is given the induction variable times the constant,
+// and after the statement that adds to the induction variable it is added
+// the step times the constant. So it always holds the induction variable
+// times the constant while the loop runs.
+bool IrRewriter::reduce(IrSlot& slot, StmtList& ast)
+{
+  ComplexExpr* math = dynamic_cast<ComplexExpr*>(slot.expr.get());
+  if (!math || moved.count(math) || math->get_rel().get_type() != TokenType::MULTIPLY)
+    return false;
+
+  // var * constant, or constant * var
+  SimpleExpr* first = dynamic_cast<SimpleExpr*>(math->get_first_op().get());
+  SimpleExpr* rest = dynamic_cast<SimpleExpr*>(math->get_rest().get());
+  if (!first || !rest)
+    return false;
+  if (first->get_term().get_type() == TokenType::INT)
+    std::swap(first, rest);
+  if (first->get_term().get_type() != TokenType::ID || rest->get_term().get_type() != TokenType::INT)
+    return false;
+
+  const std::string& var = first->get_term().get_lexeme();
+  long long factor = std::stoll(rest->get_term().get_lexeme());
+  auto here = slot.defs->find(var);
+  if (factor < 2 || here == slot.defs->end())
+    return false;
+  IrValue* value = program.resolve(here->second.value);
+
+  for (auto& loop: program.get_loops())
+  {
+    if (!loop->blocks.count(slot.block))
+      continue;
+
+    for (IrInduction& induction: loop->inductions)
+    {
+      // The variable must hold its value from the top of the loop, or that plus the step
+      auto end = loop->end_defs->find(var);
+      if (induction.var != var || (value != induction.phi && value != induction.next) || end == loop->end_defs->end()
+          || program.resolve(end->second.value) != induction.next || !end->second.site->stmt
+          || induction.step * factor > INT_MAX)
+        continue;
+
+      Token where = math->get_rel();
+      std::string& name = reduced[{induction.phi, factor}];
+      if (name.empty())
+      {
+        name = declare("_iv", INT, ast, where, slot.stmt);
+
+        // name = var * factor, before the loop
+        std::shared_ptr<AssignStmt> start = std::make_shared<AssignStmt>();
+        start->set_origin(slot.stmt);
+        start->set_lhs_id(Token(TokenType::ID, name, where.get_line(), where.get_column()));
+        start->set_rhs_expr(slot.expr);
+        loop->list->insert_stmt(loop->stmt, start);
+        auto before = loop->defs->find(var);
+        builder.get_reads()[first] = before != loop->defs->end() ? before->second.site : nullptr;
+
+        // name = name + step * factor, after var is added to
+        std::shared_ptr<SimpleExpr> self = std::make_shared<SimpleExpr>();
+        self->set_token(Token(TokenType::ID, name, where.get_line(), where.get_column()));
+        std::shared_ptr<SimpleExpr> step = std::make_shared<SimpleExpr>();
+        step->set_token(Token(TokenType::INT, std::to_string(induction.step * factor), where.get_line(), where.get_column()));
+        std::shared_ptr<ComplexExpr> sum = std::make_shared<ComplexExpr>();
+        sum->set_first_op(self);
+        sum->set_math_rel(Token(TokenType::PLUS, "+", where.get_line(), where.get_column()));
+        sum->set_rest(step);
+        std::shared_ptr<AssignStmt> advance = std::make_shared<AssignStmt>();
+        advance->set_origin(slot.stmt);
+        advance->set_lhs_id(Token(TokenType::ID, name, where.get_line(), where.get_column()));
+        advance->set_rhs_expr(sum);
+
+        IrSite* site = end->second.site;
+        std::deque<std::shared_ptr<Stmt>> stmts = site->list->get_stmts();
+        auto after = std::find_if(stmts.begin(), stmts.end(),
+                                  [site](const std::shared_ptr<Stmt>& s) { return s.get() == site->stmt; });
+        site->list->insert_stmt(after == stmts.end() || after + 1 == stmts.end() ? nullptr : (after + 1)->get(), advance);
+      }
+      forget(*math);
+
+      std::shared_ptr<SimpleExpr> replacement = std::make_shared<SimpleExpr>();
+      replacement->set_token(Token(TokenType::ID, name, where.get_line(), where.get_column()));
+      slot.set(replacement);
+      slot.expr = replacement;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Declares a new variable at the start of the program, and gives its name.
+// The name starts with an underscore, which no name in a program can.
+// The declaration is marked as made from the statement the variable is for.
+std::string IrRewriter::declare(const std::string& prefix, Type type, StmtList& ast, const Token& where, Stmt* origin)
+{
+  std::string name = prefix + std::to_string(declared++);
+
+  std::shared_ptr<SimpleExpr> initial = std::make_shared<SimpleExpr>();
+  initial->set_token(type == STRING ? Token(TokenType::STRING, "", where.get_line(), where.get_column())
+                                    : Token(TokenType::INT, "0", where.get_line(), where.get_column()));
+  std::shared_ptr<VarDecStmt> dec = std::make_shared<VarDecStmt>();
+  dec->set_origin(origin);
+  dec->set_id(Token(TokenType::ID, name, where.get_line(), where.get_column()));
+  dec->set_type(type == STRING ? TokenType::STRING : TokenType::INT);
+  dec->set_rhs_expr(initial);
+  ast.insert_stmt(ast.get_stmts().front().get(), dec);
+  return name;
+}
+
+// Whether the variables an expression reads hold the same values before a
+// loop as where the expression is. The loop can give a variable the value of
+// one it does not change, so only the variables it does not change do.
+bool IrRewriter::available(Expr& node, IrSlot& slot, IrLoop& loop)
+{
+  if (SimpleExpr* simple = dynamic_cast<SimpleExpr*>(&node))
+  {
+    if (simple->get_term().get_type() != TokenType::ID)
+      return true;
+
+    auto here = slot.defs->find(simple->get_term().get_lexeme());
+    auto before = loop.defs->find(simple->get_term().get_lexeme());
+    return here != slot.defs->end() && before != loop.defs->end()
+           && program.resolve(here->second.value) == program.resolve(before->second.value);
+  }
+  if (ComplexExpr* math = dynamic_cast<ComplexExpr*>(&node))
+    return available(*math->get_first_op(), slot, loop) && available(*math->get_rest(), slot, loop);
+  return false;
+}
+
+// Remembers that an expression and the ones in it are no longer where they were
+void IrRewriter::forget(Expr& node)
+{
+  moved.insert(&node);
+  if (ComplexExpr* math = dynamic_cast<ComplexExpr*>(&node))
+  {
+    forget(*math->get_first_op());
+    forget(*math->get_rest());
+  }
+}
+
+// Whether an expression does nothing but make its value.
+// Reading a list can print that it is out of bounds, and dividing by 0 stops the program.
+bool IrRewriter::pure(Expr& node)
+{
+  if (SimpleExpr* simple = dynamic_cast<SimpleExpr*>(&node))
+    return simple->get_term().get_type() != TokenType::ID || builder.get_tracked().count(simple->get_term().get_lexeme());
+  if (ComplexExpr* math = dynamic_cast<ComplexExpr*>(&node))
+    return math->get_rel().get_type() != TokenType::DIVIDE && pure(*math->get_first_op()) && pure(*math->get_rest());
+  return false;
+}
+
+// Marks the value from a site as read
+void IrRewriter::mark(IrSite* site)
+{
+  if (!site || site->live)
+    return;
+  site->live = true;
+  for (IrSite* from: site->incoming)
+    mark(from);
+}
+
+// Accepts a StmtList reference
+void IrRewriter::visit(StmtList& node)
+{
+  for (std::shared_ptr<Stmt> s: node.get_stmts())
+    s->accept(*this);
+}
+
+// Accepts a BasicIf reference
+void IrRewriter::visit(BasicIf& node)
+{
+  node.get_if()->accept(*this);
+  node.get_if_stmts()->accept(*this);
+}
+
+// Accepts a IfStmt reference
+void IrRewriter::visit(IfStmt& node)
+{
+  node.get_if()->accept(*this);
+  for (auto& elseif: node.get_elseifs())
+    elseif->accept(*this);
+  if (node.get_else())
+    node.get_else()->accept(*this);
+}
+
+// Accepts a WhileStmt reference
+void IrRewriter::visit(WhileStmt& node)
+{
+  node.get_while()->accept(*this);
+  node.get_stmts()->accept(*this);
+}
+
+// Accepts a PrintStmt reference
+void IrRewriter::visit(PrintStmt& node)
+{
+  node.get_expr()->accept(*this);
+}
+
+// Accepts a VarDecStmt reference
+void IrRewriter::visit(VarDecStmt& node)
+{
+  if (node.get_assign())
+    node.get_assign()->accept(*this);
+}
+
+// Accepts an AssignStmt reference
+void IrRewriter::visit(AssignStmt& node)
+{
+  ++references[node.get_id().get_lexeme()];
+  if (node.get_index())
+    node.get_index()->accept(*this);
+  node.get_assign()->accept(*this);
+}
+
+// Accepts a SimpleExpr reference
+void IrRewriter::visit(SimpleExpr& node)
+{
+  if (node.get_term().get_type() != TokenType::ID)
+    return;
+
+  ++references[node.get_term().get_lexeme()];
+  auto read = builder.get_reads().find(&node);
+  if (read != builder.get_reads().end())
+    mark(read->second);
+}
+
+// Accepts a IndexExpr reference
+void IrRewriter::visit(IndexExpr& node)
+{
+  ++references[node.get_id().get_lexeme()];
+  node.get_expr()->accept(*this);
+}
+
+// Accepts a ListExpr reference
+void IrRewriter::visit(ListExpr& node)
+{
+  for (auto& e: node.get_exprs())
+    e->accept(*this);
+}
+
+// Accepts a ReadExpr reference
+void IrRewriter::visit(ReadExpr&)
+{
+}
+
+// Accepts a ComplexExpr reference
+void IrRewriter::visit(ComplexExpr& node)
+{
+  node.get_first_op()->accept(*this);
+  node.get_rest()->accept(*this);
+}
+
+// Accepts a SimpleBoolExpr reference
+void IrRewriter::visit(SimpleBoolExpr& node)
+{
+  node.get_expr_term()->accept(*this);
+}
+
+// Accepts a ComplexBoolExpr reference
+void IrRewriter::visit(ComplexBoolExpr& node)
+{
+  node.get_first_op()->accept(*this);
+  node.get_second_op()->accept(*this);
+  if (node.get_rest())
+    node.get_rest()->accept(*this);
+}
+
+// Accepts a NotBoolExpr reference
+void IrRewriter::visit(NotBoolExpr& node)
+{
+  node.get_expr()->accept(*this);
+}
@@ -0,0 +1,159 @@
+// Defines everything in Jit.h
+
+#include <algorithm>
+#include <string>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED
+#endif
+
+#include "Jit.h"
+#include "Encoder.h"
+#include "Input.h"
+#include "exception.h"
+
+// The procedure every system call is redirected to
+static const std::string TRAMPOLINE = "jit_syscall";
+
+// How far brk can move the end of the program. Pages are only used once the
+// program touches them.
+static const uint64_t HEAP_LIMIT = 0x10000000;
+
+// Rounds a value up to a multiple of a power of two
+static uint64_t align(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Constructor
+Jit::Jit(AsmStructure& a, std::ostream& o, std::istream& i) :
+  asms(a),
+  out(o),
+  in(i),
+  exit_point(),
+  status(0),
+  heap_start(0),
+  heap_break(0),
+  heap_end(0)
+{
+}
+
+// Encodes the structure and runs it
+int Jit::run()
+{
+  if (asms.get_target() != Target::X86_64)
+    throw Exception("only 64-bit code can be run", 0, 0, ExceptionType::JIT);
+
+#ifndef JIT_SUPPORTED
+  throw Exception("running code needs an x86-64 Linux host", 0, 0, ExceptionType::JIT);
+#else
+  redirect_syscalls();
+
+  Encoder encoder(asms);
+  encoder.layout();
+
+  // The code gets its own pages, so they can be made executable and read only.
+  // MAP_32BIT keeps every address small enough for the 32-bit absolute
+  // addresses the encoder writes. The heap brk hands out follows .bss.
+  const uint64_t page = 0x1000;
+  uint64_t text_size = align(encoder.text_size(), page);
+  uint64_t data_size = align(encoder.data_size(), 16);
+  uint64_t program_size = text_size + align(data_size + encoder.bss_size(), page);
+  uint64_t size = program_size + HEAP_LIMIT;
+  void* memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT | MAP_NORESERVE,
+                      -1, 0);
+  if (memory == MAP_FAILED)
+    throw Exception("could not map memory for the code", 0, 0, ExceptionType::JIT);
+
+  // .bss is already 0, since the mapping is new
+  uint64_t text_address = reinterpret_cast<uint64_t>(memory);
+  encoder.encode(text_address, text_address + text_size, text_address + text_size + data_size);
+  heap_start = heap_break = text_address + program_size;
+  heap_end = text_address + size;
+  uint8_t* base = static_cast<uint8_t*>(memory);
+  std::copy(encoder.get_text().begin(), encoder.get_text().end(), base);
+  std::copy(encoder.get_data().begin(), encoder.get_data().end(), base + text_size);
+
+  if (mprotect(memory, text_size, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(memory, size);
+    throw Exception("could not make the code executable", 0, 0, ExceptionType::JIT);
+  }
+
+  // _start never returns. Its exit system call jumps back here instead.
+  void (*start)() = reinterpret_cast<void (*)()>(encoder.address("_start"));
+  if (setjmp(exit_point) == 0)
+    start();
+
+  out.flush();
+  munmap(memory, size);
+  return status;
+#endif
+}
+
+// Replaces every system call with a call to host_call
+void Jit::redirect_syscalls()
+{
+  for (Procedure* p: asms.get_procedures())
+    for (Instruction& i: p->get_instructions())
+      if (i.op == Op::SYSCALL)
+        i = Instruction{Op::CALL, sym(TRAMPOLINE), Operand()};
+
+  // Moves the system call arguments into place for host_call.
+  // syscall only changes rax, rcx and r11, and add_syscall already saves rcx
+  // and r11, so the other registers C is free to change are saved here.
+  const Reg saved[] = {Reg::SI, Reg::DI, Reg::DX, Reg::R8, Reg::R9, Reg::R10};
+  Procedure* proc = new Procedure(TRAMPOLINE);
+  for (Reg r: saved)
+    proc->add(Op::PUSH, reg(r));
+  proc->add(Op::PUSH, EBP);
+  proc->add(Op::MOV, EBP, ESP);
+  proc->add(Op::AND, ESP, imm(-16)); // C expects an aligned stack
+  proc->add(Op::MOV, ECX, EDX);
+  proc->add(Op::MOV, EDX, ESI);
+  proc->add(Op::MOV, ESI, EDI);
+  proc->add(Op::MOV, EDI, EAX);
+  proc->add(Op::MOV, reg(Reg::R8), imm(reinterpret_cast<long long>(this)));
+  proc->add(Op::MOV, EAX, imm(reinterpret_cast<long long>(&Jit::host_call)));
+  proc->add(Op::CALL, EAX);
+  proc->add(Op::MOV, ESP, EBP);
+  proc->add(Op::POP, EBP);
+  for (int i = sizeof(saved) / sizeof(saved[0]) - 1; i >= 0; --i)
+    proc->add(Op::POP, reg(saved[i]));
+  proc->add(Op::RET);
+  asms.add_procedure(proc);
+}
+
+// Carries out a system call for the generated code
+int64_t Jit::host_call(int64_t number, int64_t a, int64_t b, int64_t c, Jit* jit)
+{
+  const int64_t bad_file = -9, no_call = -38; // -EBADF and -ENOSYS
+  switch (number)
+  {
+  case 0: // read
+  {
+    if (a != 0)
+      return bad_file;
+
+    return read_some(jit->in, reinterpret_cast<char*>(b), c);
+  }
+
+  case 1: // write
+    if (a != 1 && a != 2)
+      return bad_file;
+    (a == 1 ? jit->out : std::cerr).write(reinterpret_cast<const char*>(b), c);
+    return c;
+
+  case 12: // brk
+    // Like the kernel, a break that cannot be set leaves it where it was
+    if (static_cast<uint64_t>(a) >= jit->heap_start && static_cast<uint64_t>(a) <= jit->heap_end)
+      jit->heap_break = a;
+    return jit->heap_break;
+
+  case 60: // exit
+    jit->status = static_cast<int>(a & 0xff); // What a process would exit with
+    std::longjmp(jit->exit_point, 1);
+  }
+  return no_call;
+}
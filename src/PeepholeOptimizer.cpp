@@ -0,0 +1,480 @@
+// Defines the members of the PeepholeOptimizer class
+
+#include <set>
+
+#include "PeepholeOptimizer.h"
+
+// Gets the global label each instruction is under.
+// nasm attaches labels starting with '.' to the last label that doesn't.
+static std::vector<std::string> scopes(const std::vector<Instruction>& code, const std::string& proc)
+{
+  std::vector<std::string> out;
+  std::string scope = proc;
+  for (const Instruction& in: code)
+  {
+    if (in.op == Op::LABEL && in.dst.symbol[0] != '.')
+      scope = in.dst.symbol;
+    out.push_back(scope);
+  }
+  return out;
+}
+
+// Gets the full name of a label used under a scope
+static std::string full_name(const std::string& label, const std::string& scope)
+{
+  return label[0] == '.' ? scope + label : label;
+}
+
+// Whether an operand is a whole register
+static bool is_reg(const Operand& o)
+{
+  return o.kind == OperandKind::REG && o.size == Size::NATIVE;
+}
+
+// Whether an instruction only moves data between registers and global variables.
+// These are the instructions push and pop can be moved across.
+static bool is_simple(const Instruction& in)
+{
+  switch (in.op)
+  {
+  case Op::MOV: case Op::MOVZX: case Op::LEA:
+  case Op::ADD: case Op::SUB: case Op::AND: case Op::OR: case Op::XOR:
+  case Op::SHL: case Op::SHR: case Op::SAR:
+  case Op::INC: case Op::DEC: case Op::NEG: case Op::NOT:
+  case Op::CMP: case Op::TEST:
+    break;
+
+  case Op::IMUL:
+    if (in.src.kind == OperandKind::NONE)
+      return false;
+    break;
+
+  default: return false;
+  }
+
+  // Nothing that could read or write the stack
+  for (const Operand* o: {&in.dst, &in.src})
+    if (o->kind == OperandKind::MEM && (o->base != Reg::NONE || o->index != Reg::NONE))
+      return false;
+  return !((reads(in) | writes(in)) & bit(Reg::SP));
+}
+
+// Constructor
+PeepholeOptimizer::PeepholeOptimizer(AsmStructure& a) :
+  asms(a),
+  before(0),
+  after(0),
+  hits(),
+  clobber_cache()
+{
+}
+
+// Counts a match of a pattern
+void PeepholeOptimizer::hit(const char* pattern)
+{
+  ++hits[pattern];
+}
+
+// Optimizes every procedure
+void PeepholeOptimizer::run()
+{
+  for (Procedure* p: asms.get_procedures())
+    before += p->get_instructions().size();
+
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    find_targets();
+    for (Procedure* p: asms.get_procedures())
+    {
+      std::vector<Instruction>& code = p->get_instructions();
+      changed |= dead_code(code);
+      changed |= jump_thread(code, p->get_name());
+      changed |= jump_to_next(code, p->get_name());
+      changed |= push_pop(code, p->get_name());
+      changed |= store_load(code);
+      changed |= self_move(code);
+      changed |= dead_move(code);
+      changed |= copy_forward(code);
+      changed |= known_value(code, p->get_name());
+    }
+  }
+
+  for (Procedure* p: asms.get_procedures())
+    after += p->get_instructions().size();
+}
+
+// Prints the instruction counts and how often each pattern matched
+void PeepholeOptimizer::print_report(std::ostream& os)
+{
+  os << "Peephole optimizer: " << before << " -> " << after << " instructions" << std::endl;
+  for (auto& h: hits)
+    os << "  " << h.second << "\t" << h.first << std::endl;
+}
+
+// Finds the full names of every label that is jumped to or called
+void PeepholeOptimizer::find_targets()
+{
+  targets.clear();
+  for (Procedure* p: asms.get_procedures())
+  {
+    std::vector<Instruction>& code = p->get_instructions();
+    std::vector<std::string> scope = scopes(code, p->get_name());
+    for (std::size_t i = 0; i < code.size(); ++i)
+      if (code[i].op != Op::LABEL)
+        for (const Operand* o: {&code[i].dst, &code[i].src})
+          if (o->kind == OperandKind::SYM)
+            targets.insert(full_name(o->symbol, scope[i]));
+  }
+}
+
+// Gets the registers a call to a procedure may change
+unsigned PeepholeOptimizer::clobbers(const std::string& name)
+{
+  auto it = clobber_cache.find(name);
+  if (it != clobber_cache.end())
+    return it->second;
+  clobber_cache[name] = ALL_REGS; // Recursive calls could change anything
+
+  Procedure* proc = 0;
+  for (Procedure* p: asms.get_procedures())
+    if (p->get_name() == name)
+      proc = p;
+  if (!proc)
+    return ALL_REGS;
+
+  std::vector<Instruction>& code = proc->get_instructions();
+
+  // Everything written, including by procedures it calls
+  unsigned written = 0;
+  for (const Instruction& in: code)
+  {
+    written |= writes(in);
+    if (in.op == Op::CALL)
+      written |= in.dst.kind == OperandKind::SYM ? clobbers(in.dst.symbol) : ALL_REGS;
+  }
+
+  // Registers pushed on entry are saved if the last write to them before every ret is their pop
+  unsigned saved = 0;
+  for (std::size_t i = 0; i < code.size() && code[i].op == Op::PUSH && is_reg(code[i].dst); ++i)
+  {
+    Reg r = code[i].dst.base;
+    bool restored = true;
+    for (std::size_t j = 0; j < code.size() && restored; ++j)
+    {
+      if (code[j].op != Op::RET)
+        continue;
+
+      std::size_t k = j;
+      while (k > 0 && !(writes(code[k - 1]) & bit(r)) && code[k - 1].op != Op::CALL)
+        --k;
+      restored = k > 0 && code[k - 1].op == Op::POP && code[k - 1].dst == code[i].dst;
+    }
+    if (restored)
+      saved |= bit(r);
+  }
+
+  return clobber_cache[name] = written & ~saved & ~bit(Reg::SP);
+}
+
+// push r1, ..., pop r2 -> mov r2,r1, ...
+bool PeepholeOptimizer::push_pop(std::vector<Instruction>& code, const std::string& proc)
+{
+  static const std::size_t WINDOW = 8; // Most instructions to look past
+
+  std::vector<std::string> scope = scopes(code, proc);
+
+  bool changed = false;
+  for (std::size_t i = 0; i < code.size(); ++i)
+  {
+    if (code[i].op != Op::PUSH || !is_reg(code[i].dst))
+      continue;
+
+    Reg x = code[i].dst.base;
+    unsigned read = 0, written = 0;
+    for (std::size_t j = i + 1; j < code.size() && j <= i + WINDOW; ++j)
+    {
+      if (code[j].op == Op::POP && is_reg(code[j].dst))
+      {
+        Reg y = code[j].dst.base;
+        if (x == y)
+        {
+          if (written & bit(x))
+            break; // The register doesn't hold the pushed value any more
+
+          // The register was never changed
+          code.erase(code.begin() + j);
+          code.erase(code.begin() + i);
+          scope.erase(scope.begin() + j);
+          scope.erase(scope.begin() + i);
+          --i;
+          hit("push-pop");
+          changed = true;
+        }
+        else if (!((read | written) & bit(y)))
+        { // Copy the value where it ends up instead
+          code[i] = Instruction{Op::MOV, code[j].dst, code[i].dst};
+          code.erase(code.begin() + j);
+          scope.erase(scope.begin() + j);
+          hit("push-pop");
+          changed = true;
+        }
+        break;
+      }
+
+      if (code[j].op == Op::LABEL && !targets.count(full_name(code[j].dst.symbol, scope[j])))
+        continue; // Only names a scope, nothing jumps here
+      if (!is_simple(code[j]))
+        break;
+      read |= reads(code[j]);
+      written |= writes(code[j]);
+    }
+  }
+  return changed;
+}
+
+// mov [x],r1; mov r2,[x] -> mov [x],r1; mov r2,r1
+bool PeepholeOptimizer::store_load(std::vector<Instruction>& code)
+{
+  bool changed = false;
+  for (std::size_t i = 0; i + 1 < code.size(); ++i)
+  {
+    Instruction& store = code[i];
+    Instruction& load = code[i + 1];
+    if (store.op != Op::MOV || load.op != Op::MOV || !is_reg(store.src) || !is_reg(load.dst)
+        || store.dst.kind != OperandKind::MEM || load.src != store.dst)
+      continue;
+
+    if (load.dst == store.src)
+      code.erase(code.begin() + i + 1);
+    else
+      load.src = store.src;
+    hit("store-load");
+    changed = true;
+  }
+  return changed;
+}
+
+// mov r,r -> nothing
+bool PeepholeOptimizer::self_move(std::vector<Instruction>& code)
+{
+  bool changed = false;
+  for (std::size_t i = 0; i < code.size(); ++i)
+  {
+    if (code[i].op == Op::MOV && is_reg(code[i].dst) && code[i].dst == code[i].src)
+    {
+      code.erase(code.begin() + i--);
+      hit("self-move");
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// mov r,a; mov r,b -> mov r,b
+bool PeepholeOptimizer::dead_move(std::vector<Instruction>& code)
+{
+  bool changed = false;
+  for (std::size_t i = 0; i + 1 < code.size(); ++i)
+  {
+    const Instruction& first = code[i];
+    const Instruction& next = code[i + 1];
+    if (first.op != Op::MOV || !is_reg(first.dst))
+      continue;
+
+    bool overwrites = (next.op == Op::MOV || next.op == Op::MOVZX || next.op == Op::LEA || next.op == Op::POP)
+                   && next.dst == first.dst;
+    if (overwrites && !(reads(next) & bit(first.dst.base)))
+    {
+      code.erase(code.begin() + i--);
+      hit("dead-move");
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// mov r1,a; mov r2,r1; mov r1,b -> mov r2,a; mov r1,b
+bool PeepholeOptimizer::copy_forward(std::vector<Instruction>& code)
+{
+  bool changed = false;
+  for (std::size_t i = 0; i + 2 < code.size(); ++i)
+  {
+    Instruction& load = code[i];
+    const Instruction& copy = code[i + 1];
+    const Instruction& next = code[i + 2];
+    if (load.op != Op::MOV || copy.op != Op::MOV || !is_reg(load.dst) || !is_reg(copy.dst)
+        || copy.src != load.dst || copy.dst == load.dst)
+      continue;
+
+    // The first register has to be overwritten straight after, without being read
+    bool overwrites = (next.op == Op::MOV || next.op == Op::MOVZX || next.op == Op::LEA)
+                   && next.dst == load.dst && !(reads(next) & bit(load.dst.base));
+    if (!overwrites || (reads(load) & bit(copy.dst.base)))
+      continue;
+
+    load.dst = copy.dst;
+    code.erase(code.begin() + i + 1);
+    hit("copy-forward");
+    changed = true;
+  }
+  return changed;
+}
+
+// mov r,a when r is known to hold a already -> nothing
+bool PeepholeOptimizer::known_value(std::vector<Instruction>& code, const std::string& proc)
+{
+  std::vector<std::string> scope = scopes(code, proc);
+
+  // The constant or address each register holds, if known
+  Operand known[16];
+
+  bool changed = false;
+  for (std::size_t i = 0; i < code.size(); ++i)
+  {
+    const Instruction& in = code[i];
+
+    // Another path could reach a label
+    if (in.op == Op::LABEL)
+    {
+      if (targets.count(full_name(in.dst.symbol, scope[i])))
+        for (Operand& k: known)
+          k = Operand();
+      continue;
+    }
+
+    bool constant = in.src.kind == OperandKind::IMM || in.src.kind == OperandKind::SYM;
+    if (in.op == Op::MOV && is_reg(in.dst) && constant)
+    {
+      Operand& k = known[static_cast<unsigned>(in.dst.base)];
+      if (k == in.src)
+      {
+        code.erase(code.begin() + i);
+        scope.erase(scope.begin() + i--);
+        hit("known-value");
+        changed = true;
+        continue;
+      }
+      k = in.src;
+      continue;
+    }
+
+    // Forget the registers this changes
+    unsigned lost = writes(in);
+    if (in.op == Op::CALL)
+      lost |= in.dst.kind == OperandKind::SYM ? clobbers(in.dst.symbol) : ALL_REGS;
+    for (unsigned r = 0; r < 16; ++r)
+      if (lost & (1u << r))
+        known[r] = Operand();
+  }
+  return changed;
+}
+
+// Jumps to the instruction right after them -> nothing
+bool PeepholeOptimizer::jump_to_next(std::vector<Instruction>& code, const std::string& proc)
+{
+  std::vector<std::string> scope = scopes(code, proc);
+
+  bool changed = false;
+  for (std::size_t i = 0; i < code.size(); ++i)
+  {
+    if (!is_jump(code[i].op) || code[i].dst.kind != OperandKind::SYM)
+      continue;
+
+    std::string target = full_name(code[i].dst.symbol, scope[i]);
+    for (std::size_t j = i + 1; j < code.size() && code[j].op == Op::LABEL; ++j)
+    {
+      if (full_name(code[j].dst.symbol, scope[j]) == target)
+      {
+        code.erase(code.begin() + i);
+        scope.erase(scope.begin() + i);
+        --i;
+        hit("jump-to-next");
+        changed = true;
+        break;
+      }
+    }
+  }
+  return changed;
+}
+
+// Jumps to a jmp -> jump to where that jmp goes
+bool PeepholeOptimizer::jump_thread(std::vector<Instruction>& code, const std::string& proc)
+{
+  std::vector<std::string> scope = scopes(code, proc);
+
+  // Where each label is
+  std::map<std::string, std::size_t> labels;
+  for (std::size_t i = 0; i < code.size(); ++i)
+    if (code[i].op == Op::LABEL)
+      labels[full_name(code[i].dst.symbol, scope[i])] = i;
+
+  bool changed = false;
+  for (std::size_t i = 0; i < code.size(); ++i)
+  {
+    if (!is_jump(code[i].op) || code[i].dst.kind != OperandKind::SYM)
+      continue;
+
+    // Follow the chain of jmps, stopping at loops
+    std::string target = full_name(code[i].dst.symbol, scope[i]);
+    std::set<std::string> seen = {target};
+    std::string symbol;
+    std::string symbol_scope;
+    bool loops = false;
+    for (;;)
+    {
+      auto label = labels.find(target);
+      if (label == labels.end())
+        break;
+
+      std::size_t j = label->second;
+      while (j < code.size() && code[j].op == Op::LABEL)
+        ++j;
+      if (j == code.size() || code[j].op != Op::JMP || code[j].dst.kind != OperandKind::SYM)
+        break;
+
+      std::string next = full_name(code[j].dst.symbol, scope[j]);
+      if (!seen.insert(next).second)
+      {
+        loops = true;
+        break;
+      }
+      target = next;
+      symbol = code[j].dst.symbol;
+      symbol_scope = scope[j];
+    }
+
+    if (symbol.empty() || loops)
+      continue;
+
+    // Local labels of another scope are named in full
+    code[i].dst = sym(symbol_scope == scope[i] ? symbol : target);
+    hit("jump-thread");
+    changed = true;
+  }
+  return changed;
+}
+
+// Instructions after jmp or ret that no label leads to -> nothing
+bool PeepholeOptimizer::dead_code(std::vector<Instruction>& code)
+{
+  bool changed = false;
+  for (std::size_t i = 0; i < code.size(); ++i)
+  {
+    if (code[i].op != Op::JMP && code[i].op != Op::RET)
+      continue;
+
+    std::size_t end = i + 1;
+    while (end < code.size() && code[end].op != Op::LABEL)
+      ++end;
+    if (end > i + 1)
+    {
+      for (std::size_t j = i + 1; j < end; ++j)
+        hit("dead-code");
+      code.erase(code.begin() + i + 1, code.begin() + end);
+      changed = true;
+    }
+  }
+  return changed;
+}
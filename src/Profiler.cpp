@@ -0,0 +1,278 @@
+// Defines the members of the Profiler class
+
+#include <algorithm>
+#include <cstdio>
+
+#if defined(__linux__)
+#include <sys/time.h>
+#define SAMPLING_SUPPORTED
+#endif
+
+#include "Profiler.h"
+
+// How often the timer samples, in microseconds of CPU time
+static const long SAMPLE_INTERVAL = 1000;
+
+// The samples the timer took that no statement was given yet
+volatile std::sig_atomic_t Profiler::pending = 0;
+
+// Where a statement is, from the first token of an expression
+static Token where(Expr& node)
+{
+  if (SimpleExpr* simple = dynamic_cast<SimpleExpr*>(&node))
+    return simple->get_term();
+  if (ComplexExpr* complex = dynamic_cast<ComplexExpr*>(&node))
+    return complex->get_first_op() ? where(*complex->get_first_op()) : complex->get_rel();
+  if (IndexExpr* index = dynamic_cast<IndexExpr*>(&node))
+    return index->get_id();
+  if (ListExpr* list = dynamic_cast<ListExpr*>(&node))
+    return list->get_lbracket();
+  if (ReadExpr* read = dynamic_cast<ReadExpr*>(&node))
+    return read->get_msg();
+  return Token();
+}
+
+// Where a statement is, and what to call it
+static Token where(Stmt& node, std::string& name)
+{
+  if (AssignStmt* assign = dynamic_cast<AssignStmt*>(&node))
+  {
+    name = assign->get_id().get_lexeme() + " =";
+    return assign->get_id();
+  }
+  if (VarDecStmt* dec = dynamic_cast<VarDecStmt*>(&node))
+  {
+    name = "var " + dec->get_id().get_lexeme();
+    return dec->get_id();
+  }
+  if (PrintStmt* print = dynamic_cast<PrintStmt*>(&node))
+  {
+    name = print->get_type() == TokenType::PRINTLN ? "println" : "print";
+    return where(*print->get_expr());
+  }
+  if (IfStmt* cond = dynamic_cast<IfStmt*>(&node))
+  {
+    name = "if";
+    return cond->get_if()->get_if()->get_token();
+  }
+  if (WhileStmt* loop = dynamic_cast<WhileStmt*>(&node))
+  {
+    name = "while";
+    return loop->get_while()->get_token();
+  }
+  name = "statement";
+  return Token();
+}
+
+// Whether SAMPLE mode can be used on this host
+bool Profiler::can_sample()
+{
+#ifdef SAMPLING_SUPPORTED
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Constructor
+Profiler::Profiler(ProfileMode m) :
+  mode(m == ProfileMode::SAMPLE && !can_sample() ? ProfileMode::TIME : m),
+  entries(),
+  stack(),
+  cpu_start(std::clock())
+{
+  if (mode != ProfileMode::SAMPLE)
+    return;
+
+#ifdef SAMPLING_SUPPORTED
+  pending = 0;
+
+  struct sigaction action = {};
+  action.sa_handler = on_timer;
+  action.sa_flags = SA_RESTART; // Reading the input is not cut short
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, nullptr);
+
+  struct itimerval timer = {};
+  timer.it_interval.tv_usec = SAMPLE_INTERVAL;
+  timer.it_value.tv_usec = SAMPLE_INTERVAL;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+}
+
+// Destructor
+Profiler::~Profiler()
+{
+  if (mode != ProfileMode::SAMPLE)
+    return;
+
+#ifdef SAMPLING_SUPPORTED
+  struct itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  signal(SIGPROF, SIG_DFL);
+#endif
+}
+
+// Prints the statements that took the most time
+void Profiler::print_report(std::ostream& os, const std::string& file)
+{
+  std::vector<Entry*> hot = sorted();
+
+  // The whole run, to give each statement its share of
+  double all = 0;
+  for (auto& e: entries)
+    all += mode == ProfileMode::SAMPLE ? e.second.samples : e.second.self;
+
+  char line[160];
+  os << "Hot statements of " << file << ":" << std::endl;
+  if (mode == ProfileMode::SAMPLE)
+    os << "   self%   samples     total  line:col  statement" << std::endl;
+  else
+    os << "   self%   self_ms  total_ms       count  line:col  statement" << std::endl;
+
+  for (std::size_t i = 0; i < hot.size() && i < 20; ++i)
+  {
+    Entry& e = *hot[i];
+    std::string at = std::to_string(e.where.get_line()) + ":" + std::to_string(e.where.get_column());
+    if (mode == ProfileMode::SAMPLE)
+      std::snprintf(line, sizeof(line), "  %5.1f%%  %8lu  %8lu  %8s  ",
+                    all > 0 ? e.samples * 100 / all : 0.0, e.samples, e.total_samples, at.c_str());
+    else
+      std::snprintf(line, sizeof(line), "  %5.1f%%  %8.3f  %8.3f  %10lu  %8s  ",
+                    all > 0 ? e.self * 100 / all : 0.0, e.self * 1000, e.total * 1000, e.count, at.c_str());
+    os << line << e.name << std::endl;
+  }
+
+  if (mode == ProfileMode::SAMPLE)
+  {
+    // The timer only goes off as often as the kernel lets it
+    double cpu_ms = static_cast<double>(std::clock() - cpu_start) * 1000 / CLOCKS_PER_SEC;
+    os << static_cast<unsigned long>(all) << " samples in " << static_cast<unsigned long>(cpu_ms)
+       << " ms of CPU time" << std::endl;
+  }
+}
+
+// Writes the stacks in the folded format
+void Profiler::write_folded(std::ostream& os, const std::string& file)
+{
+  for (Entry* e: sorted())
+  {
+    unsigned long value = mode == ProfileMode::SAMPLE ? e->samples
+                                                      : static_cast<unsigned long>(e->self * 1000000 + 0.5);
+    if (value > 0)
+      os << stack_of(*e, file) << " " << value << "\n";
+  }
+}
+
+// Gets the entry of a statement, making it the first time.
+// A statement the optimizer added gets the entry of the statement it was made
+// from, which only takes its place in the stack when it runs itself.
+Profiler::Entry& Profiler::find(Stmt& stmt, Entry* parent)
+{
+  Stmt* origin = stmt.get_origin();
+  Stmt& written = origin ? *origin : stmt;
+
+  auto found = entries.find(&written);
+  if (found == entries.end())
+  {
+    Entry& e = entries[&written];
+    e.where = where(written, e.name);
+    e.parent = nullptr;
+    e.placed = false;
+    e.count = 0;
+    e.total = 0;
+    e.self = 0;
+    e.samples = 0;
+    e.total_samples = 0;
+    found = entries.find(&written);
+  }
+
+  Entry& e = found->second;
+  if (!origin && !e.placed)
+  {
+    e.parent = parent;
+    e.placed = true;
+  }
+  return e;
+}
+
+// Starts a statement in TIME mode
+void Profiler::enter_timed(Stmt& stmt)
+{
+  Entry& e = find(stmt, stack.empty() ? nullptr : stack.back().entry);
+  if (!stmt.get_origin())
+    ++e.count;
+  stack.push_back(Frame{&stmt, &e, Clock::now(), 0});
+}
+
+// Ends a statement in TIME mode
+void Profiler::leave_timed()
+{
+  Frame frame = stack.back();
+  std::chrono::duration<double> taken = Clock::now() - frame.start;
+  stack.pop_back();
+
+  // A statement made from the one it runs inside is already part of its time
+  if (!stack.empty() && stack.back().entry == frame.entry)
+    return;
+
+  frame.entry->total += taken.count();
+  frame.entry->self += taken.count() - frame.inside;
+  if (!stack.empty())
+    stack.back().inside += taken.count();
+}
+
+// Gives the samples taken since the last time to the running statement
+void Profiler::sample()
+{
+  unsigned long taken = pending;
+  pending = 0;
+  if (stack.empty()) // Between the statements of the top
+    return;
+
+  // The statements on the stack get entries, inside each other
+  Entry* parent = nullptr;
+  for (Frame& frame: stack)
+  {
+    if (!frame.entry)
+      frame.entry = &find(*frame.stmt, parent);
+    if (frame.entry != parent) // A statement made from the one it runs inside
+      frame.entry->total_samples += taken;
+    parent = frame.entry;
+  }
+  parent->samples += taken;
+}
+
+// The entries that were run, the most time first
+std::vector<Profiler::Entry*> Profiler::sorted()
+{
+  std::vector<Entry*> hot;
+  for (auto& e: entries)
+    hot.push_back(&e.second);
+
+  bool sampled = mode == ProfileMode::SAMPLE;
+  std::sort(hot.begin(), hot.end(), [sampled](const Entry* a, const Entry* b)
+    {
+      if (sampled ? a->samples != b->samples : a->self != b->self)
+        return sampled ? a->samples > b->samples : a->self > b->self;
+      if (a->where.get_line() != b->where.get_line())
+        return a->where.get_line() < b->where.get_line();
+      return a->where.get_column() < b->where.get_column();
+    });
+  return hot;
+}
+
+// The stack of an entry, as a line of the folded format without the value
+std::string Profiler::stack_of(Entry& e, const std::string& file)
+{
+  std::string frame = file + ":" + std::to_string(e.where.get_line()) + ":"
+                      + std::to_string(e.where.get_column()) + " " + e.name;
+  std::replace(frame.begin(), frame.end(), ';', ','); // Separates the frames
+  return e.parent ? stack_of(*e.parent, file) + ";" + frame : frame;
+}
+
+// Adds a sample, from the SIGPROF handler
+void Profiler::on_timer(int)
+{
+  pending = pending + 1;
+}
@@ -0,0 +1,186 @@
+// Defines everything in Stats.h
+
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#define RUSAGE_SUPPORTED
+#endif
+
+#include "Stats.h"
+
+// The calls to operator new, and the bytes asked for
+static unsigned long new_calls = 0;
+static unsigned long long new_bytes = 0;
+
+// Counts every allocation made with new, in the whole program.
+// The other forms of new and delete call these.
+void* operator new(std::size_t size)
+{
+  ++new_calls;
+  new_bytes += size;
+  if (void* memory = std::malloc(size ? size : 1))
+    return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+  std::free(memory);
+}
+
+// Writes a string as a JSON string
+static std::string quote(const std::string& text)
+{
+  std::ostringstream out;
+  out << '"';
+  for (char c: text)
+  {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < ' ')
+    {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out << escaped;
+    }
+    else
+      out << c;
+  }
+  out << '"';
+  return out.str();
+}
+
+// StopWatch constructor
+StopWatch::StopWatch() :
+  wall_start(),
+  cpu_start(0),
+  wall(0),
+  cpu(0)
+{
+}
+
+// Starts an interval
+void StopWatch::start()
+{
+  wall_start = std::chrono::steady_clock::now();
+  cpu_start = std::clock();
+}
+
+// Ends the interval
+void StopWatch::stop()
+{
+  std::chrono::duration<double> taken = std::chrono::steady_clock::now() - wall_start;
+  wall += taken.count();
+  cpu += static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+}
+
+// Stats constructor
+Stats::Stats(const std::string& f, bool e) :
+  file(f),
+  enabled(e),
+  ok(true),
+  tokens(0),
+  nodes(0),
+  phases(),
+  total(),
+  start_allocations(new_calls),
+  start_bytes(new_bytes)
+{
+  if (enabled)
+    total.start();
+}
+
+// Runs a phase and adds how long it took to its times
+void Stats::phase(const std::string& name, const std::function<void()>& run_phase)
+{
+  if (!enabled)
+  {
+    run_phase();
+    return;
+  }
+
+  StopWatch& watch = find(name).watch;
+  watch.start();
+  try
+  {
+    run_phase();
+  }
+  catch (...)
+  {
+    watch.stop();
+    throw;
+  }
+  watch.stop();
+}
+
+// Writes the line
+void Stats::write(std::ostream& out)
+{
+  if (!enabled)
+    return;
+
+  total.stop();
+
+  // The peak RSS is only known on Linux, and is 0 elsewhere
+  long peak_rss = 0;
+#ifdef RUSAGE_SUPPORTED
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    peak_rss = usage.ru_maxrss;
+#endif
+
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(3);
+  line << "{\"file\":" << quote(file)
+       << ",\"ok\":" << (ok ? "true" : "false")
+       << ",\"tokens\":" << tokens
+       << ",\"ast_nodes\":" << nodes
+       << ",\"phases\":[";
+  for (std::size_t i = 0; i < phases.size(); ++i)
+  {
+    if (i > 0)
+      line << ',';
+    line << "{\"phase\":" << quote(phases[i].name)
+         << ",\"wall_ms\":" << phases[i].watch.get_wall() * 1000
+         << ",\"cpu_ms\":" << phases[i].watch.get_cpu() * 1000 << '}';
+  }
+  line << "],\"wall_ms\":" << total.get_wall() * 1000
+       << ",\"cpu_ms\":" << total.get_cpu() * 1000
+       << ",\"allocations\":" << new_calls - start_allocations
+       << ",\"allocated_bytes\":" << new_bytes - start_bytes
+       << ",\"peak_rss_kb\":" << peak_rss << "}\n";
+  out << line.str();
+  out.flush();
+}
+
+// How many times operator new has been called
+unsigned long Stats::allocations()
+{
+  return new_calls;
+}
+
+// How many bytes operator new has been asked for
+unsigned long long Stats::allocated_bytes()
+{
+  return new_bytes;
+}
+
+// Finds a phase, adding it if it is new
+Stats::Phase& Stats::find(const std::string& name)
+{
+  for (Phase& p: phases)
+    if (p.name == name)
+      return p;
+  phases.push_back(Phase{name, StopWatch()});
+  return phases.back();
+}
@@ -287,6 +287,9 @@ void TypeVisitor::visit(ListExpr& node)
     if (type != expr_type)
       error(node.get_lbracket(), "mismatched types in list initializer ");
   }
+
+  // The elements set the sub type to their own, so set it again
+  expr_sub_type = TokenType::ARRAY;
 }
 
 // TypeVisitor ReadExpr visit definition
@@ -0,0 +1,150 @@
+// Defines the members of the VarUseVisitor class
+
+#include "VarUseVisitor.h"
+
+// Constructor
+VarUseVisitor::VarUseVisitor() :
+  weight(1),
+  uses(),
+  assigned(),
+  declared(),
+  indexed(),
+  lengths()
+{
+}
+
+// Accepts a StmtList reference
+void VarUseVisitor::visit(StmtList& node)
+{
+  for (std::shared_ptr<Stmt> s: node.get_stmts())
+    s->accept(*this);
+}
+
+// Accepts a BasicIf reference
+void VarUseVisitor::visit(BasicIf& node)
+{
+  node.get_if()->accept(*this);
+  node.get_if_stmts()->accept(*this);
+}
+
+// Accepts a IfStmt reference
+void VarUseVisitor::visit(IfStmt& node)
+{
+  node.get_if()->accept(*this);
+  for (auto& elseif: node.get_elseifs())
+    elseif->accept(*this);
+  if (node.get_else())
+    node.get_else()->accept(*this);
+}
+
+// Accepts a WhileStmt reference
+void VarUseVisitor::visit(WhileStmt& node)
+{
+  // Everything in a loop runs more than once
+  weight *= 10;
+  node.get_while()->accept(*this);
+  node.get_stmts()->accept(*this);
+  weight /= 10;
+}
+
+// Accepts a PrintStmt reference
+void VarUseVisitor::visit(PrintStmt& node)
+{
+  node.get_expr()->accept(*this);
+}
+
+// Accepts a VarDecStmt reference
+void VarUseVisitor::visit(VarDecStmt& node)
+{
+  declared.insert(node.get_id().get_lexeme());
+  uses[node.get_id().get_lexeme()] += weight;
+
+  // A list starts empty, or as long as its list literal
+  ListExpr* list = dynamic_cast<ListExpr*>(node.get_assign().get());
+  define(node.get_id().get_lexeme(), !node.get_assign() ? 0 : list ? list->get_exprs().size() : -1);
+
+  if (node.get_assign())
+    node.get_assign()->accept(*this);
+}
+
+// Accepts an AssignStmt reference
+void VarUseVisitor::visit(AssignStmt& node)
+{
+  assigned.insert(node.get_id().get_lexeme());
+  uses[node.get_id().get_lexeme()] += weight;
+  if (node.get_index())
+  {
+    indexed.insert(node.get_id().get_lexeme());
+    node.get_index()->accept(*this);
+  }
+  else if (ListExpr* list = dynamic_cast<ListExpr*>(node.get_assign().get()))
+    define(node.get_id().get_lexeme(), list->get_exprs().size());
+  else if (dynamic_cast<SimpleExpr*>(node.get_assign().get()))
+    define(node.get_id().get_lexeme(), -1); // Maybe a copy of another list
+  node.get_assign()->accept(*this);
+}
+
+// Accepts a SimpleExpr reference
+void VarUseVisitor::visit(SimpleExpr& node)
+{
+  if (node.get_term().get_type() == TokenType::ID)
+    uses[node.get_term().get_lexeme()] += weight;
+}
+
+// Accepts a IndexExpr reference
+void VarUseVisitor::visit(IndexExpr& node)
+{
+  indexed.insert(node.get_id().get_lexeme());
+  uses[node.get_id().get_lexeme()] += weight;
+  node.get_expr()->accept(*this);
+}
+
+// Accepts a ListExpr reference
+void VarUseVisitor::visit(ListExpr& node)
+{
+  for (auto& expr: node.get_exprs())
+    expr->accept(*this);
+}
+
+// Accepts a ReadExpr reference
+void VarUseVisitor::visit(ReadExpr&)
+{
+}
+
+// Accepts a ComplexExpr reference
+void VarUseVisitor::visit(ComplexExpr& node)
+{
+  node.get_first_op()->accept(*this);
+  node.get_rest()->accept(*this);
+}
+
+// Accepts a SimpleBoolExpr reference
+void VarUseVisitor::visit(SimpleBoolExpr& node)
+{
+  node.get_expr_term()->accept(*this);
+}
+
+// Accepts a ComplexBoolExpr reference
+void VarUseVisitor::visit(ComplexBoolExpr& node)
+{
+  node.get_first_op()->accept(*this);
+  node.get_second_op()->accept(*this);
+  if (node.get_rest())
+    node.get_rest()->accept(*this);
+}
+
+// Accepts a NotBoolExpr reference
+void VarUseVisitor::visit(NotBoolExpr& node)
+{
+  node.get_expr()->accept(*this);
+}
+
+// Records the length of a list given to a variable
+void VarUseVisitor::define(const std::string& name, int length)
+{
+  auto known = lengths.find(name);
+  if (known == lengths.end())
+    lengths[name] = length;
+  else if (known->second != length)
+    known->second = -1;
+}
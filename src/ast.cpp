@@ -1,8 +1,16 @@
 // Defines all necessary functions for all the nodes of the AST
 
+#include <algorithm>
 #include <iostream>
 #include "ast.h"
 
+//----------------------------------------------------------------------
+// ASTNode
+//----------------------------------------------------------------------
+
+// No nodes have been created yet
+unsigned long ASTNode::created = 0;
+
 //----------------------------------------------------------------------
 // BoolExpr
 //----------------------------------------------------------------------
@@ -21,6 +29,22 @@ StmtList::StmtList() :
   stmts(0)
 {}
 
+// Adds a Stmt to this list, in front of another, or at the end for nullptr
+void StmtList::insert_stmt(Stmt* before, std::shared_ptr<Stmt> stmt)
+{
+  auto at = std::find_if(stmts.begin(), stmts.end(),
+                         [before](const std::shared_ptr<Stmt>& s) { return s.get() == before; });
+  stmts.insert(at, stmt);
+}
+
+// Takes a Stmt out of this list
+void StmtList::remove_stmt(Stmt* stmt)
+{
+  stmts.erase(std::remove_if(stmts.begin(), stmts.end(),
+                             [stmt](const std::shared_ptr<Stmt>& s) { return s.get() == stmt; }),
+              stmts.end());
+}
+
 //----------------------------------------------------------------------
 // BasicIf
 //----------------------------------------------------------------------
@@ -25,10 +25,21 @@ Exception::Exception(std::string msg, int line, int column, ExceptionType type)
   case ExceptionType::VARVISIT:
     ss << "Variable";
     break;
+
+  case ExceptionType::ENCODER:
+    ss << "Encoding";
+    break;
+
+  case ExceptionType::JIT:
+    ss << "JIT";
+    break;
   }
 
   // The rest of the output data
-  ss << " error at line " << line << ", column " << column << ": " + msg;
+  if (type == ExceptionType::ENCODER || type == ExceptionType::JIT) // Generated code has no position in the file
+    ss << " error: " << msg;
+  else
+    ss << " error at line " << line << ", column " << column << ": " + msg;
 
   // Save for output
   errMsg = ss.str();
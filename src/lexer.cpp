@@ -19,12 +19,32 @@
 Lexer::Lexer(std::istream& stream) :
 	input_stream(stream),
 	line(1),
-	column(0)
+	column(0),
+	count(0),
+	tokens(),
+	next(0)
 {
 }
 
 // Lext next_token() definition
 Token Lexer::next_token()
+{
+	++count;
+	if (next < tokens.size())
+		return tokens[next++];
+	return scan();
+}
+
+// Reads every token up front
+void Lexer::read_all()
+{
+	do
+		tokens.push_back(scan());
+	while (tokens.back().get_type() != TT::EOS);
+}
+
+// Reads the next token from input_stream
+Token Lexer::scan()
 {
 	// We are taking one byte at a time
 	char c = input_stream.peek();
@@ -35,7 +55,7 @@ Token Lexer::next_token()
 		line++;
 		column = 0;
 		input_stream.get();
-		return next_token();
+		return scan();
 	}
 
 	// Otherwise increment column
@@ -46,11 +66,11 @@ Token Lexer::next_token()
 	{
 	case ' ': // Whitespace. Skip
 		input_stream.get();
-		return next_token();
+		return scan();
 
 	case '\t': // Tab character. Skip
 		input_stream.get();
-		return next_token();
+		return scan();
 
 	case ';': // Semicolon
 		input_stream.get();
@@ -98,7 +118,7 @@ Token Lexer::next_token()
 	case '#': // Comment
 		do { input_stream.get(); }
 		while (input_stream.peek() != '\n');
-		return next_token();
+		return scan();
 
 	case '"': // String
 	{
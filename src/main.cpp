@@ -1,9 +1,17 @@
 // Main executable file for the Lexical Analyzer
 
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <memory>
 
+#if defined(__linux__)
+#include <sys/stat.h>
+#define CHMOD_SUPPORTED
+#endif
+
+#include <boost/optional.hpp>
+
 #include "token.h"
 #include "lexer.h"
 #include "parser.h"
@@ -12,6 +20,13 @@
 #include "TypeVisitor.h"
 #include "Interpreter.h"
 #include "AssemblyVisitor.h"
+#include "PeepholeOptimizer.h"
+#include "ElfWriter.h"
+#include "Jit.h"
+#include "IrBuilder.h"
+#include "IrOptimizer.h"
+#include "IrRewriter.h"
+#include "Stats.h"
 
 // Class that holds all the options for how the program is run
 class Options
@@ -21,7 +36,19 @@ public:
   Options() :
     parse(false),
     print(true),
-    assemble(false)
+    assemble(false),
+    target(Target::X86),
+    op_stats(false),
+    optimize(true),
+    opt_report(false),
+    elf(false),
+    jit(false),
+    dump_ir(false),
+    time_passes(false),
+    stats(false),
+    profile(ProfileMode::OFF),
+    folded(),
+    sse2()
   {}
 
   // Sets the "parse only" flag (-p)
@@ -48,6 +75,102 @@ public:
   bool get_assemble()
     { return assemble; }
 
+  // Sets the machine to assemble for (-m64)
+  void set_target(Target t)
+    { target = t; }
+
+  // Gets the machine to assemble for
+  Target get_target()
+    { return target; }
+
+  // Sets the "op stats" flag (-op-stats)
+  void set_op_stats(bool s)
+    { op_stats = s; }
+
+  // Gets the "op stats" flag
+  bool get_op_stats()
+    { return op_stats; }
+
+  // Sets the "optimize" flag (-no-opt)
+  void set_optimize(bool o)
+    { optimize = o; }
+
+  // Gets the "optimize" flag
+  bool get_optimize()
+    { return optimize; }
+
+  // Sets the "optimization report" flag (-opt-report)
+  void set_opt_report(bool r)
+    { opt_report = r; }
+
+  // Gets the "optimization report" flag
+  bool get_opt_report()
+    { return opt_report; }
+
+  // Sets the "executable" flag (-elf)
+  void set_elf(bool e)
+    { elf = e; }
+
+  // Gets the "executable" flag
+  bool get_elf()
+    { return elf; }
+
+  // Sets the "JIT" flag (-jit)
+  void set_jit(bool j)
+    { jit = j; }
+
+  // Gets the "JIT" flag
+  bool get_jit()
+    { return jit; }
+
+  // Sets the "dump IR" flag (-dump-ir)
+  void set_dump_ir(bool d)
+    { dump_ir = d; }
+
+  // Gets the "dump IR" flag
+  bool get_dump_ir()
+    { return dump_ir; }
+
+  // Sets the "time passes" flag (-time-passes)
+  void set_time_passes(bool t)
+    { time_passes = t; }
+
+  // Gets the "time passes" flag
+  bool get_time_passes()
+    { return time_passes; }
+
+  // Sets the "stats" flag (-stats)
+  void set_stats(bool s)
+    { stats = s; }
+
+  // Gets the "stats" flag
+  bool get_stats()
+    { return stats; }
+
+  // Sets how the interpreter is profiled (-profile or -profile-sample)
+  void set_profile(ProfileMode p)
+    { profile = p; }
+
+  // Gets how the interpreter is profiled
+  ProfileMode get_profile()
+    { return profile; }
+
+  // Sets the file the profiler writes folded stacks to (-profile-folded)
+  void set_folded(const std::string& f)
+    { folded = f; }
+
+  // Gets the file for folded stacks, which is empty if there is none
+  std::string get_folded()
+    { return folded; }
+
+  // Sets the "SSE2" flag (-msse2 or -mno-sse2)
+  void set_sse2(bool s)
+    { sse2 = s; }
+
+  // Gets the "SSE2" flag, which is not set unless it was given
+  boost::optional<bool> get_sse2()
+    { return sse2; }
+
 private:
   // The "parse only" flag
   bool parse;
@@ -57,6 +180,42 @@ private:
 
   // Assemble or Interpret?
   bool assemble;
+
+  // The machine to assemble for
+  Target target;
+
+  // Report the node shapes the interpreter executed most?
+  bool op_stats;
+
+  // Run the optimizers?
+  bool optimize;
+
+  // Report what the optimizers did?
+  bool opt_report;
+
+  // Write an executable instead of assembly?
+  bool elf;
+
+  // Run the generated code instead of interpreting?
+  bool jit;
+
+  // Print the IR after the optimizers ran?
+  bool dump_ir;
+
+  // Report how long each IR pass took?
+  bool time_passes;
+
+  // Report the time and memory each file took?
+  bool stats;
+
+  // How to profile the interpreter
+  ProfileMode profile;
+
+  // Where to write the profiler's folded stacks
+  std::string folded;
+
+  // Use SSE2 in the runtime procedures? The default depends on the target.
+  boost::optional<bool> sse2;
 };
 
 void printAST(std::ostream& out, std::shared_ptr<StmtList> ast, std::string filename)
@@ -86,31 +245,178 @@ void typeAST(std::ostream& out, std::shared_ptr<StmtList> ast, std::string filen
   out << std::endl << std::endl;
 }
 
-void interpret(std::ostream& out, std::shared_ptr<StmtList> ast)
+void optimize(std::shared_ptr<StmtList> ast, Options& opt, std::string filename)
+{
+  // Lower the AST to the IR
+  IrProgram program;
+  IrBuilder builder(program);
+  IrOptimizer optimizer(program);
+  optimizer.time("lower", [&] { builder.build(*ast); return program.size(); });
+
+  // Run the passes
+  if (opt.get_optimize())
+    optimizer.run();
+
+  if (opt.get_dump_ir())
+  {
+    std::cerr << "IR of " << filename << ":" << std::endl;
+    program.print(std::cerr);
+    std::cerr << std::endl;
+  }
+
+  // Put what the passes found back into the AST, for every backend to use
+  if (opt.get_optimize())
+  {
+    IrRewriter rewriter(program, builder);
+    optimizer.time("rewrite", [&] { return rewriter.rewrite(*ast); });
+  }
+
+  if (opt.get_time_passes())
+    optimizer.print_timing(std::cerr);
+}
+
+void interpret(std::ostream& out, std::shared_ptr<StmtList> ast, Options& opt, std::string filename, std::ostream* folded)
 {
   // Create the Interpreter
   Interpreter vtor = Interpreter(out);
+  vtor.set_op_stats(opt.get_op_stats());
+  vtor.set_profile(opt.get_profile());
 
   // Pass the visitor to the AST
   ast->accept(vtor);
+
+  // Report which node shapes ran the most
+  if (opt.get_op_stats())
+    vtor.print_op_stats(std::cerr);
+
+  // Report which statements the time went to
+  if (opt.get_profile() != ProfileMode::OFF)
+  {
+    out.flush();
+    vtor.print_profile(std::cerr, filename);
+    if (folded)
+      vtor.write_folded(*folded, filename);
+  }
 }
 
-void assemble(std::ostream& out, std::shared_ptr<StmtList> ast)
+void generate(AssemblyVisitor& ator, std::shared_ptr<StmtList> ast, Options& opt)
 {
-  // Create the AssemblyVisitor
-  AssemblyVisitor ator = AssemblyVisitor();
+  if (opt.get_sse2())
+    ator.get_structure().set_sse2(*opt.get_sse2());
 
   // Pass the visitor to the AST
   ast->accept(ator);
-	
-  // Output to assembly
-  ator.output(out);
+
+  // Clean up the generated instructions
+  if (opt.get_optimize())
+  {
+    PeepholeOptimizer peephole(ator.get_structure());
+    peephole.run();
+    if (opt.get_opt_report())
+      peephole.print_report(std::cerr);
+  }
+}
+
+void assemble(std::ostream& out, std::shared_ptr<StmtList> ast, Options& opt)
+{
+  // Create the AssemblyVisitor and generate the code
+  AssemblyVisitor ator = AssemblyVisitor(opt.get_target());
+  generate(ator, ast, opt);
+
+  if (opt.get_elf())
+  { // Output an executable
+    ElfWriter writer(ator.get_structure());
+    writer.write(out);
+  }
+  else // Output to assembly
+    ator.output(out);
+}
+
+int jit(std::ostream& out, std::shared_ptr<StmtList> ast, Options& opt)
+{
+  // Generate code for the machine this is running on
+  AssemblyVisitor ator = AssemblyVisitor(Target::X86_64);
+  generate(ator, ast, opt);
+
+  // Run it here
+  Jit jit(ator.get_structure(), out, std::cin);
+  return jit.run();
+}
+
+// Parses one opened file, then prints, checks, and runs or assembles it.
+// Each step is timed as a phase of stats.
+// Gives the exit status for the file, and throws an Exception when it has an error.
+int run_file(Options& opt, std::ostream& out, std::istream& file, std::string filename, Stats& stats,
+              std::ostream* folded)
+{
+  // Start the lexer.
+  // To time it apart from the parser, it reads the whole file first.
+  Lexer lexer(file);
+  if (opt.get_stats())
+    stats.phase("lex", [&] { lexer.read_all(); });
+
+  // Start the parser,
+  // parse the file
+  std::shared_ptr<StmtList> ast;
+  unsigned long nodes = ASTNode::count();
+  stats.phase("parse", [&] { ast = Parser(lexer).parse(); });
+  stats.set_tokens(lexer.get_count());
+  stats.set_nodes(ASTNode::count() - nodes);
+
+  if (!ast)
+  {
+    std::cerr << "No code was found in '" << filename << "'." << std::endl;
+    return 1;
+  }
+
+  // Stop here if parsing was all that was specified
+  if (opt.parse_only())
+    return 0;
+
+  // Print out the filename and the AST
+  if (opt.get_print())
+    stats.phase("print", [&] { printAST(out, ast, filename); });
+
+  // Catch variable errors
+  stats.phase("type-check", [&] { typeAST(out, ast, filename, opt.get_print()); });
+
+  // Optimize it for whichever backend runs it
+  if (opt.get_optimize() || opt.get_dump_ir() || opt.get_time_passes())
+    stats.phase("optimize", [&] { optimize(ast, opt, filename); });
+
+  if (opt.get_assemble())
+  { // Covert to assembly
+    stats.phase("assemble", [&] { assemble(out, ast, opt); });
+  }
+  else if (opt.get_jit())
+  { // Run the generated code
+    int status = 0;
+    stats.phase("jit", [&] { status = jit(out, ast, opt); });
+    return status;
+  }
+  else
+  { // Interpret the file
+    stats.phase("interpret", [&] { interpret(out, ast, opt, filename, folded); });
+  }
+  return 0;
 }
 
 // Runs the meat and potatoes of the program
 // Parses every file passed in in the files parameter
-void run(Options& opt, std::ostream& out, std::deque<std::string>& files)
+// Gives 0 if every file was handled, or the status of the first that was not
+int run(Options& opt, std::ostream& out, std::deque<std::string>& files)
 {
+  int status = 0;
+
+  // Where the profiler writes the stacks, if anywhere
+  std::ofstream folded;
+  if (!opt.get_folded().empty())
+  {
+    folded.open(opt.get_folded());
+    if (!folded.is_open())
+      std::cerr << "ERROR: Unable to open '" << opt.get_folded() << "'" << std::endl;
+  }
+
   // Loop through all passed in files
 	for (std::string filename: files)
   {
@@ -119,60 +425,50 @@ void run(Options& opt, std::ostream& out, std::deque<std::string>& files)
     if(!file.is_open())
     {
       std::cerr << "ERROR: Unable to open '" << filename << "'" << std::endl;
+      if (status == 0)
+        status = 1;
       continue;
     }
 
     // Parses the file then prints the resulting AST
+    Stats stats(filename, opt.get_stats());
     try
     {
-      // Start the lexer
-      Lexer lexer(file);
-
-      // Start the parser,
-      // parse the file
-      std::shared_ptr<StmtList> ast = Parser(lexer).parse();
-
-      if (!ast)
-      {
-    	  std::cerr << "No code was found in '" << filename << "'." << std::endl;
-    	  continue;
-      }
-
-      // Stop here if parsing was all that was specified
-      if (opt.parse_only())
-        continue;
-
-      // Print out the filename and the AST
-      if (opt.get_print())
-        printAST(out, ast, filename);
-
-      // Catch variable errors
-      typeAST(out, ast, filename, opt.get_print());
-
-      if (opt.get_assemble())
-      { // Covert to assembly
-        assemble(out, ast);
-      }
-      else
-      { // Interpret the file
-        interpret(out, ast);
-      }
+      int file_status = run_file(opt, out, file, filename, stats, folded.is_open() ? &folded : nullptr);
+      if (status == 0)
+        status = file_status;
     }
     catch(Exception e)
     {
+      stats.set_ok(false);
+      if (status == 0)
+        status = 1;
       std::cerr << "In file " << filename << ":" << std::endl
           << e.what() << std::endl;
     }
 
+    // Report where the time and memory went, after the program's own output
+    if (opt.get_stats())
+    {
+      out.flush();
+      stats.write(std::cerr);
+    }
+
     // Close the stream
     file.close();
   }
+
+  return status;
 }
 
 // The main function for this program.
 // Checks for proper arguments, exits if they are incorrect.
 int main(int argc, char *argv[])
 {
+  // Nothing uses C stdio, so the standard streams can keep buffers of their
+  // own. The interpreter and the JIT then read the input in blocks.
+  std::ios::sync_with_stdio(false);
+
   // The options that determine how the program runs
   Options opt = Options();
 
@@ -206,11 +502,96 @@ int main(int argc, char *argv[])
       // Do not interpret, just convert to assembly
       opt.set_assemble(true);
     }
+    else if (arg.compare("-m64") == 0)
+    {
+      // Generate 64-bit assembly
+      opt.set_target(Target::X86_64);
+    }
+    else if (arg.compare("-msse2") == 0)
+    {
+      // Use SSE2 in the runtime procedures, even for 32-bit
+      opt.set_sse2(true);
+    }
+    else if (arg.compare("-mno-sse2") == 0)
+    {
+      // Use only the general purpose registers, even for 64-bit
+      opt.set_sse2(false);
+    }
     else if (arg.compare("-no-print") == 0)
     {
       // Don't print out the ASTs
       opt.set_print(false);
     }
+    else if (arg.compare("-op-stats") == 0)
+    {
+      // Report the node shapes the interpreter executed most
+      opt.set_op_stats(true);
+    }
+    else if (arg.compare("-no-opt") == 0)
+    {
+      // Run and output the program as written
+      opt.set_optimize(false);
+    }
+    else if (arg.compare("-opt-report") == 0)
+    {
+      // Report what the optimizers did
+      opt.set_opt_report(true);
+    }
+    else if (arg.compare("-elf") == 0)
+    {
+      // Write an executable instead of assembly.
+      // The AST would end up inside it, so it is not printed.
+      opt.set_elf(true);
+      opt.set_print(false);
+    }
+    else if (arg.compare("-jit") == 0)
+    {
+      // Run the generated code instead of interpreting
+      opt.set_jit(true);
+    }
+    else if (arg.compare("-dump-ir") == 0)
+    {
+      // Print the IR after the optimizers ran
+      opt.set_dump_ir(true);
+    }
+    else if (arg.compare("-time-passes") == 0)
+    {
+      // Report how long each IR pass took
+      opt.set_time_passes(true);
+    }
+    else if (arg.compare("-stats") == 0)
+    {
+      // Report the time and memory each file took, as JSON lines
+      opt.set_stats(true);
+    }
+    else if (arg.compare("-profile") == 0)
+    {
+      // Count and time every statement the interpreter runs
+      opt.set_profile(ProfileMode::TIME);
+    }
+    else if (arg.compare("-profile-sample") == 0)
+    {
+      // Sample the statement the interpreter is running every millisecond
+      if (Profiler::can_sample())
+        opt.set_profile(ProfileMode::SAMPLE);
+      else
+      {
+        std::cerr << "Sampling needs a Linux host. Profiling every statement instead." << std::endl;
+        opt.set_profile(ProfileMode::TIME);
+      }
+    }
+    else if (arg.compare("-profile-folded") == 0)
+    {
+      if (++i < argc)
+      {
+        // Write the profiler's stacks for flame graph tools
+        opt.set_folded(argv[i]);
+        if (opt.get_profile() == ProfileMode::OFF)
+          opt.set_profile(ProfileMode::TIME);
+      }
+      else
+        std::cerr << "Argument error. No filename specified after the -profile-folded flag." << std::endl;
+    }
     else
       // Add the file to the parse list
       files.push_back(arg);
@@ -221,7 +602,7 @@ int main(int argc, char *argv[])
 
   // Open the output file stream if an output file was specified
   if (output_file.size() > 0)
-    out_stream.open(output_file, std::ios::out);
+    out_stream.open(output_file, opt.get_elf() ? std::ios::out | std::ios::binary : std::ios::out);
 
   // Where to post the output
   std::ostream& outFile = (output_file.size() > 0 ? out_stream : std::cout);
@@ -229,12 +610,24 @@ int main(int argc, char *argv[])
   // Check that there are files specified
 	if (files.empty())
 	{
-		std::cerr << "USAGE: " << argv[0] << " [-no-print] [-a] [-o output_filename] file [file] [file] [...]" << std::endl;
+		std::cerr << "USAGE: " << argv[0] << " [-no-print] [-a] [-m64] [-msse2] [-mno-sse2] [-op-stats] [-no-opt] [-opt-report] [-elf] [-jit] [-dump-ir] [-time-passes] [-stats] [-profile] [-profile-sample] [-profile-folded stacks_filename] [-o output_filename] file [file] [file] [...]" << std::endl;
 		return -1;
 	}
 
   // Run the program
-  run(opt, outFile, files);
+  int status = run(opt, outFile, files);
+
+  // Let the executable be run, if it was written whole
+  if (opt.get_elf() && output_file.size() > 0)
+  {
+    out_stream.close();
+    if (status != 0)
+      std::remove(output_file.c_str());
+#ifdef CHMOD_SUPPORTED
+    else
+      chmod(output_file.c_str(), 0755);
+#endif
+  }
 
-	return 0;
+	return status;
 }